@@ -26,6 +26,7 @@
 #include <specific_includes/linux/if_arp.h>
 #include <specific_includes/linux/if_vlan.h>
 #include <specific_includes/linux/ip.h>
+#include <specific_includes/linux/tcp.h>
 #include <specific_includes/net/ip.h>
 #include <specific_includes/linux/ipv6.h>
 #include <specific_includes/linux/in.h>
@@ -40,65 +41,450 @@
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_timer.h>
+#include <emmintrin.h>
 
 typedef struct
 {
 	int port_number;
+	/* the port's netdev, self for the port's own one */
+	struct net_device *real_dev;
+	/* VLAN sub-interface: its VLAN ID, 0 on the port's netdev */
+	u16 vlan_id;
+	/* port's netdev: sub-interfaces by VLAN ID, allocated with the first one */
+	struct net_device **vlan_devs;
 }dpdk_dev_priv_t;
 
+uint64_t dpdk_dev_rx_vlan_unknown = 0;
+uint64_t dpdk_dev_tx_vlan_failed = 0;
+
+/* drops the 802.1Q tag in place moving the MAC addresses over it (8+4 bytes), returns the TCI */
+static inline u16 dpdk_dev_vlan_untag(struct sk_buff *skb)
+{
+	u8 *p = skb->data;
+	u16 tci = ntohs(((struct vlan_ethhdr *)p)->h_vlan_TCI);
+	u64 macs = *(u64 *)p;
+	u32 macs_tail = *(u32 *)(p + 8);
+
+	*(u32 *)(p + 12) = macs_tail;
+	*(u64 *)(p + VLAN_HLEN) = macs;
+	skb->data += VLAN_HLEN;
+	skb->len -= VLAN_HLEN;
+	return tci;
+}
+
+/* software 802.1Q insertion into the headroom, the stack reserves it (needed_headroom) */
+static inline int dpdk_dev_vlan_insert(struct sk_buff *skb,u16 tci)
+{
+	struct vlan_ethhdr *veth;
+	u8 *p;
+
+	if(unlikely(skb_headroom(skb) < VLAN_HLEN))
+		return -1;
+	p = __skb_push(skb,VLAN_HLEN);
+	*(u64 *)p = *(u64 *)(p + VLAN_HLEN);
+	*(u32 *)(p + 8) = *(u32 *)(p + 8 + VLAN_HLEN);
+	veth = (struct vlan_ethhdr *)p;
+	veth->h_vlan_proto = htons(ETH_P_8021Q);
+	veth->h_vlan_TCI = htons(tci);
+	skb_reset_mac_header(skb);
+	return 0;
+}
+
+/* software GRO: in-order TCP segments of one flow within an rx burst are chained
+ * behind the first one (frag_list), so IP/TCP input, socket lookup and the ACK decision
+ * run once per flow per burst. Every segment keeps its own mbuf, tcp_recvmsg hands them
+ * to the app one by one as before */
+#define DPDK_DEV_GRO_MAX_FLOWS 8
+/* keeps the merged datagram within the IP tot_len */
+#define DPDK_DEV_GRO_MAX_LEN 65000
+
+typedef struct
+{
+	struct sk_buff *skb;
+	struct sk_buff *last;
+	u32 next_seq;
+	int mss;
+	int count;
+}dpdk_dev_gro_flow_t;
+
+uint64_t dpdk_dev_gro_merged = 0;
+uint64_t dpdk_dev_gro_delivered = 0;
+
+/* returns TCP payload length if the segment may be merged, 0 otherwise */
+static inline int dpdk_dev_gro_candidate(struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+	struct tcphdr *th;
+	int tot_len,thlen;
+
+	if((skb->protocol != htons(ETH_P_IP))||skb_is_nonlinear(skb))
+		return 0;
+	if((*(u8 *)iph != 0x45)||(iph->protocol != IPPROTO_TCP))
+		return 0;
+	if(iph->frag_off & htons(IP_MF|IP_OFFSET))
+		return 0;
+	tot_len = ntohs(iph->tot_len);
+	if((tot_len > skb->len)||(tot_len < (int)(sizeof(struct iphdr) + sizeof(struct tcphdr))))
+		return 0;
+	th = (struct tcphdr *)(iph + 1);
+	thlen = th->doff*4;
+	if((thlen < (int)sizeof(struct tcphdr))||(tot_len - (int)sizeof(struct iphdr) <= thlen))
+		return 0;
+	if(tcp_flag_word(th) & (TCP_FLAG_URG|TCP_FLAG_RST|TCP_FLAG_SYN|TCP_FLAG_FIN|TCP_FLAG_CWR))
+		return 0;
+	return tot_len - sizeof(struct iphdr) - thlen;
+}
+
+/* p is a candidate, skb may be any TCP segment, IP options included */
+static inline int dpdk_dev_gro_same_flow(struct sk_buff *p,struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data,*iph2 = (struct iphdr *)p->data;
+	int ihl = iph->ihl*4;
+
+	if((ihl < (int)sizeof(struct iphdr))||(skb_headlen(skb) < ihl + 4))
+		return 0;
+	return (p->dev == skb->dev)&&(iph->saddr == iph2->saddr)&&(iph->daddr == iph2->daddr)&&
+	       (*(u32 *)((u8 *)iph + ihl) == *(u32 *)((u8 *)iph2 + iph2->ihl*4));
+}
+
+static inline void dpdk_dev_gro_flush(dpdk_dev_gro_flow_t *flow,struct sk_buff_head *rx_list)
+{
+	struct iphdr *iph = (struct iphdr *)flow->skb->data;
+	__be16 newlen = htons(flow->skb->len);
+
+	if(flow->count > 1) {
+		csum_replace2(&iph->check,iph->tot_len,newlen);
+		iph->tot_len = newlen;
+		skb_shinfo(flow->skb)->gso_size = flow->mss;
+		skb_shinfo(flow->skb)->gso_segs = flow->count;
+		dpdk_dev_gro_delivered++;
+	}
+	__skb_queue_tail(rx_list,flow->skb);
+	flow->skb = NULL;
+}
+
+static inline void dpdk_dev_gro_flush_all(dpdk_dev_gro_flow_t *flows,int *flows_count,struct sk_buff_head *rx_list)
+{
+	int i;
+
+	for(i = 0;i < *flows_count;i++)
+		dpdk_dev_gro_flush(&flows[i],rx_list);
+	*flows_count = 0;
+}
+
+/* drops ethernet padding so the mbuf ends where the segment does */
+static inline void dpdk_dev_gro_trim(struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+	struct rte_mbuf *m = skb->header_mbuf;
+
+	skb->len = ntohs(iph->tot_len);
+	m->pkt.data_len = (skb->data + skb->len) - (unsigned char *)m->pkt.data;
+	m->pkt.pkt_len = m->pkt.data_len;
+}
+
+static inline void dpdk_dev_gro_start(dpdk_dev_gro_flow_t *flow,struct sk_buff *skb,int payload)
+{
+	struct tcphdr *th = (struct tcphdr *)(skb->data + sizeof(struct iphdr));
+
+	dpdk_dev_gro_trim(skb);
+	flow->skb = skb;
+	flow->last = NULL;
+	flow->next_seq = ntohl(th->seq) + payload;
+	flow->mss = payload;
+	flow->count = 1;
+}
+
+/* returns non-zero if skb was chained into the flow */
+static inline int dpdk_dev_gro_merge(dpdk_dev_gro_flow_t *flow,struct sk_buff *skb,int payload)
+{
+	struct tcphdr *th = (struct tcphdr *)(skb->data + sizeof(struct iphdr));
+	struct tcphdr *th2 = (struct tcphdr *)(flow->skb->data + sizeof(struct iphdr));
+	struct iphdr *iph = (struct iphdr *)skb->data,*iph2 = (struct iphdr *)flow->skb->data;
+	int i,thlen = th->doff*4;
+
+	/* same rules as tcp_gro_receive */
+	if((ntohl(th->seq) != flow->next_seq)||(payload > flow->mss)||
+	   (th->doff != th2->doff)||(th->ack_seq != th2->ack_seq)||
+	   ((tcp_flag_word(th) ^ tcp_flag_word(th2)) & ~TCP_FLAG_PSH)||
+	   (iph->ttl != iph2->ttl)||(iph->tos != iph2->tos)||
+	   ((iph->frag_off ^ iph2->frag_off) & htons(IP_DF))||
+	   (flow->skb->len + payload > DPDK_DEV_GRO_MAX_LEN))
+		return 0;
+	for(i = sizeof(struct tcphdr);i < thlen;i += 4)
+		if(*(u32 *)((u8 *)th + i) != *(u32 *)((u8 *)th2 + i))
+			return 0;
+	tcp_flag_word(th2) |= tcp_flag_word(th) & TCP_FLAG_PSH;
+	dpdk_dev_gro_trim(skb);
+	__skb_pull(skb,sizeof(struct iphdr) + thlen);
+	skb->next = NULL;
+	if(flow->last)
+		flow->last->next = skb;
+	else
+		skb_shinfo(flow->skb)->frag_list = skb;
+	flow->last = skb;
+	flow->skb->len += payload;
+	flow->skb->data_len += payload;
+	flow->skb->truesize += skb->truesize;
+	flow->next_seq += payload;
+	flow->count++;
+	dpdk_dev_gro_merged++;
+	return 1;
+}
+
+static inline void dpdk_dev_gro_remove(dpdk_dev_gro_flow_t *flows,int *flows_count,int idx,struct sk_buff_head *rx_list)
+{
+	dpdk_dev_gro_flush(&flows[idx],rx_list);
+	(*flows_count)--;
+	flows[idx] = flows[*flows_count];
+}
+
+static inline void dpdk_dev_gro_receive(dpdk_dev_gro_flow_t *flows,int *flows_count,struct sk_buff *skb,struct sk_buff_head *rx_list)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+	int i,payload = dpdk_dev_gro_candidate(skb);
+	int tcp = (skb->protocol == htons(ETH_P_IP))&&(iph->protocol == IPPROTO_TCP);
+	struct tcphdr *th;
+
+	for(i = 0;tcp && (i < *flows_count);i++) {
+		if(!dpdk_dev_gro_same_flow(flows[i].skb,skb))
+			continue;
+		if(payload && dpdk_dev_gro_merge(&flows[i],skb,payload)) {
+			th = (struct tcphdr *)(flows[i].skb->data + sizeof(struct iphdr));
+			/* a short or pushed segment ends the train */
+			if((payload < flows[i].mss)||th->psh)
+				dpdk_dev_gro_remove(flows,flows_count,i,rx_list);
+			return;
+		}
+		/* keep the flow in order: what is queued goes up first */
+		if(payload) {
+			dpdk_dev_gro_flush(&flows[i],rx_list);
+			dpdk_dev_gro_start(&flows[i],skb,payload);
+			return;
+		}
+		dpdk_dev_gro_remove(flows,flows_count,i,rx_list);
+		break;
+	}
+	if(!payload) {
+		__skb_queue_tail(rx_list,skb);
+		return;
+	}
+	if(*flows_count == DPDK_DEV_GRO_MAX_FLOWS)
+		dpdk_dev_gro_flush_all(flows,flows_count,rx_list);
+	dpdk_dev_gro_start(&flows[*flows_count],skb,payload);
+	(*flows_count)++;
+}
+
 /* this function polls DPDK PMD driver for the received buffers.
- * It constructs skb and submits it to the stack.
- * netif_receive_skb is used, we don't have HW interrupt/BH contexts here
+ * It constructs skbs for the whole burst and submits them to the stack as a list.
+ * netif_receive_skb_list is used, we don't have HW interrupt/BH contexts here
  */
+uint64_t dpdk_dev_rx_scattered = 0;
+uint64_t dpdk_dev_rx_scattered_dropped = 0;
+
+/* a scattered (jumbo) frame: the segments after the first one become skbs on frag_list,
+ * the layout GRO builds too, so TCP and UDP hand them to the app as an mbuf chain.
+ * On failure skb and the rest of the chain are freed */
+static inline int dpdk_dev_rx_scatter(struct sk_buff *skb)
+{
+	struct rte_mbuf *m = skb->header_mbuf->pkt.next,*next;
+	struct sk_buff *frag,*last = NULL;
+
+	skb->header_mbuf->pkt.next = NULL;
+	for(;m;m = next) {
+		next = m->pkt.next;
+		m->pkt.next = NULL;
+		DPDK_MBUF_TX_TAG(m) = 0;
+		frag = build_skb(m,m->pkt.data_len);
+		if(unlikely(frag == NULL)) {
+			m->pkt.next = next;
+			rte_pktmbuf_free(m);
+			kfree_skb(skb);
+			dpdk_dev_rx_scattered_dropped++;
+			return -1;
+		}
+		frag->len = m->pkt.data_len;
+		if(last)
+			last->next = frag;
+		else
+			skb_shinfo(skb)->frag_list = frag;
+		last = frag;
+		skb->len += frag->len;
+		skb->data_len += frag->len;
+		skb->truesize += frag->truesize;
+	}
+	dpdk_dev_rx_scattered++;
+	return 0;
+}
+
+uint64_t dpdk_dev_rx_csum_hw = 0;
+uint64_t dpdk_dev_rx_csum_sw = 0;
+uint64_t dpdk_dev_rx_csum_bad = 0;
+
+/* ones' complement sum, 16 bytes per step: the 32 bit words are added to two 64 bit lanes
+ * and folded at the end, the way csum_partial adds them with carries */
+static inline __wsum dpdk_dev_csum_sse(const u8 *buf,int len)
+{
+	__m128i acc = _mm_setzero_si128(),zero = _mm_setzero_si128(),x;
+	u64 lanes[2],sum;
+
+	for(;len >= 16;len -= 16,buf += 16) {
+		x = _mm_loadu_si128((const __m128i *)buf);
+		acc = _mm_add_epi64(acc,_mm_unpacklo_epi32(x,zero));
+		acc = _mm_add_epi64(acc,_mm_unpackhi_epi32(x,zero));
+	}
+	_mm_storeu_si128((__m128i *)lanes,acc);
+	sum = lanes[0] + lanes[1];
+	for(;len >= 4;len -= 4,buf += 4)
+		sum += *(const u32 *)buf;
+	if(len >= 2) {
+		sum += *(const u16 *)buf;
+		buf += 2;
+		len -= 2;
+	}
+	if(len)
+		sum += *buf;
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	return (__force __wsum)sum;
+}
+
+/* returns the IPv4 header of a TCP/UDP datagram whose L4 checksum can be verified here, NULL otherwise */
+static inline struct iphdr *dpdk_dev_rx_csum_l4(struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+
+	if(skb->protocol != htons(ETH_P_IP))
+		return NULL;
+	if((skb_headlen(skb) < (int)sizeof(struct iphdr))||(iph->ihl < 5)||
+	   ((iph->protocol != IPPROTO_TCP)&&(iph->protocol != IPPROTO_UDP)))
+		return NULL;
+	if((iph->frag_off & htons(IP_MF|IP_OFFSET))||(ntohs(iph->tot_len) > skb->len)||
+	   (ntohs(iph->tot_len) <= iph->ihl*4)||(skb_headlen(skb) < iph->ihl*4 + 8))
+		return NULL;
+	return iph;
+}
+
+/* non-zero if the L4 checksum is right, sums the linear part and the frag_list segments */
+static inline int dpdk_dev_rx_csum_verify(struct sk_buff *skb,struct iphdr *iph)
+{
+	int l4_len = ntohs(iph->tot_len) - iph->ihl*4,off = 0,len;
+	__wsum csum = csum_tcpudp_nofold(iph->saddr,iph->daddr,l4_len,iph->protocol,0);
+	struct sk_buff *frag;
+
+	if((iph->protocol == IPPROTO_UDP)&&(((struct udphdr *)((u8 *)iph + iph->ihl*4))->check == 0))
+		return 1;
+	len = min_t(int,skb_headlen(skb) - iph->ihl*4,l4_len);
+	csum = csum_add(csum,dpdk_dev_csum_sse((u8 *)iph + iph->ihl*4,len));
+	off += len;
+	skb_walk_frags(skb,frag) {
+		if(off >= l4_len)
+			break;
+		len = min_t(int,frag->len,l4_len - off);
+		csum = csum_block_add(csum,dpdk_dev_csum_sse(frag->data,len),off);
+		off += len;
+	}
+	return csum_fold(csum) == 0;
+}
+
+/* TCP/UDP datagrams the NIC verified are CHECKSUM_UNNECESSARY.
+ * The rest are verified here in a pass over the burst, the bad ones dropped.
+ * Whatever cannot be verified here (fragments, other protocols) goes up as CHECKSUM_NONE */
+static inline void dpdk_dev_rx_csum_burst(struct net_device *netdev,struct sk_buff **skbs,int count)
+{
+	struct iphdr *iph;
+	int i,hw = netdev->features & NETIF_F_RXCSUM;
+
+	for(i = 0;i < count;i++) {
+		if(unlikely(skbs[i] == NULL))
+			continue;
+		iph = dpdk_dev_rx_csum_l4(skbs[i]);
+		if(unlikely(iph == NULL)) {
+			skbs[i]->ip_summed = CHECKSUM_NONE;
+			continue;
+		}
+		if(hw && !(skbs[i]->header_mbuf->ol_flags & (PKT_RX_IP_CKSUM_BAD|PKT_RX_L4_CKSUM_BAD))) {
+			skbs[i]->ip_summed = CHECKSUM_UNNECESSARY;
+			dpdk_dev_rx_csum_hw++;
+			continue;
+		}
+		if(unlikely(!dpdk_dev_rx_csum_verify(skbs[i],iph))) {
+			kfree_skb(skbs[i]);
+			skbs[i] = NULL;
+			dpdk_dev_rx_csum_bad++;
+			continue;
+		}
+		skbs[i]->ip_summed = CHECKSUM_UNNECESSARY;
+		dpdk_dev_rx_csum_sw++;
+	}
+}
+
 static void rx_construct_skb_and_submit(struct net_device *netdev)
 {
-	int size = MAX_PKT_BURST,ret,i,frag_idx;
-	struct rte_mbuf *mbufs[MAX_PKT_BURST],*m;
-	struct sk_buff *skb;
-        struct ethhdr *eth;
+	int size = MAX_PKT_BURST,ret,i;
+	struct rte_mbuf *mbufs[MAX_PKT_BURST];
+	struct sk_buff *skb,*skbs[MAX_PKT_BURST];
+	struct net_device *dev;
+	u16 vlan_tci;
 	dpdk_dev_priv_t *priv = netdev_priv(netdev);
+	uint64_t rx_tsc;
+	dpdk_dev_gro_flow_t gro_flows[DPDK_DEV_GRO_MAX_FLOWS];
+	int gro_flows_count = 0;
+	struct sk_buff_head rx_list;
 
 	ret = dpdk_dev_get_received(priv->port_number,mbufs,size);
 	if(unlikely(ret <= 0)) {
 		return;
 	}
+	/* PMDs here have no per-packet hw timestamp, the whole burst gets the same stamp */
+	rx_tsc = rte_rdtsc();
+	__skb_queue_head_init(&rx_list);
         for(i = 0;i < ret;i++) {
             rte_prefetch0(rte_pktmbuf_mtod(mbufs[i],void *));
+            DPDK_MBUF_RX_TSC(mbufs[i]) = rx_tsc;
+            DPDK_MBUF_TX_TAG(mbufs[i]) = 0;
         }
 	for(i = 0;i < ret;i++) {
+		skbs[i] = NULL;
 		skb = build_skb(mbufs[i],mbufs[i]->pkt.data_len);
 		if(unlikely(skb == NULL)) {
 			rte_pktmbuf_free(mbufs[i]);
 			continue;
 		}
 		skb->len = mbufs[i]->pkt.data_len;
-#if 0 /* once the receive will scatter the packets, this will be needed */
-		m = mbufs[i]->pkt.next;
-		frag_idx = 0;
-		while(unlikely(m)) {
-			struct page pg;
-
-			pg.mbuf = m;
-			skb_add_rx_frag(skb,frag_idx,&pg,0,m->pkt.data_len,m->pkt.data_len);
-			frag_idx++;
-			m = m->pkt.next;
+		if(unlikely(mbufs[i]->pkt.nb_segs > 1)&&dpdk_dev_rx_scatter(skb))
+			continue;
+		/* tag still in the frame, or stripped by the NIC into the mbuf */
+		vlan_tci = 0;
+		if(unlikely(((struct ethhdr *)skb->data)->h_proto == htons(ETH_P_8021Q)))
+			vlan_tci = dpdk_dev_vlan_untag(skb);
+		else if((mbufs[i]->ol_flags & PKT_RX_VLAN_PKT)&&(netdev->features & NETIF_F_HW_VLAN_CTAG_RX))
+			vlan_tci = mbufs[i]->pkt.vlan_macip.f.vlan_tci;
+		dev = netdev;
+		if(unlikely(vlan_tci & VLAN_VID_MASK)) {
+			dev = priv->vlan_devs ? priv->vlan_devs[vlan_tci & VLAN_VID_MASK] : NULL;
+			if(unlikely(dev == NULL)) {
+				kfree_skb(skb);
+				dpdk_dev_rx_vlan_unknown++;
+				continue;
+			}
 		}
-#endif
-                /* removing vlan tagg */
-                eth = (struct ethhdr *)skb->data;
-                if(eth->h_proto == htons(ETH_P_8021Q)) {
-                    unsigned i = 0;
-                    uint8_t *hdr_str = (uint8_t *) skb->data;
-                    for(i = 0; i < 12 ; i++)
-                        hdr_str[(11 - i) + 4] = hdr_str[(11-i)];
-                    skb->data = &hdr_str[4];
-                    skb->len = skb->len - 4;
-                }
-		skb->protocol = eth_type_trans(skb, netdev);
-		skb->ip_summed = CHECKSUM_UNNECESSARY;
-		skb->dev = netdev;
-		netif_receive_skb(skb);
+		skb->protocol = eth_type_trans(skb, dev);
+		skb->dev = dev;
+		skbs[i] = skb;
+	}
+	dpdk_dev_rx_csum_burst(netdev,skbs,ret);
+	for(i = 0;i < ret;i++) {
+		skb = skbs[i];
+		if(unlikely(skb == NULL))
+			continue;
+		if(netdev->features & NETIF_F_GRO)
+			dpdk_dev_gro_receive(gro_flows,&gro_flows_count,skb,&rx_list);
+		else
+			__skb_queue_tail(&rx_list,skb);
 	}
+	dpdk_dev_gro_flush_all(gro_flows,&gro_flows_count,&rx_list);
+	netif_receive_skb_list(&rx_list);
 }
 
 static int dpdk_open(struct net_device *netdev)
@@ -111,14 +497,127 @@ static int dpdk_close(struct net_device *netdev)
 {
 	return 0;
 }
+#ifdef GSO
+uint64_t dpdk_dev_gso_frames = 0;
+uint64_t dpdk_dev_gso_segments = 0;
+uint64_t dpdk_dev_gso_failed = 0;
+
+/* an indirect mbuf referencing len bytes at data inside md, no copy */
+static inline struct rte_mbuf *dpdk_dev_gso_ref(struct rte_mempool *pool,struct rte_mbuf *md,char *data,int len)
+{
+	struct rte_mbuf *mi = rte_pktmbuf_alloc(pool);
+
+	if(unlikely(mi == NULL))
+		return NULL;
+	rte_pktmbuf_attach(mi,RTE_MBUF_FROM_BADDR(md->buf_addr));
+	mi->pkt.data = data;
+	mi->pkt.data_len = len;
+	mi->pkt.pkt_len = len;
+	return mi;
+}
+
+/* software TSO: the frame is cut into gso_size segments in the driver.
+ * Each segment gets a copy of the headers with seq/len/id fixed up
+ * and references the payload it covers, the NIC does the checksums as for any frame.
+ * rte_mbuf of DPDK 1.6 has no way to ask the PMD for TSO, so this is the only path */
+static void dpdk_dev_gso_xmit(struct sk_buff *skb,int port_num,u16 hw_vlan_tci)
+{
+	struct rte_mempool *pool = skb->header_mbuf->pool;
+	struct iphdr *iph = ip_hdr(skb),*seg_iph;
+	struct tcphdr *th = tcp_hdr(skb),*seg_th;
+	int l2_len = skb_network_offset(skb),l3_len = ip_hdrlen(skb);
+	int hdr_len = skb_transport_offset(skb) + tcp_hdrlen(skb);
+	int mss = skb_shinfo(skb)->gso_size;
+	int left = skb->len - hdr_len,seg_len,piece,seg_idx = 0;
+	/* current payload source: linear tail of the header mbuf, then the frags */
+	int frag_idx = -1,src_left = skb_headlen(skb) - hdr_len;
+	char *src = (char *)skb->data + hdr_len;
+	struct rte_mbuf *src_mbuf = skb->header_mbuf,*seg,**next;
+
+	dpdk_dev_gso_frames++;
+	while(left > 0) {
+		seg_len = left > mss ? mss : left;
+		seg = rte_pktmbuf_alloc(pool);
+		if(unlikely(seg == NULL)) {
+			dpdk_dev_gso_failed++;
+			return;
+		}
+		rte_memcpy(seg->pkt.data,skb->data,hdr_len);
+		seg->pkt.data_len = hdr_len;
+		seg->pkt.pkt_len = hdr_len + seg_len;
+		seg->pkt.nb_segs = 1;
+		next = &seg->pkt.next;
+		for(piece = seg_len;piece > 0;) {
+			while(src_left == 0) {
+				frag_idx++;
+				src_mbuf = skb_frag_page(&skb_shinfo(skb)->frags[frag_idx]);
+				src = (char *)src_mbuf->pkt.data + skb_shinfo(skb)->frags[frag_idx].page_offset;
+				src_left = skb_frag_size(&skb_shinfo(skb)->frags[frag_idx]);
+			}
+			*next = dpdk_dev_gso_ref(pool,src_mbuf,src,piece < src_left ? piece : src_left);
+			if(unlikely(*next == NULL)) {
+				dpdk_dev_gso_failed++;
+				rte_pktmbuf_free(seg);
+				return;
+			}
+			src += (*next)->pkt.data_len;
+			src_left -= (*next)->pkt.data_len;
+			piece -= (*next)->pkt.data_len;
+			seg->pkt.nb_segs++;
+			next = &(*next)->pkt.next;
+		}
+		seg_iph = (struct iphdr *)((char *)seg->pkt.data + l2_len);
+		seg_th = (struct tcphdr *)((char *)seg_iph + l3_len);
+		seg_iph->tot_len = htons(hdr_len - l2_len + seg_len);
+		seg_iph->id = htons(ntohs(iph->id) + seg_idx);
+		seg_iph->check = 0;
+		seg_th->seq = htonl(ntohl(th->seq) + seg_idx*mss);
+		if(seg_idx)
+			seg_th->cwr = 0;
+		if(left > seg_len) {
+			seg_th->fin = 0;
+			seg_th->psh = 0;
+		}
+		seg_th->check = ~csum_tcpudp_magic(iph->saddr,iph->daddr,
+						   hdr_len - l2_len - l3_len + seg_len,IPPROTO_TCP,0);
+		seg->ol_flags = PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM;
+		seg->pkt.vlan_macip.f.l3_len = l3_len;
+		seg->pkt.vlan_macip.f.l2_len = l2_len;
+		if(hw_vlan_tci) {
+			seg->ol_flags |= PKT_TX_VLAN_PKT;
+			seg->pkt.vlan_macip.f.vlan_tci = hw_vlan_tci;
+		}
+		dpdk_dev_enqueue_for_tx(port_num,seg);
+		dpdk_dev_gso_segments++;
+		left -= seg_len;
+		seg_idx++;
+	}
+}
+#endif
 static netdev_tx_t dpdk_xmit_frame(struct sk_buff *skb,
                                   struct net_device *netdev)
 {
 	int i,pkt_len = 0;
 	struct rte_mbuf **mbuf,*head;
+	struct sk_buff *frag;
 	dpdk_dev_priv_t *priv = netdev_priv(netdev);
 	skb_dst_force(skb);
 
+	if(priv->vlan_id && !(netdev->features & NETIF_F_HW_VLAN_CTAG_TX)) {
+		if(unlikely(dpdk_dev_vlan_insert(skb,priv->vlan_id))) {
+			dpdk_dev_tx_vlan_failed++;
+			kfree_skb(skb);
+			return NETDEV_TX_OK;
+		}
+	}
+#ifdef GSO
+	if(skb_is_gso(skb)) {
+		dpdk_dev_gso_xmit(skb,priv->port_number,
+				  (netdev->features & NETIF_F_HW_VLAN_CTAG_TX) ? priv->vlan_id : 0);
+		kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
+#endif
 	head = skb->header_mbuf;
 	head->pkt.data_len = skb_headroom(skb) + skb_headlen(skb);
 	/* across all the stack, pkt.data in rte_mbuf is not moved while skb's data is.
@@ -140,23 +639,24 @@ static netdev_tx_t dpdk_xmit_frame(struct sk_buff *skb,
 		pkt_len += (*mbuf)->pkt.data_len;
 		mbuf = &((*mbuf)->pkt.next);
 	}
+	/* a frame longer than a header mbuf, built by ip_append_data as one skb per mbuf */
+	skb_walk_frags(skb,frag) {
+		*mbuf = frag->header_mbuf;
+		frag->header_mbuf = NULL;
+		(*mbuf)->pkt.data = frag->data;
+		(*mbuf)->pkt.data_len = skb_headlen(frag);
+		pkt_len += (*mbuf)->pkt.data_len;
+		mbuf = &((*mbuf)->pkt.next);
+		head->pkt.nb_segs += 1 + skb_shinfo(frag)->nr_frags;
+		for (i = 0; i < (int)skb_shinfo(frag)->nr_frags; i++) {
+			*mbuf = skb_shinfo(frag)->frags[i].page.p;
+			skb_frag_ref(frag,i);
+			pkt_len += (*mbuf)->pkt.data_len;
+			mbuf = &((*mbuf)->pkt.next);
+		}
+	}
         *mbuf = NULL;
 	head->pkt.pkt_len = pkt_len;
-#ifdef GSO
-        if ((skb->protocol == htons(ETH_P_IP))&&(ip_hdr(skb)->protocol == IPPROTO_TCP)&&(i> 0)) {
-                 struct iphdr *iph = ip_hdr(skb);
-                 head->pkt.vlan_macip.data = skb_network_header_len(skb) | (skb_network_offset(skb) << 9);
-                 head->pkt.hash.fdir.hash = tcp_hdrlen(skb); /* ugly, but no other place */
-                 head->pkt.hash.fdir.id = skb_transport_offset(skb);
-                 head->ol_flags = PKT_TX_TCP_CKSUM | PKT_TX_IP_CKSUM;
-                 iph->tot_len = 0;
-                 iph->check = 0; 
-                 tcp_hdr(skb)->check = ~csum_tcpudp_magic(iph->saddr,
-                                                          iph->daddr, 0,
-                                                          IPPROTO_TCP,
-                                                          0);
-        }
-#else 
        if (skb->protocol == htons(ETH_P_IP)) {
            head->ol_flags = PKT_TX_IP_CKSUM;        
            struct iphdr *iph = ip_hdr(skb);
@@ -168,7 +668,10 @@ static netdev_tx_t dpdk_xmit_frame(struct sk_buff *skb,
            else if(ip_hdr(skb)->protocol == IPPROTO_UDP)
                head->ol_flags |= PKT_TX_UDP_CKSUM;
        }
-#endif
+	if(priv->vlan_id && (netdev->features & NETIF_F_HW_VLAN_CTAG_TX)) {
+		head->ol_flags |= PKT_TX_VLAN_PKT;
+		head->pkt.vlan_macip.f.vlan_tci = priv->vlan_id;
+	}
 	/* this will pass the mbuf to DPDK PMD driver */
 	dpdk_dev_enqueue_for_tx(priv->port_number,head);
 	kfree_skb(skb);
@@ -177,7 +680,25 @@ static netdev_tx_t dpdk_xmit_frame(struct sk_buff *skb,
 static struct rtnl_link_stats64 *dpdk_get_stats64(struct net_device *netdev,
                                                  struct rtnl_link_stats64 *stats)
 {
-	return NULL;
+	dpdk_dev_priv_t *priv = netdev_priv(netdev);
+	dpdk_dev_nic_stats_t nic_stats;
+
+	/* the NIC counts all VLANs of the port together, sub-interfaces report none */
+	if(priv->real_dev != netdev)
+		return stats;
+	if(dpdk_dev_get_nic_stats(priv->port_number,&nic_stats))
+		return stats;
+	stats->rx_packets = nic_stats.rx_packets;
+	stats->tx_packets = nic_stats.tx_packets;
+	stats->rx_bytes = nic_stats.rx_bytes;
+	stats->tx_bytes = nic_stats.tx_bytes;
+	stats->rx_errors = nic_stats.rx_errors;
+	stats->tx_errors = nic_stats.tx_errors;
+	stats->multicast = nic_stats.rx_multicast;
+	stats->rx_missed_errors = nic_stats.rx_missed;
+	stats->rx_dropped = nic_stats.rx_nombuf;
+	stats->tx_dropped = nic_stats.stack_tx_dropped;
+	return stats;
 }
 static void dpdk_set_rx_mode(struct net_device *netdev)
 {
@@ -192,8 +713,17 @@ static int dpdk_set_mac(struct net_device *netdev, void *p)
     memcpy(netdev->dev_addr, addr->sa_data, netdev->addr_len);
 	return 0;
 }
+int dpdk_dev_max_rx_pkt_len[RTE_MAX_ETHPORTS];
+
 static int dpdk_change_mtu(struct net_device *netdev, int new_mtu)
 {
+	dpdk_dev_priv_t *priv = netdev_priv(netdev);
+	/* 0 if the port was not configured through the PMD (software loop) */
+	int max_len = dpdk_dev_max_rx_pkt_len[priv->port_number] ? dpdk_dev_max_rx_pkt_len[priv->port_number] : DPDK_DEV_MAX_RX_PKT_LEN;
+
+	if((new_mtu < 68)||(new_mtu > max_len - ETH_HLEN - VLAN_HLEN - ETH_FCS_LEN))
+		return -EINVAL;
+	netdev->mtu = new_mtu;
 	return 0;
 }
 static int dpdk_ioctl(struct net_device *netdev, struct ifreq *ifr, int cmd)
@@ -242,7 +772,7 @@ static void dpdk_netpoll(struct net_device *netdev)
 	/* check for received packets.
 	 * Then check if there are mbufs ready for tx, but not submitted yet
 	 */
-	rx_construct_skb_and_submit(netdev);
+	rx_construct_skb_and_submit(priv->real_dev);
 }
 static netdev_features_t dpdk_fix_features(struct net_device *netdev,
          netdev_features_t features)
@@ -353,10 +883,9 @@ void set_dev_addr(void *netdev,char *mac_addr,char *ip_addr,char *ip_mask)
 		printf("netdev is NULL%s %d\n",__FILE__,__LINE__);
 		goto leave;
 	}
-        dev->mtu = 1500;
 #ifdef GSO
-        dev->gso_max_segs = 2;
-        dev->gso_max_size = 4096;
+        /* one payload mbuf per frag, TCP splits bigger frames before they get here */
+        dev->gso_max_segs = MAX_SKB_FRAGS;
 #endif
 	memcpy(macaddr.sa_data,mac_addr,ETH_ALEN);
 	memset(&ifr,0,sizeof(ifr));
@@ -397,6 +926,17 @@ leave:
 	kernel_close(sock);
 }
 
+int set_dev_mtu(void *netdev,int mtu)
+{
+	struct net_device *dev = (struct net_device *)netdev;
+	int rc;
+
+	rc = dev_set_mtu(dev,mtu);
+	if(rc)
+		printf("cannot set MTU %d on %s %s %d\n",mtu,dev->name,__FILE__,__LINE__);
+	return rc;
+}
+
 void *create_netdev(int port_num)
 {
 	struct net_device *netdev;
@@ -412,13 +952,24 @@ void *create_netdev(int port_num)
 	priv = netdev_priv(netdev);
 	memset(priv, 0, sizeof(dpdk_dev_priv_t));
 	priv->port_number = port_num;
+	priv->real_dev = netdev;
 	netdev->netdev_ops = &dpdk_netdev_ops;
-#ifdef GSO
-	netdev->features = NETIF_F_SG | NETIF_F_GSO | NETIF_F_FRAGLIST;
-#else
         netdev->features = NETIF_F_SG | NETIF_F_FRAGLIST|NETIF_F_V4_CSUM;
-#endif
 	netdev->hw_features = 0;
+	/* the port was configured with hw_ip_checksum and hw_vlan_strip on the same conditions */
+	if(dpdk_dev_rx_csum_capable(port_num)) {
+		netdev->features |= NETIF_F_RXCSUM;
+		netdev->hw_features |= NETIF_F_RXCSUM;
+	}
+	if(dpdk_dev_rx_vlan_strip_capable(port_num))
+		netdev->features |= NETIF_F_HW_VLAN_CTAG_RX;
+	if(dpdk_dev_tx_vlan_insert_capable(port_num))
+		netdev->features |= NETIF_F_HW_VLAN_CTAG_TX;
+#ifdef GSO
+	/* TSO frames are segmented by dpdk_dev_gso_xmit, may be turned off per netdev */
+	netdev->features |= NETIF_F_TSO;
+	netdev->hw_features |= NETIF_F_TSO;
+#endif
 
 	netdev->vlan_features = 0;
 
@@ -428,10 +979,85 @@ void *create_netdev(int port_num)
 	}
 	return netdev;
 }
+
+void *get_vlan_netdev(void *real_netdev,int vlan_id)
+{
+	dpdk_dev_priv_t *real_priv = netdev_priv((struct net_device *)real_netdev);
+
+	if((real_priv->vlan_devs == NULL)||(vlan_id <= 0)||(vlan_id >= VLAN_N_VID))
+		return NULL;
+	return real_priv->vlan_devs[vlan_id];
+}
+
+/* VLAN sub-interface <port netdev>.<vlan id>. Received frames are demultiplexed
+ * to it by the port's netdev, transmitted ones are tagged by the NIC if it can,
+ * in the headroom otherwise */
+void *create_vlan_netdev(void *real_netdev,int vlan_id)
+{
+	struct net_device *real_dev = (struct net_device *)real_netdev,*netdev;
+	dpdk_dev_priv_t *real_priv = netdev_priv(real_dev),*priv;
+	char dev_name[IFNAMSIZ];
+
+	if((vlan_id <= 0)||(vlan_id >= VLAN_N_VID)) {
+		printf("invalid VLAN ID %d %s %d\n",vlan_id,__FILE__,__LINE__);
+		return NULL;
+	}
+	if(get_vlan_netdev(real_netdev,vlan_id))
+		return get_vlan_netdev(real_netdev,vlan_id);
+	if(real_priv->vlan_devs == NULL) {
+		real_priv->vlan_devs = kzalloc(sizeof(struct net_device *)*VLAN_N_VID,GFP_KERNEL);
+		if(real_priv->vlan_devs == NULL) {
+			printf("cannot allocate VLAN table %s %d\n",__FILE__,__LINE__);
+			return NULL;
+		}
+	}
+	snprintf(dev_name,sizeof(dev_name),"%s.%d",real_dev->name,vlan_id);
+	netdev = alloc_netdev_mqs(sizeof(dpdk_dev_priv_t),dev_name,ether_setup,1,1);
+	if(netdev == NULL) {
+		printf("cannot allocate netdevice %s %d\n",__FILE__,__LINE__);
+		return NULL;
+	}
+	priv = netdev_priv(netdev);
+	memset(priv, 0, sizeof(dpdk_dev_priv_t));
+	priv->port_number = real_priv->port_number;
+	priv->real_dev = real_dev;
+	priv->vlan_id = vlan_id;
+	netdev->netdev_ops = &dpdk_netdev_ops;
+	netdev->features = real_dev->features;
+	netdev->hw_features = real_dev->hw_features;
+	netdev->vlan_features = 0;
+	if(!(netdev->features & NETIF_F_HW_VLAN_CTAG_TX))
+		netdev->needed_headroom = VLAN_HLEN;
+	if(register_netdev(netdev)) {
+		printf("Cannot register netdev %s %d\n",__FILE__,__LINE__);
+		free_netdev(netdev);
+		return NULL;
+	}
+	real_priv->vlan_devs[vlan_id] = netdev;
+	return netdev;
+}
 extern uint64_t received;
 extern uint64_t transmitted;
 extern uint64_t tx_dropped;
+extern uint64_t dpdk_dev_tx_bursts[DPDK_DEV_TX_BURST_BUCKETS];
+extern uint64_t dpdk_dev_tx_flush_full;
+extern uint64_t dpdk_dev_tx_flush_delay;
+extern uint64_t dpdk_dev_tx_backlogged;
+extern uint64_t dpdk_dev_tx_stopped;
+extern uint64_t dpdk_dev_tx_woken;
 void dpdk_dev_print_stats()
 {
-	printf("PHY received %"PRIu64" transmitted %"PRIu64" dropped %"PRIu64"\n",received,transmitted,tx_dropped);
+	printf("PHY received %"PRIu64" transmitted %"PRIu64" dropped (tx backlog overflow) %"PRIu64"\n",received,transmitted,tx_dropped);
+	printf("PHY tx bursts 1 %"PRIu64" 2-3 %"PRIu64" 4-7 %"PRIu64" 8-15 %"PRIu64" 16-31 %"PRIu64" 32+ %"PRIu64"\n",
+	       dpdk_dev_tx_bursts[0],dpdk_dev_tx_bursts[1],dpdk_dev_tx_bursts[2],
+	       dpdk_dev_tx_bursts[3],dpdk_dev_tx_bursts[4],dpdk_dev_tx_bursts[5]);
+	printf("PHY tx flushed full %"PRIu64" delayed %"PRIu64"\n",dpdk_dev_tx_flush_full,dpdk_dev_tx_flush_delay);
+#ifdef GSO
+	printf("PHY gso frames %"PRIu64" segments %"PRIu64" failed %"PRIu64"\n",dpdk_dev_gso_frames,dpdk_dev_gso_segments,dpdk_dev_gso_failed);
+#endif
+	printf("PHY rx csum hw %"PRIu64" sw %"PRIu64" bad %"PRIu64"\n",dpdk_dev_rx_csum_hw,dpdk_dev_rx_csum_sw,dpdk_dev_rx_csum_bad);
+	printf("PHY rx vlan unknown %"PRIu64" tx vlan insert failed %"PRIu64"\n",dpdk_dev_rx_vlan_unknown,dpdk_dev_tx_vlan_failed);
+	printf("PHY rx scattered %"PRIu64" dropped %"PRIu64"\n",dpdk_dev_rx_scattered,dpdk_dev_rx_scattered_dropped);
+	printf("PHY gro merged %"PRIu64" delivered %"PRIu64"\n",dpdk_dev_gro_merged,dpdk_dev_gro_delivered);
+	printf("PHY tx backlogged %"PRIu64" stopped %"PRIu64" woken %"PRIu64"\n",dpdk_dev_tx_backlogged,dpdk_dev_tx_stopped,dpdk_dev_tx_woken);
 }
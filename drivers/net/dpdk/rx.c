@@ -8,10 +8,15 @@
 #include <specific_includes/dummies.h>
 #include <specific_includes/linux/types.h>
 #include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
 #include <rte_config.h>
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_ethdev.h>
+#include <rte_memzone.h>
+#include <rte_atomic.h>
+#include <specific_includes/dpdk_drv_iface.h>
 
 uint64_t received = 0;
 
@@ -23,3 +28,130 @@ int dpdk_dev_get_received(int port_num,struct rte_mbuf **tbl,int tbl_size)
 	received += nb_rx;
     return nb_rx;
 }
+
+int dpdk_dev_rx_csum_capable(int port_num)
+{
+	struct rte_eth_dev_info dev_info;
+	uint32_t capa = DEV_RX_OFFLOAD_IPV4_CKSUM|DEV_RX_OFFLOAD_UDP_CKSUM|DEV_RX_OFFLOAD_TCP_CKSUM;
+
+	rte_eth_dev_info_get((uint8_t)port_num,&dev_info);
+	return (dev_info.rx_offload_capa & capa) == capa;
+}
+
+int dpdk_dev_rx_vlan_strip_capable(int port_num)
+{
+	struct rte_eth_dev_info dev_info;
+
+	rte_eth_dev_info_get((uint8_t)port_num,&dev_info);
+	return (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_VLAN_STRIP) != 0;
+}
+
+static dpdk_dev_nic_stats_t *dpdk_dev_nic_stats = NULL;
+
+void dpdk_dev_init_nic_stats()
+{
+	const struct rte_memzone *mz = rte_memzone_reserve(DPDK_DEV_NIC_STATS_MEMZONE_NAME,
+	                                                   sizeof(dpdk_dev_nic_stats_t)*RTE_MAX_ETHPORTS,
+	                                                   rte_socket_id(),0);
+	if(!mz) {
+		printf("cannot create memzone %s %d\n",__FILE__,__LINE__);
+		return;
+	}
+	dpdk_dev_nic_stats = (dpdk_dev_nic_stats_t *)mz->addr;
+	memset(dpdk_dev_nic_stats,0,mz->len);
+}
+
+static inline uint64_t dpdk_dev_nic_stats_rate(uint64_t now,uint64_t prev,uint64_t cycles)
+{
+	return (uint64_t)((double)(now - prev)*rte_get_tsc_hz()/cycles);
+}
+
+extern uint64_t tx_dropped;
+/* Not on the data path: register reads are slow and only one lcore may sample a port */
+void dpdk_dev_sample_nic_stats(int port_num)
+{
+	struct rte_eth_stats eth_stats;
+	dpdk_dev_nic_stats_t *nic_stats;
+	uint64_t tsc,cycles,rx_missed = 0;
+	int q;
+
+	if((!dpdk_dev_nic_stats)||(port_num >= RTE_MAX_ETHPORTS))
+		return;
+	nic_stats = &dpdk_dev_nic_stats[port_num];
+	rte_eth_stats_get((uint8_t)port_num,&eth_stats);
+	tsc = rte_rdtsc();
+	/* DPDK 1.6 has no port-wide missed counter (ixgbe folds MPC into ierrors).
+	   With rx_drop_en a full ring's drops are the queue's q_errors (QPRDC on ixgbe), 0 on PMDs not counting them */
+	for(q = 0;q < DPDK_DEV_NIC_STATS_QUEUES;q++)
+		rx_missed += eth_stats.q_errors[q];
+	nic_stats->seq++;
+	rte_wmb();
+	cycles = tsc - nic_stats->tsc;
+	if(nic_stats->tsc && cycles) {
+		nic_stats->rx_packets_rate = dpdk_dev_nic_stats_rate(eth_stats.ipackets,nic_stats->rx_packets,cycles);
+		nic_stats->tx_packets_rate = dpdk_dev_nic_stats_rate(eth_stats.opackets,nic_stats->tx_packets,cycles);
+		nic_stats->rx_bytes_rate = dpdk_dev_nic_stats_rate(eth_stats.ibytes,nic_stats->rx_bytes,cycles);
+		nic_stats->tx_bytes_rate = dpdk_dev_nic_stats_rate(eth_stats.obytes,nic_stats->tx_bytes,cycles);
+		nic_stats->rx_missed_rate = dpdk_dev_nic_stats_rate(rx_missed,nic_stats->rx_missed,cycles);
+		nic_stats->rx_nombuf_rate = dpdk_dev_nic_stats_rate(eth_stats.rx_nombuf,nic_stats->rx_nombuf,cycles);
+	}
+	nic_stats->tsc = tsc;
+	nic_stats->rx_packets = eth_stats.ipackets;
+	nic_stats->tx_packets = eth_stats.opackets;
+	nic_stats->rx_bytes = eth_stats.ibytes;
+	nic_stats->tx_bytes = eth_stats.obytes;
+	nic_stats->rx_errors = eth_stats.ierrors;
+	nic_stats->tx_errors = eth_stats.oerrors;
+	nic_stats->rx_multicast = eth_stats.imcasts;
+	nic_stats->rx_missed = rx_missed;
+	nic_stats->rx_nombuf = eth_stats.rx_nombuf;
+	nic_stats->stack_rx_packets = received;
+	nic_stats->stack_tx_dropped = tx_dropped;
+	for(q = 0;q < DPDK_DEV_NIC_STATS_QUEUES;q++) {
+		nic_stats->q_rx_packets[q] = eth_stats.q_ipackets[q];
+		nic_stats->q_tx_packets[q] = eth_stats.q_opackets[q];
+		nic_stats->q_rx_bytes[q] = eth_stats.q_ibytes[q];
+		nic_stats->q_tx_bytes[q] = eth_stats.q_obytes[q];
+		nic_stats->q_rx_missed[q] = eth_stats.q_errors[q];
+	}
+	rte_wmb();
+	nic_stats->seq++;
+}
+
+int dpdk_dev_get_nic_stats(int port_num,dpdk_dev_nic_stats_t *stats)
+{
+	dpdk_dev_nic_stats_t *nic_stats;
+	uint32_t seq;
+
+	if((!dpdk_dev_nic_stats)||(port_num >= RTE_MAX_ETHPORTS))
+		return -1;
+	nic_stats = &dpdk_dev_nic_stats[port_num];
+	do {
+		seq = nic_stats->seq;
+		rte_rmb();
+		*stats = *nic_stats;
+		rte_rmb();
+	}while((seq & 1)||(seq != nic_stats->seq));
+	return 0;
+}
+
+void dpdk_dev_print_nic_stats(int port_num)
+{
+	dpdk_dev_nic_stats_t stats;
+	int q;
+
+	if(dpdk_dev_get_nic_stats(port_num,&stats))
+		return;
+	printf("NIC port %d rx %"PRIu64" (%"PRIu64"/s %"PRIu64"B/s) tx %"PRIu64" (%"PRIu64"/s %"PRIu64"B/s)\n",
+	       port_num,stats.rx_packets,stats.rx_packets_rate,stats.rx_bytes_rate,
+	       stats.tx_packets,stats.tx_packets_rate,stats.tx_bytes_rate);
+	printf("NIC port %d missed (rx ring full) %"PRIu64" (%"PRIu64"/s) nombuf %"PRIu64" (%"PRIu64"/s) rx errors %"PRIu64" tx errors %"PRIu64" multicast %"PRIu64"\n",
+	       port_num,stats.rx_missed,stats.rx_missed_rate,stats.rx_nombuf,stats.rx_nombuf_rate,
+	       stats.rx_errors,stats.tx_errors,stats.rx_multicast);
+	for(q = 0;q < DPDK_DEV_NIC_STATS_QUEUES;q++) {
+		if((!stats.q_rx_packets[q])&&(!stats.q_tx_packets[q])&&(!stats.q_rx_missed[q]))
+			continue;
+		printf("NIC port %d queue %d rx %"PRIu64" tx %"PRIu64" missed %"PRIu64"\n",
+		       port_num,q,stats.q_rx_packets[q],stats.q_tx_packets[q],stats.q_rx_missed[q]);
+	}
+}
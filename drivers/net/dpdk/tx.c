@@ -10,16 +10,241 @@
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_ethdev.h>
+#include <specific_includes/dpdk_drv_iface.h>
 
 uint64_t transmitted = 0;
+/* backlog overflow, the only place tx drops */
 uint64_t tx_dropped = 0;
+int dpdk_dev_last_tx_port = -1;
+uint64_t dpdk_dev_last_tx_seq = 0;
+/* bursts handed to the PMD, bucketed 1,2-3,4-7,8-15,16-31,32+ */
+uint64_t dpdk_dev_tx_bursts[DPDK_DEV_TX_BURST_BUCKETS] = { 0 };
+uint64_t dpdk_dev_tx_flush_full = 0;
+uint64_t dpdk_dev_tx_flush_delay = 0;
+uint64_t dpdk_dev_tx_backlogged = 0;
+uint64_t dpdk_dev_tx_stopped = 0;
+uint64_t dpdk_dev_tx_woken = 0;
+
+typedef struct
+{
+	uint64_t done_seq; /* done_seq of the queue after the burst */
+	uint64_t tsc;
+}dpdk_dev_tx_burst_mark_t;
+
+/* mbufs accumulated during the iteration, sent in one rte_eth_tx_burst.
+ * What the PMD does not take waits in the backlog, which drains before new packets.
+ * Mbufs go to the PMD in the order they were staged, so a sequence number tells
+ * whether and in which burst one went */
+typedef struct
+{
+	struct rte_mbuf *mbufs[MAX_PKT_BURST];
+	uint16_t count;
+	uint16_t stopped;
+	uint64_t first_tsc;
+	uint64_t staged_seq; /* mbufs ever staged */
+	uint64_t done_seq; /* of them handed to the PMD or dropped */
+	uint32_t history_head;
+	dpdk_dev_tx_burst_mark_t history[DPDK_DEV_TX_BURST_HISTORY];
+	uint32_t backlog_head;
+	uint32_t backlog_tail;
+	struct rte_mbuf *backlog[DPDK_DEV_TX_BACKLOG_SIZE];
+}dpdk_dev_tx_staging_t;
+
+static dpdk_dev_tx_staging_t tx_staging[RTE_MAX_ETHPORTS][DPDK_DEV_TX_QUEUES_COUNT];
+
+static inline uint64_t dpdk_dev_tx_max_delay_cycles()
+{
+	return (rte_get_tsc_hz()/1000000)*DPDK_DEV_TX_MAX_DELAY_US;
+}
+
+static inline uint32_t dpdk_dev_tx_backlog_count(dpdk_dev_tx_staging_t *staging)
+{
+	return staging->backlog_tail - staging->backlog_head;
+}
+
+/* the next count mbufs in staging order are done (handed to the PMD or dropped) now */
+static inline void dpdk_dev_tx_account_done(dpdk_dev_tx_staging_t *staging,unsigned count)
+{
+	dpdk_dev_tx_burst_mark_t *mark;
+
+	staging->done_seq += count;
+	mark = &staging->history[staging->history_head & (DPDK_DEV_TX_BURST_HISTORY - 1)];
+	mark->done_seq = staging->done_seq;
+	mark->tsc = rte_rdtsc();
+	staging->history_head++;
+}
+
+static inline void dpdk_dev_tx_account_burst(dpdk_dev_tx_staging_t *staging,unsigned count)
+{
+	unsigned bucket = 31 - __builtin_clz(count);
+
+	if(bucket >= DPDK_DEV_TX_BURST_BUCKETS)
+		bucket = DPDK_DEV_TX_BURST_BUCKETS - 1;
+	dpdk_dev_tx_bursts[bucket]++;
+	dpdk_dev_tx_account_done(staging,count);
+}
+
+/* sends from the backlog head, returns non-zero if the PMD ring filled up */
+static inline int dpdk_dev_tx_drain_backlog(int port_num,int queue_id,dpdk_dev_tx_staging_t *staging)
+{
+	uint32_t count,idx;
+	unsigned ret;
+
+	while((count = dpdk_dev_tx_backlog_count(staging)) > 0) {
+		idx = staging->backlog_head & (DPDK_DEV_TX_BACKLOG_SIZE - 1);
+		/* contiguous part only, the rest goes in the next round */
+		if(count > DPDK_DEV_TX_BACKLOG_SIZE - idx)
+			count = DPDK_DEV_TX_BACKLOG_SIZE - idx;
+		ret = rte_eth_tx_burst(port_num, (uint16_t)queue_id, &staging->backlog[idx], (uint16_t)count);
+		if(ret == 0)
+			return 1;
+		dpdk_dev_tx_account_burst(staging,ret);
+		transmitted += ret;
+		staging->backlog_head += ret;
+		if(ret < count)
+			return 1;
+	}
+	return 0;
+}
+
+/* on overflow the oldest are dropped to make room, so done_seq still covers
+ * exactly the mbufs staged first and dpdk_dev_tx_sent_tsc never reports a backlogged one */
+static inline void dpdk_dev_tx_backlog_append(dpdk_dev_tx_staging_t *staging,struct rte_mbuf **mbufs,unsigned count)
+{
+	unsigned i,drop;
+
+	drop = dpdk_dev_tx_backlog_count(staging) + count;
+	if(unlikely(drop > DPDK_DEV_TX_BACKLOG_SIZE)) {
+		drop -= DPDK_DEV_TX_BACKLOG_SIZE;
+		for(i = 0;i < drop;i++) {
+			rte_pktmbuf_free(staging->backlog[staging->backlog_head & (DPDK_DEV_TX_BACKLOG_SIZE - 1)]);
+			staging->backlog_head++;
+		}
+		tx_dropped += drop;
+		dpdk_dev_tx_account_done(staging,drop);
+	}
+	for(i = 0;i < count;i++) {
+		staging->backlog[staging->backlog_tail & (DPDK_DEV_TX_BACKLOG_SIZE - 1)] = mbufs[i];
+		staging->backlog_tail++;
+		dpdk_dev_tx_backlogged++;
+	}
+}
+
+static inline void dpdk_dev_tx_flush(int port_num,int queue_id,dpdk_dev_tx_staging_t *staging)
+{
+	unsigned ret = 0;
+
+	if((dpdk_dev_tx_backlog_count(staging) == 0)||
+	   (!dpdk_dev_tx_drain_backlog(port_num,queue_id,staging))) {
+		if(staging->count) {
+			ret = rte_eth_tx_burst(port_num, (uint16_t)queue_id, staging->mbufs, staging->count);
+			if(ret)
+				dpdk_dev_tx_account_burst(staging,ret);
+			transmitted += ret;
+		}
+	}
+	if (unlikely(ret < staging->count))
+		dpdk_dev_tx_backlog_append(staging,&staging->mbufs[ret],staging->count - ret);
+	staging->count = 0;
+	if(!staging->stopped) {
+		if(unlikely(dpdk_dev_tx_backlog_count(staging) >= DPDK_DEV_TX_BACKLOG_STOP_THRESHOLD)) {
+			staging->stopped = 1;
+			dpdk_dev_tx_stopped++;
+		}
+	}
+	else if(dpdk_dev_tx_backlog_count(staging) <= DPDK_DEV_TX_BACKLOG_WAKE_THRESHOLD) {
+		staging->stopped = 0;
+		dpdk_dev_tx_woken++;
+	}
+}
 
 void dpdk_dev_enqueue_for_tx(int port_num,struct rte_mbuf *m)
 {
-	unsigned ret = rte_eth_tx_burst(port_num, (uint16_t) /*queue_id*/0, &m, (uint16_t) 1);
-	transmitted += ret;
-	if (unlikely(ret < 1)) {
-		tx_dropped ++;
-		rte_pktmbuf_free(m);
+	dpdk_dev_tx_staging_t *staging = &tx_staging[port_num][0];
+
+	if(staging->count == 0)
+		staging->first_tsc = rte_rdtsc();
+	staging->staged_seq++;
+	dpdk_dev_last_tx_port = port_num;
+	dpdk_dev_last_tx_seq = staging->staged_seq;
+	staging->mbufs[staging->count++] = m;
+	if(staging->count == MAX_PKT_BURST) {
+		dpdk_dev_tx_flush_full++;
+		dpdk_dev_tx_flush(port_num,0,staging);
 	}
 }
+
+int dpdk_dev_tx_sent_tsc(int port_num,uint64_t seq,uint64_t *tsc)
+{
+	dpdk_dev_tx_staging_t *staging = &tx_staging[port_num][0];
+	uint32_t idx,oldest;
+
+	if(seq > staging->done_seq)
+		return 0;
+	oldest = (staging->history_head > DPDK_DEV_TX_BURST_HISTORY) ?
+			staging->history_head - DPDK_DEV_TX_BURST_HISTORY : 0;
+	/* the first burst whose done_seq reaches seq, searched from the newest */
+	idx = staging->history_head - 1;
+	while((idx != oldest)&&
+	      (staging->history[(idx - 1) & (DPDK_DEV_TX_BURST_HISTORY - 1)].done_seq >= seq))
+		idx--;
+	*tsc = staging->history[idx & (DPDK_DEV_TX_BURST_HISTORY - 1)].tsc;
+	return 1;
+}
+
+/* called at the end of each app_glue_periodic iteration.
+ * Staged mbufs are held across iterations only while younger than DPDK_DEV_TX_MAX_DELAY_US,
+ * the backlog is retried every time */
+void transmit_pending(int port_num)
+{
+	int queue_id;
+	dpdk_dev_tx_staging_t *staging;
+
+	for(queue_id = 0;queue_id < DPDK_DEV_TX_QUEUES_COUNT;queue_id++) {
+		staging = &tx_staging[port_num][queue_id];
+		if(dpdk_dev_tx_backlog_count(staging)) {
+			dpdk_dev_tx_flush(port_num,queue_id,staging);
+			continue;
+		}
+		if(staging->count == 0)
+			continue;
+		if((DPDK_DEV_TX_MAX_DELAY_US > 0)&&
+		   (rte_rdtsc() - staging->first_tsc < dpdk_dev_tx_max_delay_cycles()))
+			continue;
+		if(DPDK_DEV_TX_MAX_DELAY_US > 0)
+			dpdk_dev_tx_flush_delay++;
+		dpdk_dev_tx_flush(port_num,queue_id,staging);
+	}
+}
+
+/* netif_stop_queue-style backpressure: non-zero while any tx queue of the port
+ * has its backlog above the stop threshold and not yet drained to the wake threshold */
+int get_tx_overflow(int port_num)
+{
+	int queue_id;
+
+	for(queue_id = 0;queue_id < DPDK_DEV_TX_QUEUES_COUNT;queue_id++)
+		if(tx_staging[port_num][queue_id].stopped)
+			return 1;
+	return 0;
+}
+
+/* non-zero while any tx queue of the port has frames staged or backlogged,
+ * the next transmit_pending has work to do */
+int dpdk_dev_tx_pending(int port_num)
+{
+	int queue_id;
+
+	for(queue_id = 0;queue_id < DPDK_DEV_TX_QUEUES_COUNT;queue_id++)
+		if((tx_staging[port_num][queue_id].count)||(dpdk_dev_tx_backlog_count(&tx_staging[port_num][queue_id])))
+			return 1;
+	return 0;
+}
+
+int dpdk_dev_tx_vlan_insert_capable(int port_num)
+{
+	struct rte_eth_dev_info dev_info;
+
+	rte_eth_dev_info_get((uint8_t)port_num,&dev_info);
+	return (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_VLAN_INSERT) != 0;
+}
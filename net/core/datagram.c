@@ -328,18 +328,18 @@ int skb_copy_datagram_iovec(struct sk_buff *skb, int offset,
 	int i, copy = start - offset;
 	struct sk_buff *frag_iter;
 
-	if(rte_pktmbuf_adj(skb->header_mbuf,skb->data - (unsigned char *)skb->header_mbuf->pkt.data) == NULL) {
-		printf("CANNOT ADJUST MBUF %s %d %d %d %d %p %p %d\n",__FILE__,__LINE__,offset,len,skb->header_mbuf->pkt.data_len,
-                        skb->header_mbuf,skb->data,(unsigned char *)skb->header_mbuf->pkt.data,start);
-                exit(1);
-		goto fault;
-	}
-
 	skb_copy_datagram_iovec_called++;
 	trace_skb_copy_datagram_iovec(skb, len);
 
 	/* Copy header. */
 	if (copy > 0) {
+		/* the header mbuf may already be in the iovec when only frag_list is left */
+		if(rte_pktmbuf_adj(skb->header_mbuf,skb->data - (unsigned char *)skb->header_mbuf->pkt.data) == NULL) {
+			printf("CANNOT ADJUST MBUF %s %d %d %d %d %p %p %d\n",__FILE__,__LINE__,offset,len,skb->header_mbuf->pkt.data_len,
+	                        skb->header_mbuf,skb->data,(unsigned char *)skb->header_mbuf->pkt.data,start);
+	                exit(1);
+			goto fault;
+		}
 		if (copy > len)
 			copy = len;
 		if (memcpy_toiovec(to, skb->header_mbuf, offset, copy))
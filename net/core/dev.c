@@ -3756,6 +3756,48 @@ int netif_receive_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_receive_skb);
 
+/**
+ *	netif_receive_skb_list - process a burst of receive buffers
+ *	@list: skbs of one driver poll
+ *
+ *	IPv4 frames that need nothing from __netif_receive_skb_core (no taps,
+ *	rx handler or vlan tag) are passed to ip_list_rcv together, the rest
+ *	go through netif_receive_skb one by one.
+ */
+void netif_receive_skb_list(struct sk_buff_head *list)
+{
+	struct sk_buff_head ip_list;
+	struct net_device *dev = NULL;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&ip_list);
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		if (skb_defer_rx_timestamp(skb) || netpoll_receive_skb(skb))
+			continue;
+		if (skb->protocol != cpu_to_be16(ETH_P_IP) ||
+		    !list_empty(&ptype_all) ||
+		    rcu_access_pointer(skb->dev->rx_handler) ||
+		    vlan_tx_tag_present(skb)) {
+			netif_receive_skb(skb);
+			continue;
+		}
+		if (dev != skb->dev) {
+			if (!skb_queue_empty(&ip_list))
+				ip_list_rcv(&ip_list, dev);
+			dev = skb->dev;
+		}
+		skb_reset_network_header(skb);
+		if (!skb_transport_header_was_set(skb))
+			skb_reset_transport_header(skb);
+		skb_reset_mac_len(skb);
+		skb->skb_iif = skb->dev->ifindex;
+		__skb_queue_tail(&ip_list, skb);
+	}
+	if (!skb_queue_empty(&ip_list))
+		ip_list_rcv(&ip_list, dev);
+}
+EXPORT_SYMBOL(netif_receive_skb_list);
+
 /* Network device is going away, flush any packets still pending
  * Called with irqs disabled.
  */
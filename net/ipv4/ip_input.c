@@ -309,7 +309,8 @@ drop:
 int sysctl_ip_early_demux __read_mostly = 1;
 EXPORT_SYMBOL(sysctl_ip_early_demux);
 
-static int ip_rcv_finish(struct sk_buff *skb)
+/* early demux and route lookup, non-zero if the skb was dropped */
+static int ip_rcv_finish_core(struct sk_buff *skb)
 {
 	const struct iphdr *iph = ip_hdr(skb);
 	struct rtable *rt;
@@ -363,17 +364,25 @@ static int ip_rcv_finish(struct sk_buff *skb)
 		IP_UPD_PO_STATS_BH(dev_net(rt->dst.dev), IPSTATS_MIB_INBCAST,
 				skb->len);
 
-	return dst_input(skb);
+	return 0;
 
 drop:
 	kfree_skb(skb);
 	return NET_RX_DROP;
 }
 
+static int ip_rcv_finish(struct sk_buff *skb)
+{
+	if (ip_rcv_finish_core(skb))
+		return NET_RX_DROP;
+	return dst_input(skb);
+}
+
 /*
- * 	Main IP Receive routine.
+ * 	Header validation of the main IP receive routine.
+ *	Returns the skb or NULL if it was dropped.
  */
-int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+static struct sk_buff *ip_rcv_core(struct sk_buff *skb, struct net_device *dev)
 {
 	const struct iphdr *iph;
 	u32 len;
@@ -450,8 +459,7 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 	/* Must drop socket now because of tproxy. */
 	skb_orphan(skb);
 
-	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
-		       ip_rcv_finish);
+	return skb;
 
 csum_error:
 	IP_INC_STATS_BH(dev_net(dev), IPSTATS_MIB_CSUMERRORS);
@@ -460,5 +468,66 @@ inhdr_error:
 drop:
 	kfree_skb(skb);
 out:
-	return NET_RX_DROP;
+	return NULL;
+}
+
+/*
+ * 	Main IP Receive routine.
+ */
+int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+{
+	skb = ip_rcv_core(skb, dev);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
+		       ip_rcv_finish);
+}
+
+static void ip_sublist_rcv_finish(struct sk_buff_head *sublist)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(sublist)) != NULL)
+		dst_input(skb);
+}
+
+/*
+ *	List receive: the whole burst is validated, then demuxed and routed,
+ *	then runs of packets sharing a dst go up back to back, so each
+ *	layer's code stays hot across the burst.
+ *	PRE_ROUTING hooks need the per packet path.
+ */
+void ip_list_rcv(struct sk_buff_head *list, struct net_device *dev)
+{
+	struct sk_buff_head valid, sublist;
+	struct dst_entry *curr_dst = NULL;
+	struct sk_buff *skb;
+
+	if (nf_hooks_active(NFPROTO_IPV4, NF_INET_PRE_ROUTING)) {
+		while ((skb = __skb_dequeue(list)) != NULL)
+			ip_rcv(skb, dev, NULL, dev);
+		return;
+	}
+	__skb_queue_head_init(&valid);
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		if (!skb_queue_empty(list))
+			prefetch(skb_peek(list)->data);
+		skb = ip_rcv_core(skb, dev);
+		if (skb)
+			__skb_queue_tail(&valid, skb);
+	}
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(&valid)) != NULL) {
+		if (!skb_queue_empty(&valid))
+			prefetch(skb_network_header(skb_peek(&valid)));
+		if (ip_rcv_finish_core(skb))
+			continue;
+		if (skb_dst(skb) != curr_dst) {
+			ip_sublist_rcv_finish(&sublist);
+			curr_dst = skb_dst(skb);
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	ip_sublist_rcv_finish(&sublist);
 }
@@ -778,6 +778,13 @@ static inline int does_protocol_use_flat_buf(int protocol_number)
 	}
 	return 0;
 }
+/* protocols above copy into skb->data, which is one header mbuf with skb_shared_info at its end.
+   Longer frames are built as one skb per mbuf, the driver chains them */
+static inline int ip_flat_buf_fragsize(struct rtable *rt,int hh_len)
+{
+	return MBUF_SIZE - sizeof(struct rte_mbuf) - RTE_PKTMBUF_HEADROOM - SMP_CACHE_BYTES -
+	       SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) - hh_len - 15 - rt->dst.header_len - rt->dst.trailer_len;
+}
 static int __ip_append_data(struct sock *sk,
 			    struct flowi4 *fl4,
 			    struct sk_buff_head *queue,
@@ -819,6 +826,11 @@ static int __ip_append_data(struct sock *sk,
 			       mtu - (opt ? opt->optlen : 0));
 		return -EMSGSIZE;
 	}
+	if (does_protocol_use_flat_buf(sk->sk_protocol) &&
+	    (mtu > ip_flat_buf_fragsize(rt,hh_len))) {
+		mtu = ip_flat_buf_fragsize(rt,hh_len);
+		maxfraglen = ((mtu - fragheaderlen) & ~7) + fragheaderlen;
+	}
 
 	/*
 	 * transhdrlen > 0 means that this is the first fragment and we wish
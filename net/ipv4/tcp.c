@@ -1038,10 +1038,6 @@ wait_for_memory:
 	        skb->ip_summed = CHECKSUM_PARTIAL;
 	        tp->write_seq += copied;
 	        TCP_SKB_CB(skb)->end_seq += copied;
-#ifdef GSO
-                skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len, mss_now);
-                skb_shinfo(skb)->gso_size = mss_now;
-#endif
 	        if (!copied)
 		    TCP_SKB_CB(skb)->tcp_flags &= ~TCPHDR_PSH;
 	        
@@ -1669,6 +1665,24 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 }
 EXPORT_SYMBOL(tcp_read_sock);
 #endif
+
+/* rx skbs hold one mbuf per segment: the linear part, then one skb per segment
+ * chained in frag_list by the driver's GRO. Returns how much of the mbuf
+ * holding offset is left */
+static inline int tcp_recv_seg_len(struct sk_buff *skb, u32 offset)
+{
+	struct sk_buff *frag_iter;
+	u32 start = skb_headlen(skb);
+
+	if (offset < start)
+		return start - offset;
+	skb_walk_frags(skb, frag_iter) {
+		if (offset < start + frag_iter->len)
+			return start + frag_iter->len - offset;
+		start += frag_iter->len;
+	}
+	return 0;
+}
 /*
  *	This routine copies from a sock struct into the user buffer.
  *
@@ -1769,8 +1783,9 @@ found_ok_skb:
 		/* Ok so how much can we use? */
 		used = skb->len - offset;
 //printf("%s %d %d %d %d\n",__FILE__,__LINE__,skb->header_mbuf->pkt.data_len,used,skb->len);
-                if(skb->header_mbuf->pkt.data_len < used) {
-                    used = skb->header_mbuf->pkt.data_len;
+                /* one mbuf per read, segments merged by GRO hang in frag_list */
+                if(tcp_recv_seg_len(skb,offset) < used) {
+                    used = tcp_recv_seg_len(skb,offset);
                 }
 /*		if (len < used)
 			used = len;*/
@@ -1819,10 +1834,8 @@ skip_copy:
 			tp->urg_data = 0;
 			tcp_fast_path_check(sk);
 		}
-		if (used + offset < skb->len) {
-                        printf("%s %d\n",__FILE__,__LINE__);
+		if (used + offset < skb->len)
 			continue;
-                }
 
 		if (tcp_hdr(skb)->fin)
 			goto found_fin_ok;
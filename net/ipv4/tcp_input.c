@@ -3460,6 +3460,8 @@ static int tcp_ack(struct sock *sk, const struct sk_buff *skb, int flag)
 	acked = tp->packets_out;
 	flag |= tcp_clean_rtx_queue(sk, prior_fackets, prior_snd_una, sack_rtt);
 	acked -= tp->packets_out;
+	if ((tp->snd_una != prior_snd_una) && (sk->sk_user_data))
+		user_on_tcp_data_acked(sk);
 
 	/* Advance cwnd if state allows */
 	if (tcp_may_raise_cwnd(sk, flag))
@@ -89,6 +89,8 @@ static void tcp_event_new_data_sent(struct sock *sk, const struct sk_buff *skb)
 	    icsk->icsk_pending == ICSK_TIME_LOSS_PROBE) {
 		tcp_rearm_rto(sk);
 	}
+	if (sk->sk_user_data)
+		user_on_tcp_data_sent(sk);
 }
 
 /* SND.NXT, if window was not shrunk.
@@ -493,6 +493,7 @@ void app_glue_init_poll_intervals(int drv_poll_interval,
 uint64_t app_glue_periodic_called = 0;
 uint64_t app_glue_tx_queues_process = 0;
 uint64_t app_glue_rx_queues_process = 0;
+uint64_t app_glue_tx_queues_stopped = 0;
 /*
  * This function must be called by application periodically.
  * This is the heart of the system, it performs all the driver/IP stack work
@@ -508,6 +509,7 @@ inline void app_glue_periodic(int call_flush_queues,uint8_t *ports_to_poll,int p
 {
 	uint64_t ts,ts2,ts3,ts4;
     uint8_t port_idx;
+	int tx_stopped;
 
 	app_glue_periodic_called++;
 	ts = rte_rdtsc();
@@ -526,7 +528,13 @@ inline void app_glue_periodic(int call_flush_queues,uint8_t *ports_to_poll,int p
 		working_cycles_stat += rte_rdtsc() - ts3;
 	}
 	if(call_flush_queues) {
-		if((ts - app_glue_tx_ready_sockets_last_poll_ts) >= app_glue_tx_ready_sockets_poll_interval) {
+		tx_stopped = 0;
+		for(port_idx = 0;port_idx < ports_to_poll_count;port_idx++)
+			tx_stopped |= get_tx_overflow(ports_to_poll[port_idx]);
+		/* writable sockets stay queued until the NIC backlog drains */
+		if(tx_stopped)
+			app_glue_tx_queues_stopped++;
+		else if((ts - app_glue_tx_ready_sockets_last_poll_ts) >= app_glue_tx_ready_sockets_poll_interval) {
 			ts2 = rte_rdtsc();
 			app_glue_tx_queues_process++;
 			process_tx_ready_sockets();
@@ -545,6 +553,8 @@ inline void app_glue_periodic(int call_flush_queues,uint8_t *ports_to_poll,int p
 		app_glue_tx_ready_sockets_last_poll_ts = ts;
 		app_glue_rx_ready_sockets_last_poll_ts = ts;
 	}
+	for(port_idx = 0;port_idx < ports_to_poll_count;port_idx++)
+		transmit_pending(ports_to_poll[port_idx]);
 	total_cycles_stat += rte_rdtsc() - ts;
 }
 /*
@@ -758,4 +768,5 @@ void app_glue_print_stats()
 	printf("app_glue_periodic_called %"PRIu64"\n",app_glue_periodic_called);
 	printf("app_glue_tx_queues_process %"PRIu64"\n",app_glue_tx_queues_process);
 	printf("app_glue_rx_queues_process %"PRIu64"\n",app_glue_rx_queues_process);
+	printf("app_glue_tx_queues_stopped %"PRIu64"\n",app_glue_tx_queues_stopped);
 }
@@ -130,8 +130,10 @@ struct lcore_conf *get_this_lcore_conf()
 {
     return &lcore_queue_conf[rte_lcore_id()];
 }
-/* This function initializes the rx queue rte_mbuf pool */
-static void init_rx_queues_mempools()
+static int rx_pools_socket = -1;
+/* This function initializes the rx queue rte_mbuf pool,
+   on the NIC's socket since the NIC writes and the stack only reads headers */
+static void init_rx_queues_mempools(int socket_id)
 {
 	uint16_t queue_id;
         char pool_name[1024];
@@ -146,20 +148,21 @@ static void init_rx_queues_mempools()
 						   sizeof(struct rte_pktmbuf_pool_private),
 						   rte_pktmbuf_pool_init, NULL,
 						   rte_pktmbuf_init, NULL,
-						   rte_socket_id(), 0);
+						   socket_id, 0);
 			if (pool_direct[queue_id] == NULL)
 				rte_panic("Cannot init direct mbuf pool\n");
         }
+        rx_pools_socket = socket_id;
 }
 
 static const struct rte_eth_conf port_conf = {
 	.rxmode = {
 		.split_hdr_size = 0,
 		.header_split   = 0, /**< Header Split disabled */
-		.hw_ip_checksum = 0, /**< IP checksum offload disabled */
+		.hw_ip_checksum = 0, /**< IP checksum offload, set per port if the PMD supports it */
 		.hw_vlan_filter = 0, /**< VLAN filtering disabled */
-		.jumbo_frame    = 1, /**< Jumbo Frame Support disabled */
-                .max_rx_pkt_len = 0x2000,
+		.jumbo_frame    = 1, /**< Jumbo Frame Support enabled */
+                .max_rx_pkt_len = DPDK_DEV_MAX_RX_PKT_LEN,
 		.hw_strip_crc   = 0, /**< CRC stripped by hardware */
 		.mq_mode = ETH_MQ_RX_NONE/*ETH_MQ_RX_RSS*/,
 	},
@@ -175,7 +178,9 @@ static const struct rte_eth_rxconf rx_conf = {
 		.wthresh = RX_WTHRESH,
 	},
         .rx_free_thresh = MAX_PKT_BURST/*0*/,
-        .rx_drop_en = 0,
+        /* a full queue drops its own packets (counted per queue, see dpdk_dev_sample_nic_stats)
+           instead of filling the NIC's packet buffer and stalling the other queues */
+        .rx_drop_en = 1,
 };
 
 static const struct rte_eth_txconf tx_conf = {
@@ -258,6 +263,7 @@ DUMP(argc);
 }
 
 static struct rte_mempool *mbufs_mempool = NULL;
+static int mbufs_mempool_socket = -1;
 
 extern unsigned long tcp_memory_allocated;
 extern uint64_t sk_stream_alloc_skb_failed;
@@ -266,10 +272,20 @@ extern uint64_t read_sockets_queue_len;
 extern struct rte_mempool *free_command_pool;
 
 void show_mib_stats(void);
+static void *dpdk_devices[RTE_MAX_ETHPORTS];
 /* This function only prints statistics, it it not called on data path */
 static int print_stats(__attribute__((unused)) void *dummy)
 {
+	int portid;
+
 	while(1) {
+		/* NIC counters are published to the apps regardless of what is printed below */
+		for(portid = 0;portid < RTE_MAX_ETHPORTS;portid++) {
+			if(dpdk_devices[portid] == NULL)
+				continue;
+			dpdk_dev_sample_nic_stats(portid);
+			dpdk_dev_print_nic_stats(portid);
+		}
 #if 1
 		app_glue_print_stats();
 		show_mib_stats();
@@ -282,6 +298,7 @@ static int print_stats(__attribute__((unused)) void *dummy)
 		dump_fclone_cache();
 		printf("rx pool free count %d\n",rte_mempool_count(pool_direct[0]));
 		printf("stack pool free count %d\n",rte_mempool_count(mbufs_mempool));
+		printf("rx pools on socket %d stack pool on socket %d\n",rx_pools_socket,mbufs_mempool_socket);
                 printf("write_sockets_queue_len %"PRIu64" read_sockets_queue_len %"PRIu64" command pool %d \n",
                        write_sockets_queue_len,read_sockets_queue_len,free_command_pool ? rte_mempool_count(free_command_pool) : -1);
 		print_skb_iov_stats();
@@ -315,12 +332,13 @@ void release_buffer(void *buf)
 typedef struct
 {
 	int  port_number;
+	int  vlan_id; /* 0 for the port itself */
 	char ip_addr_str[20];
 	char ip_mask_str[20];
+	int  mtu; /* 0 if not given */
 }dpdk_dev_config_t;
 #define ALIASES_MAX_NUMBER 4
 static dpdk_dev_config_t dpdk_dev_config[RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER];
-static void *dpdk_devices[RTE_MAX_ETHPORTS];
 /* This function returns a pointer to kernel's interface structure, required to access the driver */
 void *get_dpdk_dev_by_port_num(int port_num)
 {
@@ -334,6 +352,7 @@ static int get_dpdk_ip_stack_config()
 {
 	FILE *p_config_file;
 	int i,rc;
+	char port_str[20],mtu_str[20],line[128];
 	p_config_file = fopen("dpdk_ip_stack_config.txt","r");
 	if(!p_config_file){
 		printf("cannot open dpdk_ip_stack_config.txt");
@@ -343,12 +362,24 @@ static int get_dpdk_ip_stack_config()
 		dpdk_dev_config[i].port_number = -1;
 	}
 	i = 0;
-	while(!feof(p_config_file)) {
-		rc = fscanf(p_config_file,"%d %s %s",&dpdk_dev_config[i].port_number,dpdk_dev_config[i].ip_addr_str,dpdk_dev_config[i].ip_mask_str);
-		if(!rc){
+	while(fgets(line,sizeof(line),p_config_file)) {
+		/* <port>[.<vlan id>] <ip address> <ip mask> [mtu=<bytes>] */
+		rc = sscanf(line,"%19s %19s %19s %19s",port_str,dpdk_dev_config[i].ip_addr_str,dpdk_dev_config[i].ip_mask_str,mtu_str);
+		if(rc < 3){
+			continue;
+		}
+		dpdk_dev_config[i].mtu = 0;
+		if((rc == 4)&&(sscanf(mtu_str,"mtu=%d",&dpdk_dev_config[i].mtu) != 1)) {
+			printf("unknown config key %s %s %d\n",mtu_str,__FILE__,__LINE__);
+			continue;
+		}
+		dpdk_dev_config[i].vlan_id = 0;
+		if(sscanf(port_str,"%d.%d",&dpdk_dev_config[i].port_number,&dpdk_dev_config[i].vlan_id) < 1) {
+			dpdk_dev_config[i].port_number = -1;
 			continue;
 		}
-		printf("retrieved config entry %d %s %s\n",dpdk_dev_config[i].port_number,dpdk_dev_config[i].ip_addr_str,dpdk_dev_config[i].ip_mask_str);
+		printf("retrieved config entry %d.%d %s %s mtu %d\n",dpdk_dev_config[i].port_number,dpdk_dev_config[i].vlan_id,
+		       dpdk_dev_config[i].ip_addr_str,dpdk_dev_config[i].ip_mask_str,dpdk_dev_config[i].mtu);
 		i++;
 		if(i == RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER) {
 			break;
@@ -361,12 +392,27 @@ static dpdk_dev_config_t *get_dpdk_config_entry(int portnum)
 {
 	int i;
 	for(i = 0;i < RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER;i++) {
-		if(dpdk_dev_config[i].port_number == portnum) {
+		if((dpdk_dev_config[i].port_number == portnum)&&(dpdk_dev_config[i].vlan_id == 0)) {
 			return &dpdk_dev_config[i];
 		}
 	}
 	return NULL;
 }
+/* frames the port receives: the largest MTU of its netdev and VLANs, the default if none is given */
+static int get_dpdk_port_max_rx_pkt_len(int portnum)
+{
+	int i,mtu = ETHER_MTU;
+
+	for(i = 0;i < RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER;i++) {
+		if((dpdk_dev_config[i].port_number == portnum)&&(dpdk_dev_config[i].mtu > mtu))
+			mtu = dpdk_dev_config[i].mtu;
+	}
+	if(mtu + ETHER_HDR_LEN + sizeof(struct vlan_hdr) + ETHER_CRC_LEN > DPDK_DEV_MAX_RX_PKT_LEN) {
+		printf("MTU %d on port %d is over the maximum %s %d\n",mtu,portnum,__FILE__,__LINE__);
+		return DPDK_DEV_MAX_RX_PKT_LEN;
+	}
+	return mtu + ETHER_HDR_LEN + sizeof(struct vlan_hdr) + ETHER_CRC_LEN;
+}
 /*
  * This function must be called prior any other in this package.
  * It initializes all the DPDK libs, reads the configuration, initializes the stack's
@@ -376,12 +422,14 @@ static dpdk_dev_config_t *get_dpdk_config_entry(int portnum)
  */
 int dpdk_linux_tcpip_init(int argc,char **argv)
 {
-	int ret,sub_if_idx = 0;
+	int ret,sub_if_idx = 0,i,j,instance;
+	void *vlan_dev;
 	uint8_t nb_ports;
 	uint8_t portid, last_port;
     uint16_t queue_id;
 	struct lcore_conf *conf;
 	struct rte_eth_dev_info dev_info;
+	struct rte_eth_conf eth_conf;
 	unsigned nb_ports_in_mask = 0;
 	uint8_t nb_ports_available;
 	unsigned lcore_id, core_count;
@@ -414,17 +462,20 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 	/* init RTE timer library */
 	rte_timer_subsystem_init();
 
-	init_rx_queues_mempools();
+	mbufs_mempool_socket = rte_socket_id();
 	mbufs_mempool = rte_mempool_create("mbufs_mempool", APP_MBUFS_POOL_SIZE,
 							   MBUF_SIZE, 0,
 							   sizeof(struct rte_pktmbuf_pool_private),
 							   rte_pktmbuf_pool_init, NULL,
 							   rte_pktmbuf_init, NULL,
-							   rte_socket_id(), 0);
+							   mbufs_mempool_socket, 0);
 	if(mbufs_mempool == NULL) {
 		printf("%s %d\n",__FILE__,__LINE__);
 		exit(0);
 	}
+#ifdef DPDK_SW_LOOP
+	init_rx_queues_mempools(rte_socket_id());
+#endif
 #ifndef DPDK_SW_LOOP /* enable when at least one compatable NIC */
 	/* init driver(s) */
 	if (rte_pmd_init_all() < 0)
@@ -439,6 +490,15 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 
 	if (nb_ports > RTE_MAX_ETHPORTS)
 		nb_ports = RTE_MAX_ETHPORTS;
+	/* rx queues of all ports share the pools, use the first enabled port's socket */
+	for (portid = 0; portid < nb_ports; portid++) {
+		if (enabled_port_mask & (1 << portid))
+			break;
+	}
+	if ((portid < nb_ports) && (rte_eth_dev_socket_id(portid) >= 0))
+		init_rx_queues_mempools(rte_eth_dev_socket_id(portid));
+	else
+		init_rx_queues_mempools(rte_socket_id());
 	core_count = rte_lcore_count();
 	/*
 	 * Each logical core is assigned a dedicated TX queue on each port.
@@ -490,7 +550,14 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 		/* init port */
 		printf("Initializing port %u... ", (unsigned) portid);
 		fflush(stdout);
-		ret = rte_eth_dev_configure(portid, RX_QUEUE_PER_PORT, TX_QUEUE_PER_PORT, &port_conf);
+		eth_conf = port_conf;
+		eth_conf.rxmode.hw_ip_checksum = dpdk_dev_rx_csum_capable(portid);
+		eth_conf.rxmode.hw_vlan_strip = dpdk_dev_rx_vlan_strip_capable(portid);
+		/* DPDK 1.6 has no rte_eth_dev_set_mtu, the frame size is set at configure */
+		dpdk_dev_max_rx_pkt_len[portid] = get_dpdk_port_max_rx_pkt_len(portid);
+		eth_conf.rxmode.max_rx_pkt_len = dpdk_dev_max_rx_pkt_len[portid];
+		eth_conf.rxmode.jumbo_frame = (eth_conf.rxmode.max_rx_pkt_len > ETHER_MAX_LEN);
+		ret = rte_eth_dev_configure(portid, RX_QUEUE_PER_PORT, TX_QUEUE_PER_PORT, &eth_conf);
 		if (ret < 0)
 			rte_exit(EXIT_FAILURE, "Cannot configure device: err=%d, port=%u\n",
 					ret, (unsigned) portid);
@@ -506,6 +573,9 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 			if (ret < 0)
 				rte_exit(EXIT_FAILURE, "rte_eth_rx_queue_setup:err=%d, port=%u\n",
 						ret, (unsigned) portid);
+			/* queue's own counters, else the NIC counts all queues in the first ones. Not all PMDs have it */
+			if (queue_id < RTE_ETHDEV_QUEUE_STAT_CNTRS)
+				rte_eth_dev_set_rx_queue_stats_mapping(portid, queue_id, queue_id);
 		}
 		/* init one TX queue on each port */
 		fflush(stdout);
@@ -538,10 +608,12 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 			dpdk_devices[portid] = create_netdev(portid);
 		    rte_eth_macaddr_get(portid,&mac_addr);
 		    set_dev_addr(dpdk_devices[portid],mac_addr.addr_bytes,p_dpdk_dev_config->ip_addr_str,p_dpdk_dev_config->ip_mask_str);
+		    if(p_dpdk_dev_config->mtu)
+			    set_dev_mtu(dpdk_devices[portid],p_dpdk_dev_config->mtu);
                     sub_if_idx = portid;
                     while(sub_if_idx < RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER) {
                         p_dpdk_dev_config++;
-                        if(p_dpdk_dev_config->port_number != portid) {
+                        if((p_dpdk_dev_config->port_number != portid)||(p_dpdk_dev_config->vlan_id)) {
                             printf("no more addressed for port %d\n",portid);
                             break;
                         }
@@ -552,6 +624,35 @@ int dpdk_linux_tcpip_init(int argc,char **argv)
 		    printf("%s %d\n",__FILE__,__LINE__);
 		}
 	}
+	/* VLAN sub-interfaces, more entries of the same one are its aliases */
+	for(i = 0;i < RTE_MAX_ETHPORTS*ALIASES_MAX_NUMBER;i++) {
+		p_dpdk_dev_config = &dpdk_dev_config[i];
+		if((p_dpdk_dev_config->port_number < 0)||(p_dpdk_dev_config->vlan_id == 0))
+			continue;
+		if((p_dpdk_dev_config->port_number >= RTE_MAX_ETHPORTS)||(dpdk_devices[p_dpdk_dev_config->port_number] == NULL)) {
+			printf("no netdev for VLAN %d of port %d %s %d\n",p_dpdk_dev_config->vlan_id,p_dpdk_dev_config->port_number,__FILE__,__LINE__);
+			continue;
+		}
+		instance = 0;
+		for(j = 0;j < i;j++)
+			instance += (dpdk_dev_config[j].port_number == p_dpdk_dev_config->port_number)&&
+				    (dpdk_dev_config[j].vlan_id == p_dpdk_dev_config->vlan_id);
+		if(instance) {
+			vlan_dev = get_vlan_netdev(dpdk_devices[p_dpdk_dev_config->port_number],p_dpdk_dev_config->vlan_id);
+			if(vlan_dev)
+				add_dev_addr(vlan_dev,instance,p_dpdk_dev_config->ip_addr_str,p_dpdk_dev_config->ip_mask_str);
+			continue;
+		}
+		vlan_dev = create_vlan_netdev(dpdk_devices[p_dpdk_dev_config->port_number],p_dpdk_dev_config->vlan_id);
+		if(vlan_dev == NULL)
+			continue;
+		rte_eth_macaddr_get(p_dpdk_dev_config->port_number,&mac_addr);
+		set_dev_addr(vlan_dev,mac_addr.addr_bytes,p_dpdk_dev_config->ip_addr_str,p_dpdk_dev_config->ip_mask_str);
+		if(p_dpdk_dev_config->mtu)
+			set_dev_mtu(vlan_dev,p_dpdk_dev_config->mtu);
+		printf("VLAN %d on port %d address %s\n",p_dpdk_dev_config->vlan_id,p_dpdk_dev_config->port_number,p_dpdk_dev_config->ip_addr_str);
+	}
+	dpdk_dev_init_nic_stats();
 	init_systick(rte_lcore_id());
 #ifdef DPDK_SW_LOOP
 	init_dpdk_sw_loop();
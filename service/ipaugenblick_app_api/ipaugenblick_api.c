@@ -8,15 +8,18 @@
 #include <rte_mempool.h>
 #include <rte_cycles.h>
 #include <rte_ring.h>
+#include <rte_memzone.h>
 #include <rte_mbuf.h>
 #include <rte_byteorder.h>
 #include "../ipaugenblick_common/ipaugenblick_common.h"
+#include <specific_includes/dpdk_drv_iface.h>
 #include "ipaugenblick_ring_ops.h"
 #include "ipaugenblick_api.h"
 #include <netinet/in.h> 
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
+#include <emmintrin.h>
 #if 0
 #define offsetof(TYPE, MEMBER) ((size_t)&((TYPE*)0)->MEMBER)
 #endif
@@ -29,21 +32,34 @@ const typeof(((type*) 0)->member)*__mptr=(ptr); \
 
 #define RTE_MBUF(d) container_of(PKT(d),struct rte_mbuf,pkt)
 
+/* reads of this size and above bypass the cache when copied to the user's buffer.
+   0 disables non-temporal stores */
+#ifndef IPAUGENBLICK_READ_NT_THRESHOLD
+#define IPAUGENBLICK_READ_NT_THRESHOLD (256*1024)
+#endif
+
 local_socket_descriptor_t local_socket_descriptors[IPAUGENBLICK_CONNECTION_POOL_SIZE];
 struct rte_mempool *free_connections_pool = NULL;
 struct rte_ring *free_connections_ring = NULL;
 struct rte_mempool *tx_bufs_pool = NULL;
 struct rte_ring *rx_bufs_ring = NULL;
 struct rte_mempool *free_command_pool = NULL;
-struct rte_ring *command_ring = NULL;
+ipaugenblick_cmd_ring_t *ipaugenblick_app_cmd_ring = NULL;
 struct rte_ring *selectors_ring = NULL;
 
 typedef struct
 {
     struct rte_ring *ready_connections; 
+    struct rte_ring *shared_rx;
 }selector_t;
 
 static selector_t selectors[IPAUGENBLICK_CONNECTION_POOL_SIZE];
+/* tx/rx rings by NUMA socket and connection, looked up once */
+static struct rte_ring *data_rings[RTE_MAX_NUMA_NODES][IPAUGENBLICK_CONNECTION_POOL_SIZE][2];
+static struct rte_ring *big_rings[RTE_MAX_NUMA_NODES][IPAUGENBLICK_BIG_RINGS_COUNT][2];
+static ipaugenblick_shared_rx_state_t *shared_rx_state = NULL;
+static ipaugenblick_socket_t *ipaugenblick_sockets_base = NULL;
+static dpdk_dev_nic_stats_t *nic_stats_base = NULL;
 
 uint64_t ipaugenblick_stats_receive_called = 0;
 uint64_t ipaugenblick_stats_send_called = 0;
@@ -57,9 +73,17 @@ uint64_t ipaugenblick_stats_select_returned = 0;
 uint64_t ipaugenblick_stats_tx_buf_allocation_failure = 0;
 uint64_t ipaugenblick_stats_send_failure = 0;
 uint64_t ipaugenblick_stats_recv_failure = 0;
+uint64_t ipaugenblick_stats_shared_rx_stale = 0;
+uint64_t ipaugenblick_stats_handoff_shared_rx = 0;
 uint64_t ipaugenblick_stats_buffers_sent = 0;
 uint64_t ipaugenblick_stats_buffers_allocated = 0;
 uint64_t ipaugenblick_stats_cannot_allocate_cmd = 0;
+uint64_t ipaugenblick_stats_read_called = 0;
+uint64_t ipaugenblick_stats_bytes_read = 0;
+int ipaugenblick_app_numa_socket = 0;
+static uint64_t ipaugenblick_tsc_hz = 0;
+uint64_t ipaugenblick_stats_tx_credits_exhausted = 0;
+uint64_t ipaugenblick_stats_tx_budget_exhausted = 0;
 pthread_t stats_thread;
 uint8_t g_print_stats_loop = 1;
 
@@ -70,13 +94,20 @@ void print_stats()
                 ipaugenblick_stats_rx_kicks_sent %lu ipaugenblick_stats_tx_kicks_sent %lu ipaugenblick_stats_cannot_allocate_cmd %lu  \n\t\
                 ipaugenblick_stats_rx_full %lu ipaugenblick_stats_rx_dequeued %lu ipaugenblick_stats_rx_dequeued_local %lu \n\t\
                 ipaugenblick_stats_select_called %lu ipaugenblick_stats_select_returned %lu ipaugenblick_stats_tx_buf_allocation_failure %lu \n\t\
-                ipaugenblick_stats_send_failure %lu ipaugenblick_stats_recv_failure %lu ipaugenblick_stats_buffers_sent %lu ipaugenblick_stats_buffers_allocated %lu\n",
+                ipaugenblick_stats_send_failure %lu ipaugenblick_stats_recv_failure %lu ipaugenblick_stats_buffers_sent %lu ipaugenblick_stats_buffers_allocated %lu \n\t\
+                ipaugenblick_stats_read_called %lu ipaugenblick_stats_bytes_read %lu \n\t\
+                ipaugenblick_stats_tx_credits_exhausted %lu ipaugenblick_stats_tx_budget_exhausted %lu app tx buffers held %d/%d \n\t\
+                ipaugenblick_stats_shared_rx_stale %lu ipaugenblick_stats_handoff_shared_rx %lu\n",
                 ipaugenblick_stats_receive_called,ipaugenblick_stats_send_called,ipaugenblick_stats_rx_kicks_sent,
                 ipaugenblick_stats_tx_kicks_sent,ipaugenblick_stats_cannot_allocate_cmd,ipaugenblick_stats_rx_full,ipaugenblick_stats_rx_dequeued,
                 ipaugenblick_stats_rx_dequeued_local,ipaugenblick_stats_select_called,ipaugenblick_stats_select_returned,ipaugenblick_stats_tx_buf_allocation_failure,
                 ipaugenblick_stats_send_failure,ipaugenblick_stats_recv_failure,
                 ipaugenblick_stats_buffers_sent,
-                ipaugenblick_stats_buffers_allocated);
+                ipaugenblick_stats_buffers_allocated,
+                ipaugenblick_stats_read_called,ipaugenblick_stats_bytes_read,
+                ipaugenblick_stats_tx_credits_exhausted,ipaugenblick_stats_tx_budget_exhausted,
+                ipaugenblick_app_cmd_ring ? rte_atomic32_read(&ipaugenblick_app_cmd_ring->tx_inflight) : 0,
+                IPAUGENBLICK_APP_TX_CREDITS,ipaugenblick_stats_shared_rx_stale,ipaugenblick_stats_handoff_shared_rx);
         sleep(1);
     }
 }
@@ -107,12 +138,14 @@ int ipaugenblick_app_init(int argc,char **argv)
 {
     int i;
     char ringname[1024];
+    uint32_t numa_mask;
 
     if(rte_eal_init(argc, argv) < 0) {
         printf("%s %d\n",__FILE__,__LINE__);
 	return -1;
     }
     printf("EAL initialized\n");
+    ipaugenblick_tsc_hz = rte_get_tsc_hz();
     free_connections_ring = rte_ring_lookup(FREE_CONNECTIONS_RING);
 
     if(!free_connections_ring) {
@@ -127,22 +160,30 @@ int ipaugenblick_app_init(int argc,char **argv)
         return -1;
     }
 
+    /* connections opened by this app get the rings on this socket,
+       the lowest socket having memory if this one has none, as the service does */
+    ipaugenblick_app_numa_socket = rte_socket_id();
+    numa_mask = ipaugenblick_memory_numa_mask();
+    if((numa_mask)&&(!(numa_mask & (1 << ipaugenblick_app_numa_socket)))) {
+        printf("no memory on socket %d, using socket %d\n",ipaugenblick_app_numa_socket,__builtin_ctz(numa_mask));
+        ipaugenblick_app_numa_socket = __builtin_ctz(numa_mask);
+    }
+    printf("connection rings on socket %d\n",ipaugenblick_app_numa_socket);
+
     memset(local_socket_descriptors,0,sizeof(local_socket_descriptors));
+    memset(data_rings,0,sizeof(data_rings));
     for(i = 0;i < IPAUGENBLICK_CONNECTION_POOL_SIZE;i++) {
-        sprintf(ringname,RX_RING_NAME_BASE"%d",i);
-        local_socket_descriptors[i].rx_ring = rte_ring_lookup(ringname);
-        if(!local_socket_descriptors[i].rx_ring) {
-            printf("%s %d\n",__FILE__,__LINE__);
-            exit(0);
-        }
-        sprintf(ringname,TX_RING_NAME_BASE"%d",i);
-        local_socket_descriptors[i].tx_ring = rte_ring_lookup(ringname);
-        if(!local_socket_descriptors[i].tx_ring) {
+        /* tx/rx rings are bound when the connection is opened, accepted or adopted */
+        sprintf(ringname,ERRQ_RING_NAME_BASE"%d",i);
+        local_socket_descriptors[i].errq_ring = rte_ring_lookup(ringname);
+        if(!local_socket_descriptors[i].errq_ring) {
             printf("%s %d\n",__FILE__,__LINE__);
             exit(0);
         }
+        local_socket_descriptors[i].numa_socket = ipaugenblick_app_numa_socket;
         local_socket_descriptors[i].select = -1;
         local_socket_descriptors[i].socket = NULL;
+        local_socket_descriptors[i].handed_off = 0;
         sprintf(ringname,"local_rx_cache%d_%d",getpid(),i);
         printf("local cache name %s\n",ringname);
         local_socket_descriptors[i].local_cache = rte_ring_create(ringname, 16384,rte_socket_id(), RING_F_SC_DEQ|RING_F_SP_ENQ);
@@ -163,11 +204,34 @@ int ipaugenblick_app_init(int argc,char **argv)
         return -1;
     }
     
-    command_ring = rte_ring_lookup(COMMAND_RING_NAME);
-    if(!command_ring) {
-        printf("cannot find command ring\n");
+    /* a ring of our own, or the one a dead app left */
+    for(i = 0;i < IPAUGENBLICK_CMD_RINGS_COUNT;i++) {
+        const struct rte_memzone *mz;
+        ipaugenblick_cmd_ring_t *cmd_ring;
+        int owner;
+
+        sprintf(ringname,CMD_RING_NAME_BASE"%d",i);
+        mz = rte_memzone_lookup(ringname);
+        if(!mz) {
+            printf("cannot find command ring %s\n",ringname);
+            return -1;
+        }
+        cmd_ring = (ipaugenblick_cmd_ring_t *)mz->addr;
+        owner = rte_atomic32_read(&cmd_ring->pid);
+        if((owner)&&((kill(owner,0) == 0)||(errno != ESRCH)))
+            continue;
+        if(rte_atomic32_cmpset((volatile uint32_t *)&cmd_ring->pid.cnt,owner,getpid())) {
+            cmd_ring->tx_budget = IPAUGENBLICK_APP_TX_CREDITS;
+            /* tx_inflight is left alone, the service writes off what the dead app held once it sees the new pid */
+            ipaugenblick_app_cmd_ring = cmd_ring;
+            break;
+        }
+    }
+    if(!ipaugenblick_app_cmd_ring) {
+        printf("no free command ring\n");
         return -1;
     }
+    printf("command ring %d\n",i);
     rx_bufs_ring = rte_ring_lookup("rx_mbufs_ring");
     if(!rx_bufs_ring) {
         printf("cannot find rx bufs ring\n");
@@ -182,6 +246,32 @@ int ipaugenblick_app_init(int argc,char **argv)
             printf("cannot find ring %s %d\n",__FILE__,__LINE__);
             exit(0);
         } 
+        sprintf(ringname,SHARED_RX_RING_NAME_BASE"%d",i);
+        selectors[i].shared_rx = rte_ring_lookup(ringname);
+        if(!selectors[i].shared_rx) {
+            printf("cannot find ring %s %d\n",__FILE__,__LINE__);
+            exit(0);
+        } 
+    }
+    {
+        const struct rte_memzone *mz = rte_memzone_lookup(SHARED_RX_STATE_NAME);
+        if(!mz) {
+            printf("cannot find shared rx state\n");
+            return -1;
+        }
+        shared_rx_state = (ipaugenblick_shared_rx_state_t *)mz->addr;
+        mz = rte_memzone_lookup(SOCKETS_MEMZONE_NAME);
+        if(!mz) {
+            printf("cannot find sockets memzone\n");
+            return -1;
+        }
+        ipaugenblick_sockets_base = *(ipaugenblick_socket_t **)mz->addr;
+        mz = rte_memzone_lookup(DPDK_DEV_NIC_STATS_MEMZONE_NAME);
+        if(!mz) {
+            printf("cannot find NIC stats memzone\n");
+            return -1;
+        }
+        nic_stats_base = (dpdk_dev_nic_stats_t *)mz->addr;
     }
     
     signal(SIGHUP, sig_handler);
@@ -194,7 +284,7 @@ int ipaugenblick_app_init(int argc,char **argv)
     signal(SIGTERM, sig_handler);
     signal(SIGUSR1, sig_handler);
     pthread_create(&stats_thread,NULL,print_stats,NULL);
-    return ((tx_bufs_pool == NULL)||(command_ring == NULL)||(free_command_pool == NULL));
+    return ((tx_bufs_pool == NULL)||(ipaugenblick_app_cmd_ring == NULL)||(free_command_pool == NULL));
 }
 
 static inline void ipaugenblick_free_command_buf(ipaugenblick_cmd_t *cmd)
@@ -210,17 +300,19 @@ int ipaugenblick_open_select(void)
         printf("%s %d\n",__FILE__,__LINE__);
         return -1;
     }
+    /* connections are handed off only to a selector some process opened, and adopted only by it */
+    rte_atomic32_set(&shared_rx_state[ringset_idx].owner_pid,getpid());
     return (int)ringset_idx;
 }
 
-int ipaugenblick_set_socket_select(int sock,int select)
+static int ipaugenblick_attach_socket_select(int sock,int select,int shared_rx)
 {
    ipaugenblick_cmd_t *cmd;
 
     if(sock < 0)
         return -1;
 
-   cmd = ipaugenblick_get_free_command_buf();
+   cmd = ipaugenblick_get_command_slot();
    if(!cmd) {
        ipaugenblick_stats_cannot_allocate_cmd++;
        return -2;
@@ -230,11 +322,136 @@ int ipaugenblick_set_socket_select(int sock,int select)
    cmd->ringset_idx = sock;
    cmd->u.set_socket_select.socket_select = select;
    cmd->u.set_socket_select.pid = getpid();
-   if(ipaugenblick_enqueue_command_buf(cmd)) {
-       ipaugenblick_free_command_buf(cmd);
-       return -3;
-   }
+   cmd->u.set_socket_select.shared_rx = shared_rx;
+   ipaugenblick_post_command();
    local_socket_descriptors[sock].select = select;
+   return 0;
+}
+
+int ipaugenblick_set_socket_select(int sock,int select)
+{
+    return ipaugenblick_attach_socket_select(sock,select,0);
+}
+
+int ipaugenblick_set_socket_select_shared_rx(int sock,int select)
+{
+    return ipaugenblick_attach_socket_select(sock,select,1);
+}
+
+static int ipaugenblick_bind_local_rings(int sock,int numa_socket)
+{
+    struct rte_ring **rings = data_rings[numa_socket][sock];
+
+    if(!rings[0])
+        rings[0] = ipaugenblick_data_ring_get(TX_RING_NAME_BASE,numa_socket,sock);
+    if(!rings[1])
+        rings[1] = ipaugenblick_data_ring_get(RX_RING_NAME_BASE,numa_socket,sock);
+    if((!rings[0])||(!rings[1])) {
+        printf("cannot find rings %s %d\n",__FILE__,__LINE__);
+        return -1;
+    }
+    local_socket_descriptors[sock].tx_ring = rings[0];
+    local_socket_descriptors[sock].rx_ring = rings[1];
+    local_socket_descriptors[sock].tx_ring_id = IPAUGENBLICK_HOME_RING;
+    local_socket_descriptors[sock].rx_ring_id = IPAUGENBLICK_HOME_RING;
+    local_socket_descriptors[sock].numa_socket = numa_socket;
+    return 0;
+}
+
+/* dir - 0 tx, 1 rx. Big rings are created by the service, looked up once */
+static int ipaugenblick_switch_local_ring(int sock,int dir,int ring_id)
+{
+    local_socket_descriptor_t *descriptor = &local_socket_descriptors[sock];
+    char ringname[RTE_RING_NAMESIZE];
+    struct rte_ring *ring;
+
+    if(ring_id == IPAUGENBLICK_HOME_RING)
+        ring = data_rings[descriptor->numa_socket][sock][dir];
+    else if((ring_id >= 0)&&(ring_id < IPAUGENBLICK_BIG_RINGS_COUNT)) {
+        ring = big_rings[descriptor->numa_socket][ring_id][dir];
+        if(!ring) {
+            ipaugenblick_big_ring_name(ringname,dir ? RX_RING_NAME_BASE : TX_RING_NAME_BASE,descriptor->numa_socket,ring_id);
+            ring = big_rings[descriptor->numa_socket][ring_id][dir] = rte_ring_lookup(ringname);
+        }
+    }
+    else
+        ring = NULL;
+    if(!ring) {
+        printf("cannot find ring %d of socket %d %s %d\n",ring_id,sock,__FILE__,__LINE__);
+        return -1;
+    }
+    if(dir) {
+        descriptor->rx_ring = ring;
+        descriptor->rx_ring_id = ring_id;
+    }
+    else {
+        descriptor->tx_ring = ring;
+        descriptor->tx_ring_id = ring_id;
+    }
+    return 0;
+}
+
+/* from the next enqueue on. The service takes from the old ring until it is empty */
+void ipaugenblick_follow_tx_ring(int sock)
+{
+    ipaugenblick_socket_t *ipaugenblick_socket = local_socket_descriptors[sock].socket;
+    int ring_id = rte_atomic32_read(&ipaugenblick_socket->tx_ring_id);
+
+    if(ipaugenblick_switch_local_ring(sock,0,ring_id))
+        return;
+    /* what was put to the old ring is seen before the ack */
+    rte_wmb();
+    rte_atomic32_set(&ipaugenblick_socket->tx_ring_ack,ring_id);
+}
+
+/* once the old ring is read out, the service fills only the new one */
+void ipaugenblick_follow_rx_ring(int sock)
+{
+    ipaugenblick_socket_t *ipaugenblick_socket = local_socket_descriptors[sock].socket;
+    int ring_id = rte_atomic32_read(&ipaugenblick_socket->rx_ring_id);
+
+    /* the service's last enqueues to the old ring are seen before the new id */
+    rte_rmb();
+    if(rte_ring_count(local_socket_descriptors[sock].rx_ring))
+        return;
+    if(ipaugenblick_switch_local_ring(sock,1,ring_id))
+        return;
+    rte_atomic32_set(&ipaugenblick_socket->rx_ring_ack,ring_id);
+}
+
+/* every socket gets a full window, the sum of the windows may exceed the app's budget.
+   The budget is checked as buffers are taken, idle sockets cost nothing */
+static inline void ipaugenblick_init_tx_credits(int sock)
+{
+    rte_atomic32_set(&local_socket_descriptors[sock].socket->tx_window,IPAUGENBLICK_SOCKET_TX_CREDITS);
+    rte_atomic32_set(&local_socket_descriptors[sock].socket->tx_inflight,0);
+    local_socket_descriptors[sock].tx_blocked = 0;
+}
+
+static inline int ipaugenblick_take_tx_credits(int sock,int count)
+{
+    ipaugenblick_socket_t *ipaugenblick_socket = local_socket_descriptors[sock].socket;
+
+    if(rte_atomic32_add_return(&ipaugenblick_socket->tx_inflight,count) > rte_atomic32_read(&ipaugenblick_socket->tx_window)) {
+        rte_atomic32_sub(&ipaugenblick_socket->tx_inflight,count);
+        ipaugenblick_stats_tx_credits_exhausted++;
+        return -1;
+    }
+    if(rte_atomic32_add_return(&ipaugenblick_app_cmd_ring->tx_inflight,count) > IPAUGENBLICK_APP_TX_CREDITS) {
+        rte_atomic32_sub(&ipaugenblick_app_cmd_ring->tx_inflight,count);
+        rte_atomic32_sub(&ipaugenblick_socket->tx_inflight,count);
+        ipaugenblick_stats_tx_budget_exhausted++;
+        return -1;
+    }
+    local_socket_descriptors[sock].tx_blocked = 0;
+    return 0;
+}
+
+/* buffers taken and not sent */
+static inline void ipaugenblick_give_back_tx_credits(int sock,int count)
+{
+    rte_atomic32_sub(&local_socket_descriptors[sock].socket->tx_inflight,count);
+    rte_atomic32_sub(&ipaugenblick_app_cmd_ring->tx_inflight,count);
 }
 
 /* open asynchronous TCP client socket */
@@ -247,15 +464,20 @@ int ipaugenblick_open_tcp_client(unsigned int ipaddr,unsigned short port,unsigne
         printf("%s %d\n",__FILE__,__LINE__);
         return -1;
     }
+    if(ipaugenblick_bind_local_rings(ipaugenblick_socket->connection_idx,ipaugenblick_app_numa_socket)) {
+        rte_ring_enqueue(free_connections_ring,ipaugenblick_socket);
+        return -1;
+    }
 
     /* allocate a ringset (cmd/tx/rx) here */
-    cmd = ipaugenblick_get_free_command_buf();
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return -2;
     }
 
     cmd->cmd = IPAUGENBLICK_OPEN_CLIENT_SOCKET_COMMAND;
+    cmd->numa_socket = ipaugenblick_app_numa_socket;
     cmd->ringset_idx = ipaugenblick_socket->connection_idx;
     cmd->parent_idx = -1;
     cmd->u.open_client_sock.my_ipaddress = myipaddr;
@@ -263,12 +485,11 @@ int ipaugenblick_open_tcp_client(unsigned int ipaddr,unsigned short port,unsigne
     cmd->u.open_client_sock.peer_ipaddress = ipaddr;
     cmd->u.open_client_sock.peer_port = port;
 
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-        return -3;
-    }
-
+    /* the service takes it as the initial tx window when it binds the rings */
     local_socket_descriptors[ipaugenblick_socket->connection_idx].socket = ipaugenblick_socket;
+    ipaugenblick_init_tx_credits(ipaugenblick_socket->connection_idx);
+
+    ipaugenblick_post_command();
 
     return ipaugenblick_socket->connection_idx;
 }
@@ -282,25 +503,29 @@ int ipaugenblick_open_tcp_server(unsigned int ipaddr,unsigned short port)
     if(rte_ring_dequeue(free_connections_ring,(void **)&ipaugenblick_socket)) {
         return -1;
     }
+    if(ipaugenblick_bind_local_rings(ipaugenblick_socket->connection_idx,ipaugenblick_app_numa_socket)) {
+        rte_ring_enqueue(free_connections_ring,ipaugenblick_socket);
+        return -1;
+    }
 
-    cmd = ipaugenblick_get_free_command_buf();
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return -2;
     }
 
     cmd->cmd = IPAUGENBLICK_OPEN_LISTENING_SOCKET_COMMAND;
+    cmd->numa_socket = ipaugenblick_app_numa_socket;
     cmd->ringset_idx = ipaugenblick_socket->connection_idx;
     cmd->parent_idx = -1;
     cmd->u.open_listening_sock.ipaddress = ipaddr;
     cmd->u.open_listening_sock.port = port;
 
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-        return -3;
-    }
-
+    /* the service takes it as the initial tx window when it binds the rings */
     local_socket_descriptors[ipaugenblick_socket->connection_idx].socket = ipaugenblick_socket;
+    ipaugenblick_init_tx_credits(ipaugenblick_socket->connection_idx);
+
+    ipaugenblick_post_command();
 
     return ipaugenblick_socket->connection_idx;
 }
@@ -314,25 +539,29 @@ int ipaugenblick_open_udp(unsigned int ipaddr,unsigned short port)
     if(rte_ring_dequeue(free_connections_ring,(void **)&ipaugenblick_socket)) {
         return -1;
     }
+    if(ipaugenblick_bind_local_rings(ipaugenblick_socket->connection_idx,ipaugenblick_app_numa_socket)) {
+        rte_ring_enqueue(free_connections_ring,ipaugenblick_socket);
+        return -1;
+    }
 
-    cmd = ipaugenblick_get_free_command_buf();
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return -2;
     }
 
     cmd->cmd = IPAUGENBLICK_OPEN_UDP_SOCKET_COMMAND;
+    cmd->numa_socket = ipaugenblick_app_numa_socket;
     cmd->ringset_idx = ipaugenblick_socket->connection_idx;
     cmd->parent_idx = -1;
     cmd->u.open_listening_sock.ipaddress = ipaddr;
     cmd->u.open_listening_sock.port = port;
 
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-        return -3;
-    }
-
+    /* the service takes it as the initial tx window when it binds the rings */
     local_socket_descriptors[ipaugenblick_socket->connection_idx].socket = ipaugenblick_socket;
+    ipaugenblick_init_tx_credits(ipaugenblick_socket->connection_idx);
+
+    ipaugenblick_post_command();
 
     return ipaugenblick_socket->connection_idx;
 }
@@ -341,7 +570,14 @@ int ipaugenblick_open_udp(unsigned int ipaddr,unsigned short port)
 void ipaugenblick_close(int sock)
 {
     ipaugenblick_cmd_t *cmd;
-    cmd = ipaugenblick_get_free_command_buf();
+    while(!rte_ring_sc_dequeue(local_socket_descriptors[sock].errq_ring,(void **)&cmd)) {
+        ipaugenblick_free_command_buf(cmd);
+    }
+    if(local_socket_descriptors[sock].read_pending) {
+        ipaugenblick_release_rx_buffer(&(local_socket_descriptors[sock].read_pending->pkt.data));
+        local_socket_descriptors[sock].read_pending = NULL;
+    }
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return;
@@ -349,35 +585,156 @@ void ipaugenblick_close(int sock)
     cmd->cmd = IPAUGENBLICK_SOCKET_CLOSE_COMMAND;
     cmd->ringset_idx = sock;
     cmd->parent_idx = local_socket_descriptors[sock].select;
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-       ipaugenblick_free_command_buf(cmd); 
+    ipaugenblick_post_command();
+    /* the service writes off what is outstanding, buffers released later are not given back */
+    local_socket_descriptors[sock].socket = NULL;
+    local_socket_descriptors[sock].handed_off = 0;
+}
+
+/* TCP. The connection goes to the process owning selector, which gets SOCKET_HANDOFF_BIT for it.
+   Buffers this process has taken off the rx ring and not read go along, ahead of the rest */
+int ipaugenblick_handoff(int sock,int selector)
+{
+    local_socket_descriptor_t *descriptor = &local_socket_descriptors[sock];
+    ipaugenblick_socket_t *ipaugenblick_socket = descriptor->socket;
+    struct rte_mbuf *pending = NULL,*last = NULL,*mbuf;
+    ipaugenblick_cmd_t *cmd;
+    uint32_t pkt_len = 0;
+    uint8_t nb_segs = 0;
+
+    if((!descriptor->socket)||(selector < 0)||(selector >= IPAUGENBLICK_SELECTOR_POOL_SIZE)||
+       (!rte_atomic32_read(&shared_rx_state[selector].owner_pid)))
+        return -1;
+    cmd = ipaugenblick_get_command_slot();
+    if(!cmd) {
+        ipaugenblick_stats_cannot_allocate_cmd++;
+        return -2;
+    }
+    if(descriptor->read_pending) {
+        pending = descriptor->read_pending;
+        pending->pkt.data = (char *)pending->pkt.data + descriptor->read_pending_offset;
+        pending->pkt.data_len -= descriptor->read_pending_offset;
+        descriptor->read_pending = NULL;
+    }
+    /* stream semantics, one chain keeps the order */
+    while(!rte_ring_sc_dequeue(descriptor->local_cache,(void **)&mbuf)) {
+        if(!pending) {
+            pending = mbuf;
+            continue;
+        }
+        for(last = pending;last->pkt.next;last = last->pkt.next);
+        last->pkt.next = mbuf;
+    }
+    for(mbuf = pending;mbuf;mbuf = mbuf->pkt.next) {
+        pkt_len += mbuf->pkt.data_len;
+        nb_segs++;
+    }
+    if(pending) {
+        pending->pkt.pkt_len = pkt_len;
+        pending->pkt.nb_segs = nb_segs;
+    }
+    ipaugenblick_socket->handoff_rx = pending;
+    cmd->cmd = IPAUGENBLICK_SOCKET_HANDOFF_COMMAND;
+    cmd->ringset_idx = sock;
+    cmd->u.socket_handoff.socket_select = selector;
+    ipaugenblick_socket->handoff_status = 0;
+    ipaugenblick_post_command();
+    descriptor->socket = NULL;
+    descriptor->select = -1;
+    descriptor->handed_off = 1;
+    return 0;
+}
+
+/* takes over a connection select() returned with SOCKET_HANDOFF_BIT.
+   The service charges this app's tx budget with what is outstanding on it */
+int ipaugenblick_adopt(int sock,int selector)
+{
+    local_socket_descriptor_t *descriptor = &local_socket_descriptors[sock];
+    ipaugenblick_socket_t *ipaugenblick_socket = &ipaugenblick_sockets_base[sock];
+    struct rte_mbuf *mbuf;
+    ipaugenblick_cmd_t *cmd;
+
+    /* this process' own handoff the service refused, the connection stays here */
+    if((descriptor->handed_off)&&(ipaugenblick_socket->handoff_status)) {
+        ipaugenblick_socket->handoff_status = 0;
+        if(ipaugenblick_socket->handoff_rx) {
+            rte_ring_sp_enqueue(descriptor->local_cache,ipaugenblick_socket->handoff_rx);
+            ipaugenblick_socket->handoff_rx = NULL;
+        }
+        descriptor->socket = ipaugenblick_socket;
+        descriptor->select = selector;
+        descriptor->handed_off = 0;
+        return 0;
+    }
+    /* the previous owner's outstanding tx buffers come along, they must fit this app's budget */
+    if(rte_atomic32_read(&ipaugenblick_app_cmd_ring->tx_inflight) + rte_atomic32_read(&ipaugenblick_socket->tx_inflight) >
+       IPAUGENBLICK_APP_TX_CREDITS)
+        return -3;
+    if(ipaugenblick_bind_local_rings(sock,ipaugenblick_socket->numa_socket))
+        return -1;
+    /* where the previous owner was, a swap it didn't finish goes on from there */
+    if((ipaugenblick_switch_local_ring(sock,0,rte_atomic32_read(&ipaugenblick_socket->tx_ring_ack)))||
+       (ipaugenblick_switch_local_ring(sock,1,rte_atomic32_read(&ipaugenblick_socket->rx_ring_ack))))
+        return -1;
+    cmd = ipaugenblick_get_command_slot();
+    if(!cmd) {
+        ipaugenblick_stats_cannot_allocate_cmd++;
+        return -2;
+    }
+    /* left by an earlier connection on this index */
+    while(!rte_ring_sc_dequeue(descriptor->local_cache,(void **)&mbuf))
+        rte_pktmbuf_free(mbuf);
+    if(ipaugenblick_socket->handoff_rx) {
+        rte_ring_sp_enqueue(descriptor->local_cache,ipaugenblick_socket->handoff_rx);
+        ipaugenblick_socket->handoff_rx = NULL;
     }
+    descriptor->read_pending = NULL;
+    descriptor->socket = ipaugenblick_socket;
+    descriptor->select = selector;
+    descriptor->handed_off = 0;
+    descriptor->tx_blocked = 0;
+    cmd->cmd = IPAUGENBLICK_SOCKET_ADOPT_COMMAND;
+    cmd->ringset_idx = sock;
+    cmd->u.socket_adopt.socket_select = selector;
+    ipaugenblick_post_command();
+    return 0;
 }
 
+/* once per writable report, the service keeps the socket until it has buffers and credits again */
 static inline void ipaugenblick_notify_empty_tx_buffers(int sock)
 {
     ipaugenblick_cmd_t *cmd;
-    cmd = ipaugenblick_get_free_command_buf();
+    if((local_socket_descriptors[sock].tx_blocked)&&
+       (!rte_atomic16_read(&local_socket_descriptors[sock].socket->write_ready_to_app)))
+        return;
+    rte_atomic16_set(&local_socket_descriptors[sock].socket->write_ready_to_app,0);
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return;
     }
     cmd->cmd = IPAUGENBLICK_SOCKET_TX_POOL_EMPTY_COMMAND;
     cmd->ringset_idx = sock;
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-    }
+    ipaugenblick_post_command();
+    local_socket_descriptors[sock].tx_blocked = 1;
 }
 
 int ipaugenblick_get_socket_tx_space(int sock)
 {
-    int ring_space = ipaugenblick_socket_tx_space(sock);
-    int free_bufs_count = rte_mempool_count(tx_bufs_pool);
-    int rc = (ring_space > free_bufs_count) ? (free_bufs_count > 0 ? free_bufs_count : 0)  : ring_space;
-    if(!rc) {
-	rte_atomic16_set(&(local_socket_descriptors[sock & SOCKET_READY_MASK].socket->write_ready_to_app),0);
+    ipaugenblick_socket_t *ipaugenblick_socket = local_socket_descriptors[sock].socket;
+    int rc = ipaugenblick_socket_tx_space(sock);
+    int credits = rte_atomic32_read(&ipaugenblick_socket->tx_window) - rte_atomic32_read(&ipaugenblick_socket->tx_inflight);
+    int budget = IPAUGENBLICK_APP_TX_CREDITS - rte_atomic32_read(&ipaugenblick_app_cmd_ring->tx_inflight);
+
+    if(credits < rc)
+        rc = credits;
+    if(budget < rc)
+        rc = budget;
+    if(rc <= 0) {
         ipaugenblick_notify_empty_tx_buffers(sock);
+        return 0;
     }
+    local_socket_descriptors[sock].tx_blocked = 0;
     return rc;
 }
 
@@ -460,6 +817,50 @@ inline int ipaugenblick_sendto_bulk(int sock,void **buffers,int *offsets,int *le
     return rc;
 }
 
+int ipaugenblick_set_watermarks(int sock,int rx_lowat,int rx_hiwat,int tx_lowat,unsigned long rx_max_delay_us)
+{
+    ipaugenblick_cmd_t *cmd;
+    cmd = ipaugenblick_get_command_slot();
+    if(!cmd) {
+        ipaugenblick_stats_cannot_allocate_cmd++;
+        return -1;
+    }
+    cmd->cmd = IPAUGENBLICK_SOCKET_SET_WATERMARKS_COMMAND;
+    cmd->ringset_idx = sock;
+    cmd->u.socket_watermarks.rx_lowat = rx_lowat;
+    cmd->u.socket_watermarks.rx_hiwat = rx_hiwat;
+    cmd->u.socket_watermarks.tx_lowat = tx_lowat;
+    cmd->u.socket_watermarks.rx_max_delay_us = rx_max_delay_us;
+    ipaugenblick_post_command();
+    return 0;
+}
+
+int ipaugenblick_sendfile(int sock,int fd,unsigned long offset,unsigned long length)
+{
+    ipaugenblick_cmd_t *cmd;
+    cmd = ipaugenblick_get_command_slot();
+    if(!cmd) {
+        ipaugenblick_stats_cannot_allocate_cmd++;
+        return -1;
+    }
+    cmd->cmd = IPAUGENBLICK_SOCKET_SENDFILE_COMMAND;
+    cmd->ringset_idx = sock;
+    cmd->u.socket_sendfile.fd = fd;
+    cmd->u.socket_sendfile.offset = offset;
+    cmd->u.socket_sendfile.length = length;
+    ipaugenblick_post_command();
+    return 0;
+}
+
+int ipaugenblick_sendfile_result(int sock,unsigned long *bytes)
+{
+    ipaugenblick_socket_t *ipaugenblick_socket = local_socket_descriptors[sock].socket;
+
+    rte_rmb();
+    *bytes = ipaugenblick_socket->sendfile_bytes;
+    return ipaugenblick_socket->sendfile_status;
+}
+
 /* TCP */
 inline int ipaugenblick_receive(int sock,void **pbuffer,int *len,int *nb_segs)
 {
@@ -476,6 +877,83 @@ inline int ipaugenblick_receive(int sock,void **pbuffer,int *len,int *nb_segs)
     return 0;
 }
 
+/* copies with 16-byte streaming stores, the caller issues sfence */
+static inline void ipaugenblick_copy_nt(uint8_t *dst,const uint8_t *src,int len)
+{
+    int head = (16 - ((unsigned long)dst & 15)) & 15;
+
+    if(head > len)
+        head = len;
+    rte_memcpy(dst,src,head);
+    dst += head;
+    src += head;
+    len -= head;
+    for(;len >= 64;len -= 64,dst += 64,src += 64) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)src);
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i x2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i x3 = _mm_loadu_si128((const __m128i *)(src + 48));
+        _mm_stream_si128((__m128i *)dst,x0);
+        _mm_stream_si128((__m128i *)(dst + 16),x1);
+        _mm_stream_si128((__m128i *)(dst + 32),x2);
+        _mm_stream_si128((__m128i *)(dst + 48),x3);
+    }
+    rte_memcpy(dst,src,len);
+}
+
+/* TCP. Walks the received chains segment by segment.
+   A segment consumed partially stays in the descriptor with its offset,
+   fully consumed segments are returned to the pool in bulk */
+int ipaugenblick_read(int sock,void *dst,int len)
+{
+    local_socket_descriptor_t *descriptor = &local_socket_descriptors[sock];
+    struct rte_mbuf *mbuf;
+    void *to_free[MAX_PKT_BURST];
+    int copied = 0,chunk,freed = 0;
+    int use_nt = (IPAUGENBLICK_READ_NT_THRESHOLD > 0)&&(len >= IPAUGENBLICK_READ_NT_THRESHOLD);
+
+    ipaugenblick_stats_read_called++;
+    while(copied < len) {
+        if(!descriptor->read_pending) {
+            descriptor->read_pending = ipaugenblick_dequeue_rx_buf(sock);
+            if(!descriptor->read_pending)
+                break;
+            descriptor->read_pending_offset = 0;
+        }
+        mbuf = descriptor->read_pending;
+        if(mbuf->pkt.next)
+            rte_prefetch0(mbuf->pkt.next->pkt.data);
+        chunk = mbuf->pkt.data_len - descriptor->read_pending_offset;
+        if(chunk > len - copied)
+            chunk = len - copied;
+        if(use_nt)
+            ipaugenblick_copy_nt((uint8_t *)dst + copied,(uint8_t *)mbuf->pkt.data + descriptor->read_pending_offset,chunk);
+        else
+            rte_memcpy((uint8_t *)dst + copied,(uint8_t *)mbuf->pkt.data + descriptor->read_pending_offset,chunk);
+        copied += chunk;
+        descriptor->read_pending_offset += chunk;
+        if(descriptor->read_pending_offset < mbuf->pkt.data_len)
+            break; /* dst is full */
+        descriptor->read_pending = mbuf->pkt.next;
+        descriptor->read_pending_offset = 0;
+        mbuf->pkt.next = NULL;
+        if(likely(__rte_pktmbuf_prefree_seg(mbuf) != NULL)) {
+            /* a chain may mix rx and stack pool buffers, a batch goes back to one pool */
+            if((freed == MAX_PKT_BURST)||((freed > 0)&&(((struct rte_mbuf *)to_free[0])->pool != mbuf->pool))) {
+                rte_mempool_put_bulk(((struct rte_mbuf *)to_free[0])->pool,to_free,freed);
+                freed = 0;
+            }
+            to_free[freed++] = mbuf;
+        }
+    }
+    if(freed > 0)
+        rte_mempool_put_bulk(((struct rte_mbuf *)to_free[0])->pool,to_free,freed);
+    if(use_nt)
+        _mm_sfence();
+    ipaugenblick_stats_bytes_read += copied;
+    return copied;
+}
+
 /* UDP or RAW */
 inline int ipaugenblick_receivefrom(int sock,void **buffer,int *len,int *nb_segs,unsigned int *ipaddr,unsigned short *port)
 {
@@ -497,16 +975,109 @@ inline int ipaugenblick_receivefrom(int sock,void **buffer,int *len,int *nb_segs
     return 0;
 }
 
+static inline uint64_t ipaugenblick_tsc_to_ns(uint64_t tsc)
+{
+    return (tsc / ipaugenblick_tsc_hz) * 1000000000ULL + ((tsc % ipaugenblick_tsc_hz) * 1000000000ULL) / ipaugenblick_tsc_hz;
+}
+
+uint64_t ipaugenblick_get_rx_timestamp_ns(void *buffer)
+{
+    struct rte_mbuf *mbuf = RTE_MBUF(buffer);
+    return ipaugenblick_tsc_to_ns(IPAUGENBLICK_MBUF_RX_TSC(mbuf));
+}
+
+uint64_t ipaugenblick_get_time_ns(void)
+{
+    return ipaugenblick_tsc_to_ns(rte_rdtsc());
+}
+
+void ipaugenblick_set_tx_tag(void *buffer,uint64_t tag)
+{
+    struct rte_mbuf *mbuf = RTE_MBUF(buffer);
+    IPAUGENBLICK_MBUF_TX_TAG(mbuf) = tag;
+}
+
+int ipaugenblick_get_tx_timestamp(int sock,uint64_t *tag,int *type,uint64_t *ns)
+{
+    ipaugenblick_cmd_t *cmd;
+
+    if(rte_ring_sc_dequeue(local_socket_descriptors[sock].errq_ring,(void **)&cmd)) {
+        return -1;
+    }
+    *tag = cmd->u.tx_timestamp.tag;
+    *type = cmd->u.tx_timestamp.type;
+    *ns = ipaugenblick_tsc_to_ns(cmd->u.tx_timestamp.tsc);
+    ipaugenblick_free_command_buf(cmd);
+    return 0;
+}
+
+unsigned int ipaugenblick_get_tx_timestamp_dropped(int sock)
+{
+    return local_socket_descriptors[sock].socket->tx_tstamp_dropped;
+}
+
+int ipaugenblick_get_nic_stats(int port,struct ipaugenblick_nic_stats *stats)
+{
+    dpdk_dev_nic_stats_t *nic_stats,sample;
+    uint32_t seq;
+    int q;
+
+    if((port < 0)||(port >= RTE_MAX_ETHPORTS)||(!nic_stats_base))
+        return -1;
+    nic_stats = &nic_stats_base[port];
+    do {
+        seq = nic_stats->seq;
+        rte_rmb();
+        sample = *nic_stats;
+        rte_rmb();
+    }while((seq & 1)||(seq != nic_stats->seq));
+    if(!sample.tsc)
+        return -1;
+    stats->ns = ipaugenblick_tsc_to_ns(sample.tsc);
+    stats->rx_packets = sample.rx_packets;
+    stats->tx_packets = sample.tx_packets;
+    stats->rx_bytes = sample.rx_bytes;
+    stats->tx_bytes = sample.tx_bytes;
+    stats->rx_errors = sample.rx_errors;
+    stats->tx_errors = sample.tx_errors;
+    stats->rx_multicast = sample.rx_multicast;
+    stats->rx_missed = sample.rx_missed;
+    stats->rx_nombuf = sample.rx_nombuf;
+    stats->stack_rx_packets = sample.stack_rx_packets;
+    stats->stack_tx_dropped = sample.stack_tx_dropped;
+    stats->rx_packets_rate = sample.rx_packets_rate;
+    stats->tx_packets_rate = sample.tx_packets_rate;
+    stats->rx_bytes_rate = sample.rx_bytes_rate;
+    stats->tx_bytes_rate = sample.tx_bytes_rate;
+    stats->rx_missed_rate = sample.rx_missed_rate;
+    stats->rx_nombuf_rate = sample.rx_nombuf_rate;
+    for(q = 0;q < IPAUGENBLICK_NIC_STATS_QUEUES;q++) {
+        stats->q_rx_packets[q] = sample.q_rx_packets[q];
+        stats->q_tx_packets[q] = sample.q_tx_packets[q];
+        stats->q_rx_bytes[q] = sample.q_rx_bytes[q];
+        stats->q_tx_bytes[q] = sample.q_tx_bytes[q];
+        stats->q_rx_missed[q] = sample.q_rx_missed[q];
+    }
+    return 0;
+}
+
 /* Allocate buffer to use later in *send* APIs */
 inline void *ipaugenblick_get_buffer(int length,int owner_sock)
 {
     struct rte_mbuf *mbuf;
+    if(ipaugenblick_take_tx_credits(owner_sock,1)) {
+        ipaugenblick_notify_empty_tx_buffers(owner_sock);
+        return NULL;
+    }
     mbuf = rte_pktmbuf_alloc(tx_bufs_pool);
     if(!mbuf) {
+        ipaugenblick_give_back_tx_credits(owner_sock,1);
         ipaugenblick_notify_empty_tx_buffers(owner_sock);
         ipaugenblick_stats_tx_buf_allocation_failure++; 
         return NULL;
     }
+    IPAUGENBLICK_TX_BUF_OWNER(mbuf) = owner_sock;
+    IPAUGENBLICK_MBUF_TX_TAG(mbuf) = 0;
     ipaugenblick_stats_buffers_allocated++;
     return &(mbuf->pkt.data);
 }
@@ -515,7 +1086,12 @@ int ipaugenblick_get_buffers_bulk(int length,int owner_sock,int count,void **buf
 {
     struct rte_mbuf *mbufs[count];
     int idx;
+    if(ipaugenblick_take_tx_credits(owner_sock,count)) {
+        ipaugenblick_notify_empty_tx_buffers(owner_sock);
+        return 1;
+    }
     if(rte_mempool_get_bulk(tx_bufs_pool,mbufs,count)) {
+        ipaugenblick_give_back_tx_credits(owner_sock,count);
         ipaugenblick_notify_empty_tx_buffers(owner_sock); 
         ipaugenblick_stats_tx_buf_allocation_failure++; 
         return 1;
@@ -523,6 +1099,8 @@ int ipaugenblick_get_buffers_bulk(int length,int owner_sock,int count,void **buf
     for(idx = 0;idx < count;idx++) {
         rte_pktmbuf_reset(mbufs[idx]);
         rte_pktmbuf_refcnt_update(mbufs[idx],1);
+        IPAUGENBLICK_TX_BUF_OWNER(mbufs[idx]) = owner_sock;
+        IPAUGENBLICK_MBUF_TX_TAG(mbufs[idx]) = 0;
         bufs[idx] = &(mbufs[idx]->pkt.data);
     } 
     ipaugenblick_stats_buffers_allocated += count;
@@ -533,6 +1111,11 @@ int ipaugenblick_get_buffers_bulk(int length,int owner_sock,int count,void **buf
 void ipaugenblick_release_tx_buffer(void *buffer)
 {
     struct rte_mbuf *mbuf = RTE_MBUF(buffer);
+    int owner_sock = IPAUGENBLICK_TX_BUF_OWNER(mbuf);
+
+    /* never sent, give the credit back */
+    if((owner_sock < IPAUGENBLICK_CONNECTION_POOL_SIZE)&&(local_socket_descriptors[owner_sock].socket))
+        ipaugenblick_give_back_tx_credits(owner_sock,1);
 
     rte_pktmbuf_free_seg(mbuf);
 }
@@ -540,12 +1123,14 @@ void ipaugenblick_release_tx_buffer(void *buffer)
 inline void ipaugenblick_release_rx_buffer(void *buffer)
 {
     struct rte_mbuf *mbuf = RTE_MBUF(buffer); 
-#if 1 /* this will work if only all mbufs are guaranteed from the same mempool */
+#if 1 /* batches are split where the chain moves to another mempool */
     struct rte_mbuf *next;
     void *mbufs[MAX_PKT_BURST];
     int count;
     while(mbuf) {
         for(count = 0;(count < MAX_PKT_BURST)&&(mbuf);) {
+            if((count > 0)&&(((struct rte_mbuf *)mbufs[0])->pool != mbuf->pool))
+                break;
             next = mbuf->pkt.next;
             if(likely(__rte_pktmbuf_prefree_seg(mbuf))) {
                 mbufs[count++] = mbuf; 
@@ -567,49 +1152,54 @@ int ipaugenblick_socket_kick(int sock)
     if(!rte_atomic16_test_and_set(&(local_socket_descriptors[sock].socket->write_done_from_app)) > 0) {
         return 0;
     }
-    cmd = ipaugenblick_get_free_command_buf();
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return -1;
     }
     cmd->cmd = IPAUGENBLICK_SOCKET_TX_KICK_COMMAND;
     cmd->ringset_idx = sock;
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-    }
-    else
-        ipaugenblick_stats_tx_kicks_sent++;
+    ipaugenblick_post_command();
+    ipaugenblick_stats_tx_kicks_sent++;
     return 0;
 }
 
 int ipaugenblick_accept(int sock)
 {
-    ipaugenblick_cmd_t *cmd;
+    ipaugenblick_cmd_t *cmd,*accepted_cmd;
     ipaugenblick_socket_t *ipaugenblick_socket;
     unsigned long accepted_socket;
 
     rte_atomic16_set(&(local_socket_descriptors[sock].socket->read_ready_to_app),0);
-    if(rte_ring_dequeue(local_socket_descriptors[sock].rx_ring,(void **)&cmd)) {
+    /* taken first, so a dequeued connection is never dropped for want of a slot */
+    cmd = ipaugenblick_get_command_slot();
+    if(!cmd) {
+        ipaugenblick_stats_cannot_allocate_cmd++;
+        return -1;
+    }
+    if(rte_ring_dequeue(local_socket_descriptors[sock].rx_ring,(void **)&accepted_cmd)) {
         return -1;
     }
+    accepted_socket = accepted_cmd->u.accepted_socket.socket_descr;
+    ipaugenblick_free_command_buf(accepted_cmd);
     
     if(rte_ring_dequeue(free_connections_ring,(void **)&ipaugenblick_socket)) {
-        ipaugenblick_free_command_buf(cmd);
 	printf("NO FREE CONNECTIONS\n");
         return -1;
     } 
-    accepted_socket = cmd->u.accepted_socket.socket_descr;
+    if(ipaugenblick_bind_local_rings(ipaugenblick_socket->connection_idx,ipaugenblick_app_numa_socket)) {
+        rte_ring_enqueue(free_connections_ring,ipaugenblick_socket);
+        return -1;
+    }
 printf("%s %d %p %d %d\n",__FILE__,__LINE__,accepted_socket,sock,ipaugenblick_socket->connection_idx);
     local_socket_descriptors[ipaugenblick_socket->connection_idx].socket = ipaugenblick_socket;
+    ipaugenblick_init_tx_credits(ipaugenblick_socket->connection_idx);
     cmd->cmd = IPAUGENBLICK_SET_SOCKET_RING_COMMAND;
+    cmd->numa_socket = ipaugenblick_app_numa_socket;
     cmd->ringset_idx = ipaugenblick_socket->connection_idx;
     cmd->parent_idx = 0;
     cmd->u.set_socket_ring.socket_descr = accepted_socket;
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-        printf("CANNOT ENQUEUE SET_RING_COMMAND\n");
-        return -2;
-    }
+    ipaugenblick_post_command();
     return ipaugenblick_socket->connection_idx;
 }
 
@@ -632,7 +1222,7 @@ restart_waiting:
             for(i = 0;i < timeout;i++) rte_pause();
         }
         else if(timeout == 0) {
-            return;
+            return -1;
         }
         else 
             usleep(1);
@@ -648,10 +1238,128 @@ restart_waiting:
     return ringset_idx_and_ready_mask & SOCKET_READY_MASK;
 }
 
+/* spins when the deadline is this close, sleeps otherwise */
+#define IPAUGENBLICK_SELECT_SPIN_MICROS 50
+
+int ipaugenblick_select_wait(int selector,uint64_t micros)
+{
+    uint64_t now = rte_rdtsc(),deadline = ~0ULL;
+    uint64_t spin_cycles = (IPAUGENBLICK_SELECT_SPIN_MICROS*ipaugenblick_tsc_hz)/1000000;
+
+    if(micros != IPAUGENBLICK_SELECT_WAIT_FOREVER)
+        deadline = now + (micros*ipaugenblick_tsc_hz)/1000000;
+    while(rte_ring_empty(selectors[selector].ready_connections)) {
+        if(now >= deadline)
+            return 0;
+        if(deadline - now <= spin_cycles)
+            rte_pause();
+        else
+            usleep(1);
+        now = rte_rdtsc();
+    }
+    return 1;
+}
+
+/* non-blocking, retrieves up to max_count ready sockets at once.
+   The same socket may be returned more than once */
+int ipaugenblick_select_bulk(int selector,int *socks,unsigned short *masks,int max_count)
+{
+    void *ready[MAX_PKT_BURST];
+    uint32_t ringset_idx_and_ready_mask;
+    int dequeued,i;
+
+    ipaugenblick_stats_select_called++;
+    if(max_count > MAX_PKT_BURST)
+        max_count = MAX_PKT_BURST;
+    dequeued = rte_ring_sc_dequeue_burst(selectors[selector].ready_connections,ready,max_count);
+    for(i = 0;i < dequeued;i++) {
+        ringset_idx_and_ready_mask = (uint32_t)(unsigned long)ready[i];
+        masks[i] = ringset_idx_and_ready_mask >> SOCKET_READY_SHIFT;
+        socks[i] = ringset_idx_and_ready_mask & SOCKET_READY_MASK;
+        if(socks[i] >= IPAUGENBLICK_CONNECTION_POOL_SIZE) {
+            printf("FATAL ERROR %s %d %d\n",__FILE__,__LINE__,socks[i]);
+            exit(0);
+        }
+    }
+    ipaugenblick_stats_select_returned += (dequeued > 0);
+    return dequeued;
+}
+
+/* appended to the chain the new owner takes at adopt, the service tells it once none is left */
+static inline void ipaugenblick_handoff_shared_rx(int sock,struct rte_mbuf *mbuf)
+{
+    ipaugenblick_socket_t *ipaugenblick_socket = &ipaugenblick_sockets_base[sock];
+    struct rte_mbuf *head = (struct rte_mbuf *)ipaugenblick_socket->handoff_rx,*last;
+
+    if(!head) {
+        ipaugenblick_socket->handoff_rx = mbuf;
+    }
+    else {
+        for(last = head;last->pkt.next;last = last->pkt.next);
+        last->pkt.next = mbuf;
+        head->pkt.pkt_len += mbuf->pkt.pkt_len;
+        head->pkt.nb_segs += mbuf->pkt.nb_segs;
+    }
+    rte_wmb();
+    rte_atomic32_dec(&ipaugenblick_socket->shared_rx_queued);
+    ipaugenblick_stats_handoff_shared_rx++;
+}
+
+/* Buffers of sockets attached with ipaugenblick_set_socket_select_shared_rx.
+   Once the ring is found empty the service notifies again on the next buffer */
+int ipaugenblick_receive_shared(int selector,int *socks,void **buffers,int *lens,int *nb_segs,int max_count)
+{
+    struct rte_mbuf *mbufs[MAX_PKT_BURST];
+    int dequeued,i,sock,count = 0;
+    uint32_t tag;
+
+    ipaugenblick_stats_receive_called++;
+    if(max_count > MAX_PKT_BURST)
+        max_count = MAX_PKT_BURST;
+    /* 0 only once the ring is empty, the app stops reading then */
+    do {
+        dequeued = rte_ring_sc_dequeue_burst(selectors[selector].shared_rx,(void **)mbufs,max_count);
+        if(!dequeued) {
+            rte_atomic16_set(&shared_rx_state[selector].rx_ready_to_app,0);
+            /* the service may have enqueued before seeing the flag cleared */
+            dequeued = rte_ring_sc_dequeue_burst(selectors[selector].shared_rx,(void **)mbufs,max_count);
+            if(!dequeued) {
+                ipaugenblick_stats_recv_failure++;
+                return 0;
+            }
+        }
+        for(i = 0;i < dequeued;i++) {
+            tag = IPAUGENBLICK_MBUF_RX_SOCK(mbufs[i]);
+            sock = IPAUGENBLICK_SHARED_RX_TAG_SOCK(tag);
+            /* came in before the handoff, the new owner reads it after what it was handed */
+            if((!local_socket_descriptors[sock].socket)&&(local_socket_descriptors[sock].handed_off)&&
+               (IPAUGENBLICK_SHARED_RX_TAG_GEN(tag) == ipaugenblick_sockets_base[sock].shared_rx_gen)) {
+                ipaugenblick_handoff_shared_rx(sock,mbufs[i]);
+                continue;
+            }
+            /* of a connection closed since, maybe with its index reused */
+            if((!local_socket_descriptors[sock].socket)||
+               (IPAUGENBLICK_SHARED_RX_TAG_GEN(tag) != local_socket_descriptors[sock].socket->shared_rx_gen)) {
+                rte_pktmbuf_free(mbufs[i]);
+                ipaugenblick_stats_shared_rx_stale++;
+                continue;
+            }
+            rte_atomic32_dec(&local_socket_descriptors[sock].socket->shared_rx_queued);
+            socks[count] = sock;
+            buffers[count] = &(mbufs[i]->pkt.data);
+            lens[count] = mbufs[i]->pkt.pkt_len;
+            nb_segs[count] = mbufs[i]->pkt.nb_segs;
+            count++;
+        }
+    }while(!count);
+    ipaugenblick_stats_rx_dequeued += count;
+    return count;
+}
+
 int ipaugenblick_socket_connect(int sock,unsigned int ipaddr,unsigned short port)
 {
     ipaugenblick_cmd_t *cmd;
-    cmd = ipaugenblick_get_free_command_buf();
+    cmd = ipaugenblick_get_command_slot();
     if(!cmd) {
         ipaugenblick_stats_cannot_allocate_cmd++;
         return -1;
@@ -660,10 +1368,7 @@ int ipaugenblick_socket_connect(int sock,unsigned int ipaddr,unsigned short port
     cmd->u.socket_connect.ipaddr = ipaddr;
     cmd->u.socket_connect.port = port;
     cmd->ringset_idx = sock;
-    if(ipaugenblick_enqueue_command_buf(cmd)) {
-        ipaugenblick_free_command_buf(cmd);
-        return -2;
-    }
+    ipaugenblick_post_command();
     return 0;
 }
 /* receive functions return a chained buffer. this function
@@ -2,6 +2,8 @@
 #ifndef __IPAUGENBLICK_API_H__
 #define __IPAUGENBLICK_API_H__
 
+#include <stdint.h>
+
 #define IPAUGENBLICK_MAX_SOCKETS 1000
 
 /* must be called per process */
@@ -25,18 +27,92 @@ int ipaugenblick_get_socket_tx_space(int sock);
 /* TCP or connected UDP */
 int ipaugenblick_send(int sock,void *buffer,int offset,int length);
 
-inline int ipaugenblick_send_bulk(int sock,void **buffers,int *offsets,int *lengths,int buffer_count);
+int ipaugenblick_send_bulk(int sock,void **buffers,int *offsets,int *lengths,int buffer_count);
 
 /* UDP or RAW */
 int ipaugenblick_sendto(int sock,void *buffer,int offset,int length,unsigned int ipaddr,unsigned short port);
-inline int ipaugenblick_sendto_bulk(int sock,void **buffers,int *offsets,int *lengths,unsigned int *ipaddrs,unsigned short *ports,int buffer_count);
+int ipaugenblick_sendto_bulk(int sock,void **buffers,int *offsets,int *lengths,unsigned int *ipaddrs,unsigned short *ports,int buffer_count);
+
+/* Readable is reported once rx_lowat buffers are queued or the oldest queued buffer
+   waited rx_max_delay_us (0 - no limit). Once rx_hiwat buffers are queued the service
+   stops reading the connection until the app drained them below rx_lowat (0 - no high mark,
+   not applied to a shared rx ring). Writable is reported once tx_lowat buffers can be enqueued.
+   The marks are capped to what the socket's rings and window hold. Defaults are 1,0,1,0 */
+int ipaugenblick_set_watermarks(int sock,int rx_lowat,int rx_hiwat,int tx_lowat,unsigned long rx_max_delay_us);
+
+/* TCP. The service streams length bytes of the file starting at offset.
+   Completion is reported by the selector with SOCKET_SENDFILE_DONE_BIT (0x4) in the mask.
+   Don't send on the socket until then */
+int ipaugenblick_sendfile(int sock,int fd,unsigned long offset,unsigned long length);
+
+/* after SOCKET_SENDFILE_DONE_BIT: returns 0 or -errno, bytes is what was handed to TCP.
+   Fewer bytes than asked with 0 means the file ended first */
+int ipaugenblick_sendfile_result(int sock,unsigned long *bytes);
 
 /* TCP */
 int ipaugenblick_receive(int sock,void **pbuffer,int *len,int *nb_segs);
 
+/* TCP, stream semantics: copies up to len bytes into dst.
+   Returns number of bytes copied (0 if nothing to read).
+   Don't mix with ipaugenblick_receive on the same socket */
+int ipaugenblick_read(int sock,void *dst,int len);
+
 /* UDP or RAW */
 int ipaugenblick_receivefrom(int sock,void **buffer,int *len,int *nb_segs,unsigned int *ipaddr,unsigned short *port);
 
+/* when the first segment of a received buffer hit the NIC, in nanoseconds
+   on the same clock as ipaugenblick_get_time_ns() */
+uint64_t ipaugenblick_get_rx_timestamp_ns(void *buffer);
+
+uint64_t ipaugenblick_get_time_ns(void);
+
+/* Asks for tx timestamp reports on a buffer before it is sent, tag must be non-zero.
+   Reports (IPAUGENBLICK_TX_TSTAMP_SCHED/SENT/ACKED) are queued per socket,
+   the selector reports SOCKET_TX_TIMESTAMP_BIT (0x8) once the queue is non-empty */
+void ipaugenblick_set_tx_tag(void *buffer,uint64_t tag);
+
+/* returns 0 and one report, -1 if none */
+int ipaugenblick_get_tx_timestamp(int sock,uint64_t *tag,int *type,uint64_t *ns);
+
+/* reports lost since the socket was opened: the service's queue of tagged buffers
+   in flight (32) or the socket's report ring was full */
+unsigned int ipaugenblick_get_tx_timestamp_dropped(int sock);
+
+#define IPAUGENBLICK_NIC_STATS_QUEUES 16
+/* NIC counters of a port, sampled by the service about once a second, rates are per second.
+   rx_missed - dropped by the NIC on a full rx ring, the service did not poll in time.
+   rx_nombuf - dropped for lack of mbufs, buffers are held by the stack or apps.
+   stack_rx_packets - taken off the rx rings by the service, stack_tx_dropped - its tx overflow */
+struct ipaugenblick_nic_stats
+{
+    uint64_t ns; /* when sampled, on the ipaugenblick_get_time_ns() clock */
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_errors;
+    uint64_t tx_errors;
+    uint64_t rx_multicast;
+    uint64_t rx_missed;
+    uint64_t rx_nombuf;
+    uint64_t stack_rx_packets;
+    uint64_t stack_tx_dropped;
+    uint64_t rx_packets_rate;
+    uint64_t tx_packets_rate;
+    uint64_t rx_bytes_rate;
+    uint64_t tx_bytes_rate;
+    uint64_t rx_missed_rate;
+    uint64_t rx_nombuf_rate;
+    uint64_t q_rx_packets[IPAUGENBLICK_NIC_STATS_QUEUES];
+    uint64_t q_tx_packets[IPAUGENBLICK_NIC_STATS_QUEUES];
+    uint64_t q_rx_bytes[IPAUGENBLICK_NIC_STATS_QUEUES];
+    uint64_t q_tx_bytes[IPAUGENBLICK_NIC_STATS_QUEUES];
+    uint64_t q_rx_missed[IPAUGENBLICK_NIC_STATS_QUEUES];
+};
+
+/* returns 0 and the last sample of the port, -1 if the port was never sampled */
+int ipaugenblick_get_nic_stats(int port,struct ipaugenblick_nic_stats *stats);
+
 /* Allocate buffer to use later in *send* APIs */
 void *ipaugenblick_get_buffer(int length,int owner_sock);
 
@@ -51,12 +127,42 @@ int ipaugenblick_socket_kick(int sock);
 
 int ipaugenblick_accept(int sock);
 
+/* TCP. Passes the connection to the process owning selector, with whatever this process
+   has received and not read yet. The socket is not this process' any more on return,
+   ignore what the selector still reports for it. Don't hold buffers allocated for it.
+   If the service refuses (selector closed meanwhile), this process' selector reports sock
+   with SOCKET_HANDOFF_BIT and ipaugenblick_adopt takes it back */
+int ipaugenblick_handoff(int sock,int selector);
+
+/* call when select() on selector returns sock with SOCKET_HANDOFF_BIT (0x20),
+   before handling anything else reported for sock. Fails (-3) when the connection's
+   outstanding tx buffers don't fit this app's budget, close sock then */
+int ipaugenblick_adopt(int sock,int selector);
+
 int ipaugenblick_open_select(void);
 
 int ipaugenblick_set_socket_select(int sock,int select);
 
+/* as above, but the socket's received buffers go on the selector's shared ring
+   (the listener's accepted connections don't). The selector returns its own index
+   with SOCKET_SHARED_RX_BIT (0x10) once the ring is non-empty */
+int ipaugenblick_set_socket_select_shared_rx(int sock,int select);
+
+/* reads the selector's shared ring until it returns 0. Returns number of buffers, each one
+   with its socket, read as the ones ipaugenblick_receive/ipaugenblick_receivefrom return.
+   At most IPAUGENBLICK_SHARED_RX_SOCKET_CAP buffers of one socket are queued at a time */
+int ipaugenblick_receive_shared(int selector,int *socks,void **buffers,int *lens,int *nb_segs,int max_count);
+
 int ipaugenblick_select(int selector,unsigned short *mask,int timeout);
 
+/* waits until the selector has ready sockets or micros pass, nothing is dequeued.
+   Returns 1 if ready, 0 on timeout */
+#define IPAUGENBLICK_SELECT_WAIT_FOREVER (~0ULL)
+int ipaugenblick_select_wait(int selector,uint64_t micros);
+
+/* non-blocking, returns number of ready sockets (up to max_count) */
+int ipaugenblick_select_bulk(int selector,int *socks,unsigned short *masks,int max_count);
+
 int ipaugenblick_socket_connect(int sock,unsigned int ipaddr,unsigned short port);
 
 /* receive functions return a chained buffer. this function
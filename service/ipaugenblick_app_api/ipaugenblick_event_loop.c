@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_atomic.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+#include <rte_mbuf.h>
+#include "../ipaugenblick_common/ipaugenblick_common.h"
+#include "ipaugenblick_api.h"
+#include "ipaugenblick_event_loop.h"
+
+typedef struct
+{
+    ipaugenblick_event_cbk_t on_read;
+    ipaugenblick_event_cbk_t on_write;
+    ipaugenblick_event_cbk_t on_accept;
+    ipaugenblick_event_cbk_t on_close;
+    ipaugenblick_notify_cbk_t on_notify;
+    void *arg;
+    unsigned short pending_mask;
+    uint8_t registered;
+    uint8_t adopted; /* while in on_handoff, already attached to the selector */
+}ipaugenblick_event_loop_socket_t;
+
+typedef struct
+{
+    uint64_t expiry;
+    uint64_t period; /* 0 if one shot */
+    ipaugenblick_timer_cbk_t cbk;
+    void *arg;
+    int heap_idx; /* -1 if not armed */
+}ipaugenblick_event_loop_timer_t;
+
+struct ipaugenblick_event_loop
+{
+    int selector;
+    volatile int running;
+    uint64_t cycles_in_micro;
+    ipaugenblick_event_loop_socket_t sockets[IPAUGENBLICK_CONNECTION_POOL_SIZE];
+    int pending_socks[IPAUGENBLICK_CONNECTION_POOL_SIZE];
+    int pending_count;
+    ipaugenblick_shared_rx_cbk_t on_shared_rx;
+    void *shared_rx_arg;
+    int shared_rx_pending;
+    ipaugenblick_event_cbk_t on_handoff;
+    void *handoff_arg;
+    ipaugenblick_event_loop_timer_t timers[IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS];
+    int timer_heap[IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS];
+    int timer_heap_size;
+    int free_timers[IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS];
+    int free_timers_count;
+};
+
+uint64_t ipaugenblick_stats_event_loop_iterations = 0;
+uint64_t ipaugenblick_stats_event_loop_ready_dequeued = 0;
+uint64_t ipaugenblick_stats_event_loop_dispatched = 0;
+uint64_t ipaugenblick_stats_event_loop_timers_fired = 0;
+uint64_t ipaugenblick_stats_event_loop_adopted = 0;
+uint64_t ipaugenblick_stats_event_loop_adopt_failed = 0;
+
+static inline uint64_t timer_expiry(ipaugenblick_event_loop_t *loop,int heap_idx)
+{
+    return loop->timers[loop->timer_heap[heap_idx]].expiry;
+}
+
+static inline void timer_heap_swap(ipaugenblick_event_loop_t *loop,int i,int j)
+{
+    int tmp = loop->timer_heap[i];
+    loop->timer_heap[i] = loop->timer_heap[j];
+    loop->timer_heap[j] = tmp;
+    loop->timers[loop->timer_heap[i]].heap_idx = i;
+    loop->timers[loop->timer_heap[j]].heap_idx = j;
+}
+
+static void timer_heap_sift_up(ipaugenblick_event_loop_t *loop,int idx)
+{
+    while(idx > 0) {
+        int parent = (idx - 1) / 2;
+        if(timer_expiry(loop,parent) <= timer_expiry(loop,idx))
+            break;
+        timer_heap_swap(loop,idx,parent);
+        idx = parent;
+    }
+}
+
+static void timer_heap_sift_down(ipaugenblick_event_loop_t *loop,int idx)
+{
+    while(1) {
+        int smallest = idx;
+        int left = 2*idx + 1;
+        int right = left + 1;
+        if((left < loop->timer_heap_size)&&(timer_expiry(loop,left) < timer_expiry(loop,smallest)))
+            smallest = left;
+        if((right < loop->timer_heap_size)&&(timer_expiry(loop,right) < timer_expiry(loop,smallest)))
+            smallest = right;
+        if(smallest == idx)
+            break;
+        timer_heap_swap(loop,idx,smallest);
+        idx = smallest;
+    }
+}
+
+static void timer_heap_insert(ipaugenblick_event_loop_t *loop,int timer)
+{
+    int idx = loop->timer_heap_size++;
+    loop->timer_heap[idx] = timer;
+    loop->timers[timer].heap_idx = idx;
+    timer_heap_sift_up(loop,idx);
+}
+
+static void timer_heap_remove(ipaugenblick_event_loop_t *loop,int timer)
+{
+    int idx = loop->timers[timer].heap_idx;
+    int last = --loop->timer_heap_size;
+
+    loop->timers[timer].heap_idx = -1;
+    if(idx == last)
+        return;
+    loop->timer_heap[idx] = loop->timer_heap[last];
+    loop->timers[loop->timer_heap[idx]].heap_idx = idx;
+    timer_heap_sift_down(loop,idx);
+    timer_heap_sift_up(loop,idx);
+}
+
+ipaugenblick_event_loop_t *ipaugenblick_event_loop_create(void)
+{
+    ipaugenblick_event_loop_t *loop;
+    int i;
+
+    loop = calloc(1,sizeof(*loop));
+    if(!loop) {
+        printf("cannot allocate event loop %s %d\n",__FILE__,__LINE__);
+        return NULL;
+    }
+    loop->selector = ipaugenblick_open_select();
+    if(loop->selector == -1) {
+        printf("cannot open selector %s %d\n",__FILE__,__LINE__);
+        free(loop);
+        return NULL;
+    }
+    loop->cycles_in_micro = rte_get_tsc_hz()/1000000;
+    for(i = 0;i < IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS;i++) {
+        loop->timers[i].heap_idx = -1;
+        loop->free_timers[i] = IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS - 1 - i;
+    }
+    loop->free_timers_count = IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS;
+    return loop;
+}
+
+void ipaugenblick_event_loop_destroy(ipaugenblick_event_loop_t *loop)
+{
+    free(loop);
+}
+
+int ipaugenblick_event_loop_add_socket(ipaugenblick_event_loop_t *loop,int sock,
+                                       ipaugenblick_event_cbk_t on_read,
+                                       ipaugenblick_event_cbk_t on_write,
+                                       ipaugenblick_event_cbk_t on_accept,
+                                       ipaugenblick_event_cbk_t on_close,
+                                       void *arg)
+{
+    ipaugenblick_event_loop_socket_t *loop_sock;
+
+    if((sock < 0)||(sock >= IPAUGENBLICK_CONNECTION_POOL_SIZE))
+        return -1;
+    loop_sock = &loop->sockets[sock];
+    loop_sock->on_read = on_read;
+    loop_sock->on_write = on_write;
+    loop_sock->on_accept = on_accept;
+    loop_sock->on_close = on_close;
+    loop_sock->on_notify = NULL;
+    loop_sock->arg = arg;
+    loop_sock->registered = 1;
+    if(loop_sock->adopted)
+        return 0;
+    return ipaugenblick_set_socket_select(sock,loop->selector);
+}
+
+void ipaugenblick_event_loop_set_notify(ipaugenblick_event_loop_t *loop,int sock,ipaugenblick_notify_cbk_t on_notify)
+{
+    if((sock < 0)||(sock >= IPAUGENBLICK_CONNECTION_POOL_SIZE))
+        return;
+    loop->sockets[sock].on_notify = on_notify;
+}
+
+void ipaugenblick_event_loop_set_shared_rx(ipaugenblick_event_loop_t *loop,ipaugenblick_shared_rx_cbk_t on_shared_rx,void *arg)
+{
+    loop->on_shared_rx = on_shared_rx;
+    loop->shared_rx_arg = arg;
+}
+
+void ipaugenblick_event_loop_set_handoff(ipaugenblick_event_loop_t *loop,ipaugenblick_event_cbk_t on_handoff,void *arg)
+{
+    loop->on_handoff = on_handoff;
+    loop->handoff_arg = arg;
+}
+
+void ipaugenblick_event_loop_remove_socket(ipaugenblick_event_loop_t *loop,int sock)
+{
+    if((sock < 0)||(sock >= IPAUGENBLICK_CONNECTION_POOL_SIZE))
+        return;
+    /* if pending, it is skipped on dispatch */
+    loop->sockets[sock].registered = 0;
+}
+
+void ipaugenblick_event_loop_close_socket(ipaugenblick_event_loop_t *loop,int sock)
+{
+    ipaugenblick_event_loop_socket_t *loop_sock;
+
+    if((sock < 0)||(sock >= IPAUGENBLICK_CONNECTION_POOL_SIZE))
+        return;
+    loop_sock = &loop->sockets[sock];
+    if((loop_sock->registered)&&(loop_sock->on_close))
+        loop_sock->on_close(loop,sock,loop_sock->arg);
+    loop_sock->registered = 0;
+    ipaugenblick_close(sock);
+}
+
+int ipaugenblick_event_loop_add_timer(ipaugenblick_event_loop_t *loop,uint64_t micros,int periodic,
+                                      ipaugenblick_timer_cbk_t cbk,void *arg)
+{
+    int timer;
+    uint64_t cycles = micros*loop->cycles_in_micro;
+
+    if(loop->free_timers_count == 0)
+        return -1;
+    timer = loop->free_timers[--loop->free_timers_count];
+    loop->timers[timer].expiry = rte_rdtsc() + cycles;
+    loop->timers[timer].period = periodic ? cycles : 0;
+    loop->timers[timer].cbk = cbk;
+    loop->timers[timer].arg = arg;
+    timer_heap_insert(loop,timer);
+    return timer;
+}
+
+void ipaugenblick_event_loop_cancel_timer(ipaugenblick_event_loop_t *loop,int timer)
+{
+    if((timer < 0)||(timer >= IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS))
+        return;
+    if(loop->timers[timer].heap_idx == -1)
+        return;
+    timer_heap_remove(loop,timer);
+    loop->free_timers[loop->free_timers_count++] = timer;
+}
+
+/* fires timers expired by now. Re-armed periodic timers are not fired twice in one pass */
+static int ipaugenblick_event_loop_process_timers(ipaugenblick_event_loop_t *loop,uint64_t now)
+{
+    int timer,fired = 0;
+    ipaugenblick_event_loop_timer_t *t;
+
+    while((loop->timer_heap_size > 0)&&(timer_expiry(loop,0) <= now)) {
+        timer = loop->timer_heap[0];
+        t = &loop->timers[timer];
+        if(t->period) {
+            t->expiry += t->period;
+            if(t->expiry <= now) /* we are late, don't try to catch up */
+                t->expiry = now + t->period;
+            timer_heap_sift_down(loop,0);
+        }
+        else {
+            timer_heap_remove(loop,timer);
+            loop->free_timers[loop->free_timers_count++] = timer;
+        }
+        t->cbk(loop,timer,t->arg);
+        fired++;
+    }
+    ipaugenblick_stats_event_loop_timers_fired += fired;
+    return fired;
+}
+
+/* same socket may appear several times in one burst, masks are merged.
+   Shared rx readiness carries the selector's index, not a socket's */
+static void ipaugenblick_event_loop_collect_ready(ipaugenblick_event_loop_t *loop)
+{
+    int socks[MAX_PKT_BURST];
+    unsigned short masks[MAX_PKT_BURST];
+    int dequeued,i;
+
+    dequeued = ipaugenblick_select_bulk(loop->selector,socks,masks,MAX_PKT_BURST);
+    ipaugenblick_stats_event_loop_ready_dequeued += dequeued;
+    for(i = 0;i < dequeued;i++) {
+        if(masks[i] & SOCKET_SHARED_RX_BIT) {
+            loop->shared_rx_pending = 1;
+            continue;
+        }
+        if(!loop->sockets[socks[i]].pending_mask)
+            loop->pending_socks[loop->pending_count++] = socks[i];
+        loop->sockets[socks[i]].pending_mask |= masks[i];
+    }
+}
+
+static int ipaugenblick_event_loop_dispatch(ipaugenblick_event_loop_t *loop)
+{
+    int i,sock,newsock,dispatched = 0;
+    unsigned short mask;
+    ipaugenblick_event_loop_socket_t *loop_sock;
+
+    if((loop->shared_rx_pending)&&(loop->on_shared_rx)) {
+        loop->shared_rx_pending = 0;
+        loop->on_shared_rx(loop,loop->selector,loop->shared_rx_arg);
+        dispatched++;
+    }
+    for(i = 0;i < loop->pending_count;i++) {
+        sock = loop->pending_socks[i];
+        loop_sock = &loop->sockets[sock];
+        mask = loop_sock->pending_mask;
+        loop_sock->pending_mask = 0;
+        /* whatever else is reported for a handed off socket is only valid once it is adopted */
+        if(mask & SOCKET_HANDOFF_BIT) {
+            if(ipaugenblick_adopt(sock,loop->selector)) {
+                ipaugenblick_stats_event_loop_adopt_failed++;
+                /* nobody else takes it, don't leave the connection open */
+                ipaugenblick_close(sock);
+                continue;
+            }
+            ipaugenblick_stats_event_loop_adopted++;
+            loop_sock->registered = 0;
+            if(loop->on_handoff) {
+                loop_sock->adopted = 1;
+                loop->on_handoff(loop,sock,loop->handoff_arg);
+                loop_sock->adopted = 0;
+                dispatched++;
+            }
+            if(!loop_sock->registered) {
+                ipaugenblick_close(sock);
+                continue;
+            }
+        }
+        if(!loop_sock->registered)
+            continue;
+        if(mask & SOCKET_READABLE_BIT) {
+            if(loop_sock->on_accept) {
+                while((newsock = ipaugenblick_accept(sock)) >= 0) {
+                    loop_sock->on_accept(loop,newsock,loop_sock->arg);
+                    dispatched++;
+                }
+            }
+            else if(loop_sock->on_read) {
+                loop_sock->on_read(loop,sock,loop_sock->arg);
+                dispatched++;
+            }
+        }
+        /* on_read might have closed the socket */
+        if((mask & SOCKET_WRITABLE_BIT)&&(loop_sock->registered)&&(loop_sock->on_write)) {
+            loop_sock->on_write(loop,sock,loop_sock->arg);
+            dispatched++;
+        }
+        if((mask & (SOCKET_SENDFILE_DONE_BIT|SOCKET_TX_TIMESTAMP_BIT))&&(loop_sock->registered)&&(loop_sock->on_notify)) {
+            loop_sock->on_notify(loop,sock,mask & (SOCKET_SENDFILE_DONE_BIT|SOCKET_TX_TIMESTAMP_BIT),loop_sock->arg);
+            dispatched++;
+        }
+    }
+    loop->pending_count = 0;
+    ipaugenblick_stats_event_loop_dispatched += dispatched;
+    return dispatched;
+}
+
+int ipaugenblick_event_loop_run_once(ipaugenblick_event_loop_t *loop)
+{
+    int done;
+
+    ipaugenblick_stats_event_loop_iterations++;
+    done = ipaugenblick_event_loop_process_timers(loop,rte_rdtsc());
+    ipaugenblick_event_loop_collect_ready(loop);
+    done += ipaugenblick_event_loop_dispatch(loop);
+    return done;
+}
+
+void ipaugenblick_event_loop_run(ipaugenblick_event_loop_t *loop)
+{
+    uint64_t now,expiry,micros;
+
+    loop->running = 1;
+    while(loop->running) {
+        if(ipaugenblick_event_loop_run_once(loop) > 0)
+            continue;
+        /* idle: wait on the selector until the nearest timer is due */
+        micros = IPAUGENBLICK_SELECT_WAIT_FOREVER;
+        if(loop->timer_heap_size > 0) {
+            now = rte_rdtsc();
+            expiry = timer_expiry(loop,0);
+            if(expiry <= now)
+                continue;
+            micros = (expiry - now)/loop->cycles_in_micro;
+        }
+        ipaugenblick_select_wait(loop->selector,micros);
+    }
+}
+
+void ipaugenblick_event_loop_stop(ipaugenblick_event_loop_t *loop)
+{
+    loop->running = 0;
+}
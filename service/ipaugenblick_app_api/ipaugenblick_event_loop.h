@@ -0,0 +1,76 @@
+#ifndef __IPAUGENBLICK_EVENT_LOOP_H__
+#define __IPAUGENBLICK_EVENT_LOOP_H__
+
+#include <stdint.h>
+
+/* A reactor on the top of the selector.
+   Sockets are registered with callbacks, which are invoked when
+   the selector reports the socket readable/writable.
+   Timers are kept in a heap ordered by TSC deadline, the loop never
+   waits on the selector longer than the nearest deadline */
+
+typedef struct ipaugenblick_event_loop ipaugenblick_event_loop_t;
+
+/* sock - ready socket (for on_accept - the newly accepted one) */
+typedef void (*ipaugenblick_event_cbk_t)(ipaugenblick_event_loop_t *loop,int sock,void *arg);
+
+typedef void (*ipaugenblick_timer_cbk_t)(ipaugenblick_event_loop_t *loop,int timer,void *arg);
+
+/* mask - SOCKET_SENDFILE_DONE_BIT and/or SOCKET_TX_TIMESTAMP_BIT */
+typedef void (*ipaugenblick_notify_cbk_t)(ipaugenblick_event_loop_t *loop,int sock,unsigned short mask,void *arg);
+
+/* selector - the loop's selector, its shared rx ring is non-empty */
+typedef void (*ipaugenblick_shared_rx_cbk_t)(ipaugenblick_event_loop_t *loop,int selector,void *arg);
+
+#define IPAUGENBLICK_EVENT_LOOP_MAX_TIMERS 1024
+
+/* opens a selector the loop dispatches from */
+ipaugenblick_event_loop_t *ipaugenblick_event_loop_create(void);
+
+void ipaugenblick_event_loop_destroy(ipaugenblick_event_loop_t *loop);
+
+/* attaches the socket to the loop's selector.
+   on_accept != NULL makes it a listener: on readable, the loop accepts all
+   pending connections and calls on_accept for each of them.
+   Any callback may be NULL */
+int ipaugenblick_event_loop_add_socket(ipaugenblick_event_loop_t *loop,int sock,
+                                       ipaugenblick_event_cbk_t on_read,
+                                       ipaugenblick_event_cbk_t on_write,
+                                       ipaugenblick_event_cbk_t on_accept,
+                                       ipaugenblick_event_cbk_t on_close,
+                                       void *arg);
+
+/* sendfile completions and tx timestamp reports of a registered socket */
+void ipaugenblick_event_loop_set_notify(ipaugenblick_event_loop_t *loop,int sock,ipaugenblick_notify_cbk_t on_notify);
+
+/* called when sockets attached with shared rx have buffers, read them with ipaugenblick_receive_shared */
+void ipaugenblick_event_loop_set_shared_rx(ipaugenblick_event_loop_t *loop,ipaugenblick_shared_rx_cbk_t on_shared_rx,void *arg);
+
+/* Sockets handed to the loop's selector are adopted before anything else reported for them
+   is dispatched, then on_handoff is called to register them with add_socket.
+   Without on_handoff they are closed */
+void ipaugenblick_event_loop_set_handoff(ipaugenblick_event_loop_t *loop,ipaugenblick_event_cbk_t on_handoff,void *arg);
+
+/* stops dispatching events for the socket, the socket is not closed */
+void ipaugenblick_event_loop_remove_socket(ipaugenblick_event_loop_t *loop,int sock);
+
+/* calls on_close, removes the socket from the loop and closes it */
+void ipaugenblick_event_loop_close_socket(ipaugenblick_event_loop_t *loop,int sock);
+
+/* arms a timer to expire in micros. If periodic, it is re-armed after each expiry.
+   Returns timer id or -1 if no free timers */
+int ipaugenblick_event_loop_add_timer(ipaugenblick_event_loop_t *loop,uint64_t micros,int periodic,
+                                      ipaugenblick_timer_cbk_t cbk,void *arg);
+
+void ipaugenblick_event_loop_cancel_timer(ipaugenblick_event_loop_t *loop,int timer);
+
+/* one iteration: expired timers, then a burst of ready sockets, without waiting.
+   Returns number of callbacks invoked */
+int ipaugenblick_event_loop_run_once(ipaugenblick_event_loop_t *loop);
+
+/* runs until ipaugenblick_event_loop_stop is called (from any callback) */
+void ipaugenblick_event_loop_run(ipaugenblick_event_loop_t *loop);
+
+void ipaugenblick_event_loop_stop(ipaugenblick_event_loop_t *loop);
+
+#endif
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_memcpy.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+#include <rte_mbuf.h>
+#include <rte_atomic.h>
+#include "../ipaugenblick_common/ipaugenblick_common.h"
+#include "ipaugenblick_ring_ops.h"
+#include "ipaugenblick_framing.h"
+
+/* must be power of 2 */
+#define IPAUGENBLICK_FRAMER_MAX_SEGS 256
+#define IPAUGENBLICK_FRAMER_MAX_HEADER 64
+#define IPAUGENBLICK_FRAMER_MAX_DELIMITER 16
+#define IPAUGENBLICK_FRAMER_MAX_VARINT 10
+
+/* the parser's view of the stream is a ring of segments unlinked from the received chains.
+   Each segment carries the parser's reference, views add their own */
+struct ipaugenblick_framer
+{
+    int sock;
+    ipaugenblick_framing_config_t config;
+    char delimiter[IPAUGENBLICK_FRAMER_MAX_DELIMITER];
+    struct rte_mbuf *segs[IPAUGENBLICK_FRAMER_MAX_SEGS];
+    unsigned head;
+    unsigned count;
+    int offset;     /* consumed bytes in the head segment */
+    int available;  /* bytes from the cursor to the end of the last segment */
+    int scanned;    /* DELIMITER: bytes known not to start a delimiter */
+    int failed;     /* after a protocol error nothing more is parsed */
+    struct rte_mbuf *chain; /* rest of a received chain not fitting into segs */
+};
+
+uint64_t ipaugenblick_stats_frames = 0;
+uint64_t ipaugenblick_stats_frames_copied = 0;
+uint64_t ipaugenblick_stats_framing_errors = 0;
+
+#define FRAMER_SEG(f,i) ((f)->segs[((f)->head + (i)) & (IPAUGENBLICK_FRAMER_MAX_SEGS - 1)])
+
+ipaugenblick_framer_t *ipaugenblick_framer_create(int sock,const ipaugenblick_framing_config_t *config)
+{
+    ipaugenblick_framer_t *framer;
+
+    if((config->max_message_size <= 0)||(config->max_message_size > IPAUGENBLICK_FRAMING_MAX_MESSAGE_SIZE)) {
+        printf("invalid max message size %d %s %d\n",config->max_message_size,__FILE__,__LINE__);
+        return NULL;
+    }
+    switch(config->type) {
+        case IPAUGENBLICK_FRAMING_FIXED_LENGTH:
+            if((config->header_size > IPAUGENBLICK_FRAMER_MAX_HEADER)||
+               (config->length_offset + config->length_size > config->header_size)||
+               ((config->length_size != 1)&&(config->length_size != 2)&&
+                (config->length_size != 4)&&(config->length_size != 8))) {
+                printf("invalid fixed length framing %s %d\n",__FILE__,__LINE__);
+                return NULL;
+            }
+            break;
+        case IPAUGENBLICK_FRAMING_VARINT:
+            break;
+        case IPAUGENBLICK_FRAMING_DELIMITER:
+            if((config->delimiter_len <= 0)||(config->delimiter_len > IPAUGENBLICK_FRAMER_MAX_DELIMITER)) {
+                printf("invalid delimiter framing %s %d\n",__FILE__,__LINE__);
+                return NULL;
+            }
+            break;
+        default:
+            printf("unknown framing %d %s %d\n",config->type,__FILE__,__LINE__);
+            return NULL;
+    }
+    framer = calloc(1,sizeof(*framer));
+    if(!framer) {
+        printf("cannot allocate framer %s %d\n",__FILE__,__LINE__);
+        return NULL;
+    }
+    framer->sock = sock;
+    framer->config = *config;
+    if(config->type == IPAUGENBLICK_FRAMING_DELIMITER) {
+        memcpy(framer->delimiter,config->delimiter,config->delimiter_len);
+        framer->config.delimiter = framer->delimiter;
+    }
+    return framer;
+}
+
+void ipaugenblick_framer_destroy(ipaugenblick_framer_t *framer)
+{
+    unsigned i;
+
+    for(i = 0;i < framer->count;i++)
+        rte_pktmbuf_free_seg(FRAMER_SEG(framer,i));
+    if(framer->chain)
+        rte_pktmbuf_free(framer->chain);
+    free(framer);
+}
+
+/* moves received segments into the ring. Returns number of bytes added */
+static int ipaugenblick_framer_fill(ipaugenblick_framer_t *framer)
+{
+    struct rte_mbuf *seg;
+    int added = 0;
+
+    while(framer->count < IPAUGENBLICK_FRAMER_MAX_SEGS) {
+        if(!framer->chain) {
+            framer->chain = ipaugenblick_dequeue_rx_buf(framer->sock);
+            if(!framer->chain)
+                break;
+        }
+        seg = framer->chain;
+        framer->chain = seg->pkt.next;
+        seg->pkt.next = NULL;
+        seg->pkt.nb_segs = 1;
+        if(seg->pkt.data_len == 0) {
+            rte_pktmbuf_free_seg(seg);
+            continue;
+        }
+        FRAMER_SEG(framer,framer->count) = seg;
+        framer->count++;
+        framer->available += seg->pkt.data_len;
+        added += seg->pkt.data_len;
+    }
+    return added;
+}
+
+/* finds segment and offset in it for the stream position pos (relative to the cursor) */
+static inline unsigned ipaugenblick_framer_locate(ipaugenblick_framer_t *framer,int pos,int *seg_offset)
+{
+    unsigned idx = 0;
+    int off = framer->offset + pos;
+
+    while(off >= FRAMER_SEG(framer,idx)->pkt.data_len) {
+        off -= FRAMER_SEG(framer,idx)->pkt.data_len;
+        idx++;
+    }
+    *seg_offset = off;
+    return idx;
+}
+
+/* pos + len must not exceed available */
+static void ipaugenblick_framer_copy_out(ipaugenblick_framer_t *framer,int pos,char *dst,int len)
+{
+    int off,chunk;
+    unsigned idx;
+    struct rte_mbuf *seg;
+
+    if(len == 0)
+        return;
+    idx = ipaugenblick_framer_locate(framer,pos,&off);
+    while(len > 0) {
+        seg = FRAMER_SEG(framer,idx);
+        chunk = seg->pkt.data_len - off;
+        if(chunk > len)
+            chunk = len;
+        rte_memcpy(dst,(char *)seg->pkt.data + off,chunk);
+        dst += chunk;
+        len -= chunk;
+        off = 0;
+        idx++;
+    }
+}
+
+static void ipaugenblick_framer_consume(ipaugenblick_framer_t *framer,int len)
+{
+    struct rte_mbuf *seg;
+
+    framer->available -= len;
+    len += framer->offset;
+    while((framer->count > 0)&&(len >= FRAMER_SEG(framer,0)->pkt.data_len)) {
+        seg = FRAMER_SEG(framer,0);
+        len -= seg->pkt.data_len;
+        framer->head = (framer->head + 1) & (IPAUGENBLICK_FRAMER_MAX_SEGS - 1);
+        framer->count--;
+        /* drops parser's reference only, if a view holds the segment */
+        rte_pktmbuf_free_seg(seg);
+    }
+    framer->offset = len;
+}
+
+/* Returns 0 if parsed, -1 if more data is needed, -2 on error */
+static int ipaugenblick_framer_parse_fixed(ipaugenblick_framer_t *framer,int *payload_offset,int *payload_len)
+{
+    ipaugenblick_framing_config_t *config = &framer->config;
+    unsigned char header[IPAUGENBLICK_FRAMER_MAX_HEADER];
+    uint64_t length = 0;
+    int i;
+
+    if(framer->available < config->header_size)
+        return -1;
+    ipaugenblick_framer_copy_out(framer,0,(char *)header,config->header_size);
+    for(i = 0;i < config->length_size;i++) {
+        if(config->length_big_endian)
+            length = (length << 8) | header[config->length_offset + i];
+        else
+            length |= ((uint64_t)header[config->length_offset + i]) << (8*i);
+    }
+    if(config->length_includes_header) {
+        if(length < (uint64_t)config->header_size)
+            return -2;
+        length -= config->header_size;
+    }
+    if(length > (uint64_t)config->max_message_size)
+        return -2;
+    *payload_offset = config->header_size;
+    *payload_len = (int)length;
+    return 0;
+}
+
+static int ipaugenblick_framer_parse_varint(ipaugenblick_framer_t *framer,int *payload_offset,int *payload_len)
+{
+    unsigned char bytes[IPAUGENBLICK_FRAMER_MAX_VARINT];
+    uint64_t length = 0;
+    int i,n;
+
+    n = (framer->available < IPAUGENBLICK_FRAMER_MAX_VARINT) ? framer->available : IPAUGENBLICK_FRAMER_MAX_VARINT;
+    ipaugenblick_framer_copy_out(framer,0,(char *)bytes,n);
+    for(i = 0;i < n;i++) {
+        length |= ((uint64_t)(bytes[i] & 0x7F)) << (7*i);
+        if(!(bytes[i] & 0x80))
+            break;
+    }
+    if(i == n)
+        return (n == IPAUGENBLICK_FRAMER_MAX_VARINT) ? -2 : -1;
+    if(length > (uint64_t)framer->config.max_message_size)
+        return -2;
+    *payload_offset = i + 1;
+    *payload_len = (int)length;
+    return 0;
+}
+
+static int ipaugenblick_framer_parse_delimiter(ipaugenblick_framer_t *framer,int *payload_offset,int *payload_len)
+{
+    ipaugenblick_framing_config_t *config = &framer->config;
+    char candidate[IPAUGENBLICK_FRAMER_MAX_DELIMITER];
+    struct rte_mbuf *seg;
+    unsigned idx;
+    int off,pos,limit;
+    char *data,*found;
+
+    limit = framer->available - config->delimiter_len;
+    pos = framer->scanned;
+    while(pos <= limit) {
+        idx = ipaugenblick_framer_locate(framer,pos,&off);
+        seg = FRAMER_SEG(framer,idx);
+        data = (char *)seg->pkt.data + off;
+        found = memchr(data,config->delimiter[0],seg->pkt.data_len - off);
+        if(!found) {
+            pos += seg->pkt.data_len - off;
+            continue;
+        }
+        pos += found - data;
+        if(pos > limit)
+            break;
+        ipaugenblick_framer_copy_out(framer,pos,candidate,config->delimiter_len);
+        if(!memcmp(candidate,config->delimiter,config->delimiter_len)) {
+            framer->scanned = 0;
+            if(pos > config->max_message_size)
+                return -2;
+            *payload_offset = 0;
+            *payload_len = pos;
+            return 0;
+        }
+        pos++;
+    }
+    framer->scanned = (limit + 1 > 0) ? limit + 1 : 0;
+    if(framer->scanned > config->max_message_size)
+        return -2;
+    return -1;
+}
+
+/* builds the view of len bytes at pos */
+static int ipaugenblick_framer_make_view(ipaugenblick_framer_t *framer,int pos,int len,ipaugenblick_frame_t *frame)
+{
+    struct rte_mbuf *seg;
+    unsigned idx;
+    int off,chunk,remaining = len;
+
+    frame->len = len;
+    frame->iovcnt = 0;
+    frame->refs_count = 0;
+    if(len == 0)
+        return 0;
+    idx = ipaugenblick_framer_locate(framer,pos,&off);
+    seg = FRAMER_SEG(framer,idx);
+    if((len > seg->pkt.data_len - off)&&(len <= IPAUGENBLICK_FRAME_SIDE_BUFFER_SIZE)) {
+        /* straddles, but short enough to copy */
+        ipaugenblick_framer_copy_out(framer,pos,frame->side_buffer,len);
+        frame->iov[0].base = frame->side_buffer;
+        frame->iov[0].len = len;
+        frame->iovcnt = 1;
+        ipaugenblick_stats_frames_copied++;
+        return 0;
+    }
+    while(remaining > 0) {
+        if(frame->iovcnt == IPAUGENBLICK_FRAME_MAX_IOV) {
+            ipaugenblick_frame_release(frame);
+            return -2;
+        }
+        seg = FRAMER_SEG(framer,idx);
+        chunk = seg->pkt.data_len - off;
+        if(chunk > remaining)
+            chunk = remaining;
+        rte_mbuf_refcnt_update(seg,1);
+        frame->refs[frame->refs_count++] = seg;
+        frame->iov[frame->iovcnt].base = (char *)seg->pkt.data + off;
+        frame->iov[frame->iovcnt].len = chunk;
+        frame->iovcnt++;
+        remaining -= chunk;
+        off = 0;
+        idx++;
+    }
+    return 0;
+}
+
+int ipaugenblick_framer_next(ipaugenblick_framer_t *framer,ipaugenblick_frame_t *frame)
+{
+    int rc,payload_offset,payload_len,trailer_len;
+
+    if(framer->failed)
+        return -2;
+    while(1) {
+        switch(framer->config.type) {
+            case IPAUGENBLICK_FRAMING_FIXED_LENGTH:
+                rc = ipaugenblick_framer_parse_fixed(framer,&payload_offset,&payload_len);
+                trailer_len = 0;
+                break;
+            case IPAUGENBLICK_FRAMING_VARINT:
+                rc = ipaugenblick_framer_parse_varint(framer,&payload_offset,&payload_len);
+                trailer_len = 0;
+                break;
+            default:
+                rc = ipaugenblick_framer_parse_delimiter(framer,&payload_offset,&payload_len);
+                trailer_len = framer->config.delimiter_len;
+                break;
+        }
+        if((rc == 0)&&(framer->available < payload_offset + payload_len + trailer_len))
+            rc = -1;
+        if(rc == 0)
+            break;
+        if((rc == -2)||(framer->count == IPAUGENBLICK_FRAMER_MAX_SEGS)) {
+            framer->failed = 1;
+            ipaugenblick_stats_framing_errors++;
+            return -2;
+        }
+        if(ipaugenblick_framer_fill(framer) == 0)
+            return -1;
+    }
+    /* spread over too many small segments, nothing can be consumed */
+    if(ipaugenblick_framer_make_view(framer,payload_offset,payload_len,frame)) {
+        framer->failed = 1;
+        ipaugenblick_stats_framing_errors++;
+        return -2;
+    }
+    ipaugenblick_framer_consume(framer,payload_offset + payload_len + trailer_len);
+    ipaugenblick_stats_frames++;
+    return 0;
+}
+
+void ipaugenblick_frame_release(ipaugenblick_frame_t *frame)
+{
+    int i;
+
+    for(i = 0;i < frame->refs_count;i++)
+        rte_pktmbuf_free_seg((struct rte_mbuf *)frame->refs[i]);
+    frame->refs_count = 0;
+    frame->iovcnt = 0;
+}
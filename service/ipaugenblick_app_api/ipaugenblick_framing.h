@@ -0,0 +1,72 @@
+#ifndef __IPAUGENBLICK_FRAMING_H__
+#define __IPAUGENBLICK_FRAMING_H__
+
+/* Splits a TCP byte stream into messages without linearizing it.
+   A message is returned as a view (iovec) pointing into the received buffers,
+   the buffers are released when the parser and all the views over them are done.
+   Only a message shorter than IPAUGENBLICK_FRAME_SIDE_BUFFER_SIZE which straddles
+   buffers is copied (into the frame's side buffer) */
+
+enum
+{
+    IPAUGENBLICK_FRAMING_FIXED_LENGTH = 0, /* length field at a fixed offset in a fixed size header */
+    IPAUGENBLICK_FRAMING_VARINT,           /* LEB128 (protobuf style) length prefix */
+    IPAUGENBLICK_FRAMING_DELIMITER         /* message ends with a delimiter */
+};
+
+typedef struct
+{
+    int type;
+    /* FIXED_LENGTH */
+    int header_size;            /* bytes preceding the payload */
+    int length_offset;          /* offset of the length field within the header */
+    int length_size;            /* 1,2,4 or 8 */
+    int length_big_endian;
+    int length_includes_header;
+    /* DELIMITER */
+    const char *delimiter;
+    int delimiter_len;
+    /* all types: longer messages are a protocol error, 1..IPAUGENBLICK_FRAMING_MAX_MESSAGE_SIZE */
+    int max_message_size;
+}ipaugenblick_framing_config_t;
+
+#define IPAUGENBLICK_FRAME_MAX_IOV 64
+/* a view spans at most IPAUGENBLICK_FRAME_MAX_IOV segments, the limit assumes full sized (1448) ones,
+   the first of them possibly shared with the previous message */
+#define IPAUGENBLICK_FRAMING_MAX_MESSAGE_SIZE ((IPAUGENBLICK_FRAME_MAX_IOV - 1)*1448)
+#define IPAUGENBLICK_FRAME_SIDE_BUFFER_SIZE 512
+
+typedef struct
+{
+    void *base;
+    int len;
+}ipaugenblick_iovec_t;
+
+typedef struct
+{
+    ipaugenblick_iovec_t iov[IPAUGENBLICK_FRAME_MAX_IOV];
+    int iovcnt;
+    int len; /* payload length, header/delimiter excluded */
+    /* internal */
+    void *refs[IPAUGENBLICK_FRAME_MAX_IOV];
+    int refs_count;
+    char side_buffer[IPAUGENBLICK_FRAME_SIDE_BUFFER_SIZE];
+}ipaugenblick_frame_t;
+
+typedef struct ipaugenblick_framer ipaugenblick_framer_t;
+
+ipaugenblick_framer_t *ipaugenblick_framer_create(int sock,const ipaugenblick_framing_config_t *config);
+
+/* releases buffers held by the parser, frames handed out stay valid until released */
+void ipaugenblick_framer_destroy(ipaugenblick_framer_t *framer);
+
+/* Returns 0 and fills frame if a complete message is available,
+   -1 if more data is needed (call again when the socket is readable),
+   -2 on protocol error (message too long or spread over more than IPAUGENBLICK_FRAME_MAX_IOV
+   segments, malformed varint). The framer stays failed after an error, close the connection */
+int ipaugenblick_framer_next(ipaugenblick_framer_t *framer,ipaugenblick_frame_t *frame);
+
+/* drops the frame's references to the received buffers */
+void ipaugenblick_frame_release(ipaugenblick_frame_t *frame);
+
+#endif
@@ -12,12 +12,33 @@ typedef struct
     ipaugenblick_socket_t *socket;
     int select;
     struct rte_ring *local_cache;
+    struct rte_mbuf *read_pending; /* partially consumed by ipaugenblick_read */
+    int read_pending_offset;
+    int tx_blocked; /* out of tx buffers, the service was told and didn't report writable since */
+    struct rte_ring *errq_ring; /* tx timestamp reports */
+    int numa_socket; /* of tx_ring/rx_ring, differs from the app's for an adopted connection */
+    int tx_ring_id; /* IPAUGENBLICK_HOME_RING or the big ring the service moved the socket to */
+    int rx_ring_id;
+    int handed_off; /* by this process, its entries on the shared ring go to the new owner */
 }local_socket_descriptor_t;
 
+/* tx buffers an app may hold (allocated or queued to the service) over all its sockets,
+   and per socket. Keeps one app from draining the shared mbufs pool. The per-socket
+   windows are not carved out of the app's budget, so opening sockets costs nothing */
+#ifndef IPAUGENBLICK_APP_TX_CREDITS
+#define IPAUGENBLICK_APP_TX_CREDITS 8192
+#endif
+#ifndef IPAUGENBLICK_SOCKET_TX_CREDITS
+#define IPAUGENBLICK_SOCKET_TX_CREDITS (DATA_RINGS_SIZE - 1) /* what the home tx ring holds */
+#endif
+
+/* tx buffers remember the socket they were charged to (unused by tx path otherwise) */
+#define IPAUGENBLICK_TX_BUF_OWNER(mbuf) ((mbuf)->pkt.hash.rss)
+
 extern struct rte_ring *free_connections_ring;
 extern struct rte_mempool *tx_bufs_pool;
 extern struct rte_mempool *free_command_pool;
-extern struct rte_ring *command_ring;
+extern ipaugenblick_cmd_ring_t *ipaugenblick_app_cmd_ring;
 extern local_socket_descriptor_t local_socket_descriptors[IPAUGENBLICK_CONNECTION_POOL_SIZE];
 
 extern uint64_t ipaugenblick_stats_rx_kicks_sent;
@@ -25,23 +46,44 @@ extern uint64_t ipaugenblick_stats_rx_full;
 extern uint64_t ipaugenblick_stats_rx_dequeued;
 extern uint64_t ipaugenblick_stats_rx_dequeued_local;
 
-static inline int ipaugenblick_enqueue_command_buf(ipaugenblick_cmd_t *cmd)
+/* the service published another ring for the socket, see ipaugenblick_swap_tx_ring/rx_ring */
+void ipaugenblick_follow_tx_ring(int sock);
+void ipaugenblick_follow_rx_ring(int sock);
+
+/* filled in place, sent by ipaugenblick_post_command. NULL if the service is behind by a whole ring.
+   The app's command ring is single producer, commands are sent from one thread at a time */
+static inline ipaugenblick_cmd_t *ipaugenblick_get_command_slot()
+{
+    return ipaugenblick_cmd_ring_reserve(ipaugenblick_app_cmd_ring);
+}
+
+static inline void ipaugenblick_post_command()
+{
+    ipaugenblick_cmd_ring_post(ipaugenblick_app_cmd_ring);
+}
+
+static inline void ipaugenblick_check_tx_ring(int ringset_idx)
 {
-    return (rte_ring_enqueue(command_ring,(void *)cmd) == -ENOBUFS);
+    if(unlikely(rte_atomic32_read(&local_socket_descriptors[ringset_idx].socket->tx_ring_id) != 
+                local_socket_descriptors[ringset_idx].tx_ring_id))
+        ipaugenblick_follow_tx_ring(ringset_idx);
 }
 
 static inline int ipaugenblick_enqueue_tx_buf(int ringset_idx,struct rte_mbuf *mbuf)
 {
+    ipaugenblick_check_tx_ring(ringset_idx);
     return (rte_ring_sp_enqueue_bulk(local_socket_descriptors[ringset_idx].tx_ring,(void **)&mbuf,1) == -ENOBUFS);
 }
 
 static inline int ipaugenblick_enqueue_tx_bufs_bulk(int ringset_idx,struct rte_mbuf **mbufs,int buffer_count)
 {
+    ipaugenblick_check_tx_ring(ringset_idx);
     return (rte_ring_sp_enqueue_bulk(local_socket_descriptors[ringset_idx].tx_ring,(void **)mbufs,buffer_count) == -ENOBUFS);
 }
 
 static inline int ipaugenblick_socket_tx_space(int ringset_idx)
 {
+    ipaugenblick_check_tx_ring(ringset_idx);
     return rte_ring_free_count(local_socket_descriptors[ringset_idx].tx_ring);
 }
 
@@ -51,6 +93,9 @@ static struct rte_mbuf *ipaugenblick_dequeue_rx_buf(int ringset_idx)
     int send_kick = 1,dequeued;
     ipaugenblick_cmd_t *cmd;
  
+    if(unlikely(rte_atomic32_read(&local_socket_descriptors[ringset_idx].socket->rx_ring_id) != 
+                local_socket_descriptors[ringset_idx].rx_ring_id))
+        ipaugenblick_follow_rx_ring(ringset_idx);
     if(rte_ring_free_count(local_socket_descriptors[ringset_idx].rx_ring) == 0) {
         send_kick = 1;
         ipaugenblick_stats_rx_full++;
@@ -89,11 +134,11 @@ static struct rte_mbuf *ipaugenblick_dequeue_rx_buf(int ringset_idx)
     }
 skip_local:
     if(send_kick) {
-        cmd = ipaugenblick_get_free_command_buf();
+        cmd = ipaugenblick_get_command_slot();
         if(cmd) {
             cmd->cmd = IPAUGENBLICK_SOCKET_RX_KICK_COMMAND;
             cmd->ringset_idx = ringset_idx;
-            ipaugenblick_enqueue_command_buf(cmd);
+            ipaugenblick_post_command();
             ipaugenblick_stats_rx_kicks_sent++;
         }
     }
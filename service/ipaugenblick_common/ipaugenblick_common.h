@@ -1,6 +1,8 @@
 
 #ifndef __IPAUGENBLICK__COMMON_H__
 #define __IPAUGENBLICK__COMMON_H__
+#include <rte_memory.h>
+#include <rte_ring.h>
 
 enum
 {
@@ -18,7 +20,12 @@ enum
     IPAUGENBLICK_SOCKET_READY_FEEDBACK,
     IPAUGENBLICK_SOCKET_CONNECT_COMMAND,
     IPAUGENBLICK_SOCKET_CLOSE_COMMAND,
-    IPAUGENBLICK_SOCKET_TX_POOL_EMPTY_COMMAND
+    IPAUGENBLICK_SOCKET_TX_POOL_EMPTY_COMMAND,
+    IPAUGENBLICK_SOCKET_SENDFILE_COMMAND,
+    IPAUGENBLICK_SOCKET_SET_WATERMARKS_COMMAND,
+    IPAUGENBLICK_SOCKET_TX_TIMESTAMP_REPORT, /* service to app, on the socket's errq_ring */
+    IPAUGENBLICK_SOCKET_HANDOFF_COMMAND,
+    IPAUGENBLICK_SOCKET_ADOPT_COMMAND
 };
 
 typedef struct
@@ -66,6 +73,7 @@ typedef struct
 {
     int socket_select;
     unsigned long pid;
+    int shared_rx; /* deliver received buffers on the selector's shared ring */
 }__attribute__((packed))ipaugenblick_set_socket_select_cmd_t;
 
 typedef struct
@@ -74,8 +82,51 @@ typedef struct
     unsigned short port;
 }__attribute__((packed))ipaugenblick_socket_connect_cmd_t;
 
+typedef struct
+{
+    int fd; /* of the process owning the command ring */
+    unsigned long offset;
+    unsigned long length;
+}__attribute__((packed))ipaugenblick_socket_sendfile_cmd_t;
+
+typedef struct
+{
+    int socket_select; /* the new owner's */
+}__attribute__((packed))ipaugenblick_socket_handoff_cmd_t;
+
+typedef struct
+{
+    int socket_select; /* the one it was handed off to */
+}__attribute__((packed))ipaugenblick_socket_adopt_cmd_t;
+
+typedef struct
+{
+    int rx_lowat;
+    int rx_hiwat;
+    int tx_lowat;
+    unsigned long rx_max_delay_us;
+}__attribute__((packed))ipaugenblick_socket_watermarks_cmd_t;
+
+enum
+{
+    IPAUGENBLICK_TX_TSTAMP_SCHED = 0, /* left the tx ring */
+    IPAUGENBLICK_TX_TSTAMP_SENT,      /* handed to the PMD (first transmission) */
+    IPAUGENBLICK_TX_TSTAMP_ACKED      /* last byte cumulatively ACKed */
+};
+
+typedef struct
+{
+    uint64_t tag;
+    uint64_t tsc;
+    int type;
+}__attribute__((packed))ipaugenblick_tx_timestamp_t;
+
 #define SOCKET_READABLE_BIT 1
 #define SOCKET_WRITABLE_BIT 2
+#define SOCKET_SENDFILE_DONE_BIT 4
+#define SOCKET_TX_TIMESTAMP_BIT 8
+#define SOCKET_SHARED_RX_BIT 16 /* the selector's shared rx ring became non-empty, index is the selector's */
+#define SOCKET_HANDOFF_BIT 32 /* another process handed the socket to this selector */
 #define SOCKET_READY_SHIFT 16
 #define SOCKET_READY_MASK 0xFFFF
 
@@ -89,6 +140,7 @@ typedef struct
     int cmd;
     unsigned int ringset_idx;
     int          parent_idx;
+    int          numa_socket; /* app's socket, valid in commands binding a ringset */
     union {
         ipaugenblick_open_client_sock_cmd_t open_client_sock;
         ipaugenblick_open_listening_sock_cmd_t open_listening_sock;
@@ -100,41 +152,200 @@ typedef struct
         ipaugenblick_set_socket_select_cmd_t set_socket_select;
         ipaugenblick_socket_ready_feedback_t socket_ready_feedback;
         ipaugenblick_socket_connect_cmd_t socket_connect;
+        ipaugenblick_socket_sendfile_cmd_t socket_sendfile;
+        ipaugenblick_socket_watermarks_cmd_t socket_watermarks;
+        ipaugenblick_tx_timestamp_t tx_timestamp;
+        ipaugenblick_socket_handoff_cmd_t socket_handoff;
+        ipaugenblick_socket_adopt_cmd_t socket_adopt;
     }u;
 }__attribute__((packed))ipaugenblick_cmd_t;
 
+/* app to service commands are stored by value, each app has its own single producer/
+   single consumer ring, so apps don't contend and nothing is allocated per command.
+   An app claims a ring at init by writing its pid, a dead app's ring is taken over as is */
+#define IPAUGENBLICK_CMD_RINGS_COUNT 16
+#define IPAUGENBLICK_CMD_RING_SIZE 1024 /* power of 2 */
+#define CMD_RING_NAME_BASE "cmd_ring"
+
+typedef union
+{
+    ipaugenblick_cmd_t cmd;
+    char pad[64];
+}__attribute__((aligned(64)))ipaugenblick_cmd_record_t;
+
+typedef struct
+{
+    rte_atomic32_t pid; /* owner app, 0 - free */
+    int tx_budget; /* tx buffers the app may hold over all its sockets, set at init */
+    /* up by the app per buffer allocated, down as the service takes them off its sockets' tx rings */
+    rte_atomic32_t tx_inflight __attribute__((aligned(64)));
+    volatile uint32_t head __attribute__((aligned(64))); /* written by the app only */
+    volatile uint32_t tail __attribute__((aligned(64))); /* written by the service only */
+    ipaugenblick_cmd_record_t records[IPAUGENBLICK_CMD_RING_SIZE] __attribute__((aligned(64)));
+}ipaugenblick_cmd_ring_t;
+
+/* slot for the next command, valid until ipaugenblick_cmd_ring_post */
+static inline ipaugenblick_cmd_t *ipaugenblick_cmd_ring_reserve(ipaugenblick_cmd_ring_t *cmd_ring)
+{
+    if(cmd_ring->head - cmd_ring->tail >= IPAUGENBLICK_CMD_RING_SIZE)
+        return NULL;
+    return &cmd_ring->records[cmd_ring->head & (IPAUGENBLICK_CMD_RING_SIZE - 1)].cmd;
+}
+
+static inline void ipaugenblick_cmd_ring_post(ipaugenblick_cmd_ring_t *cmd_ring)
+{
+    rte_wmb();
+    cmd_ring->head++;
+}
+
+/* commands are processed in place, the slots are released after */
+static inline uint32_t ipaugenblick_cmd_ring_count(ipaugenblick_cmd_ring_t *cmd_ring)
+{
+    uint32_t count = cmd_ring->head - cmd_ring->tail;
+    rte_rmb();
+    return count;
+}
+
+static inline ipaugenblick_cmd_t *ipaugenblick_cmd_ring_peek(ipaugenblick_cmd_ring_t *cmd_ring,uint32_t i)
+{
+    return &cmd_ring->records[(cmd_ring->tail + i) & (IPAUGENBLICK_CMD_RING_SIZE - 1)].cmd;
+}
+
+static inline void ipaugenblick_cmd_ring_release(ipaugenblick_cmd_ring_t *cmd_ring,uint32_t count)
+{
+    rte_mb();
+    cmd_ring->tail += count;
+}
+
+/* shared by the service and the app, each line is written mostly by one side for one direction,
+   so neither neighbour sockets nor the other direction bounce it between the processes */
 typedef struct
 {
     unsigned long connection_idx; /* to be aligned */
-    rte_atomic16_t  read_ready_to_app;
-    rte_atomic16_t  write_ready_to_app;
-    rte_atomic16_t  write_done_from_app
-}__attribute__((packed))ipaugenblick_socket_t;
+    rte_atomic32_t  tx_window;  /* tx buffers the app may hold for this socket: set by the app at open, by the service as it swaps tx rings */
+    int numa_socket; /* of the rings the service bound the connection to */
+    /* set by the service, cleared by the app */
+    rte_atomic16_t  read_ready_to_app __attribute__((aligned(64)));
+    rte_atomic16_t  write_ready_to_app __attribute__((aligned(64)));
+    /* set by the app, cleared by the service */
+    rte_atomic16_t  write_done_from_app __attribute__((aligned(64)));
+    /* rings the app moved to, after tx_ring_id/rx_ring_id changed */
+    rte_atomic32_t  tx_ring_ack;
+    rte_atomic32_t  rx_ring_ack;
+    /* up by the app per buffer allocated, down by the service per burst it takes off tx_ring */
+    rte_atomic32_t  tx_inflight __attribute__((aligned(64)));
+    /* shared rx, written per buffer by both sides, kept off the readiness flags */
+    rte_atomic32_t  shared_rx_queued __attribute__((aligned(64))); /* buffers on shared rings, up by the service, down by the app */
+    uint16_t shared_rx_gen; /* set by the service on close, buffers tagged with an older one are dropped */
+    /* chain the previous owner took off rx_ring or its shared ring and didn't read, the new owner reads it first */
+    void *handoff_rx;
+    int handoff_status; /* -errno set by the service refusing a handoff, cleared by the app taking the socket back */
+    /* set by the service before it reports SOCKET_SENDFILE_DONE_BIT */
+    int sendfile_status __attribute__((aligned(64))); /* 0 or -errno */
+    unsigned long sendfile_bytes; /* handed to TCP, less than asked for if the file is shorter or on error */
+    unsigned int tx_tstamp_dropped; /* tx timestamp reports the service could not queue, up by the service */
+    /* set by the service when it swaps the socket's rings, IPAUGENBLICK_HOME_RING or a big ring */
+    rte_atomic32_t  tx_ring_id;
+    rte_atomic32_t  rx_ring_id;
+}__attribute__((aligned(64)))ipaugenblick_socket_t;
 
 typedef struct
 {
     struct rte_ring  *ready_connections;
+    struct rte_ring  *shared_rx;
 }__attribute__((packed))ipaugenblick_selector_t;
 
+/* one per selector in SHARED_RX_STATE_NAME memzone. rx_ready_to_app is set by the service when
+   it notifies the selector, cleared by the app when it finds the shared ring empty */
+typedef struct
+{
+    rte_atomic16_t rx_ready_to_app;
+    rte_atomic32_t owner_pid; /* set by the app opening the selector, 0 - not open */
+}__attribute__((aligned(64)))ipaugenblick_shared_rx_state_t;
+
 #define COMMAND_POOL_SIZE 16384
-#define DATA_RINGS_SIZE 1024
+#define DATA_RINGS_SIZE 1024 /* each connection index's own rings */
+#define DATA_RINGS_SIZE_MAX 4096 /* big rings, lent to connections that need more */
+/* big rings per NUMA socket and direction, created by the service at init */
+#ifndef IPAUGENBLICK_BIG_RINGS_COUNT
+#define IPAUGENBLICK_BIG_RINGS_COUNT 64
+#endif
+#define IPAUGENBLICK_HOME_RING -1 /* ring id of the index's own ring, big rings are numbered from 0 */
 #define FREE_CONNECTIONS_POOL_NAME "free_connections_pool"
 #define FREE_CONNECTIONS_RING "free_connections_ring"
-#define COMMAND_RING_NAME "command_ring"
 #define FREE_COMMAND_POOL_NAME "free_command_pool"
 #define RX_RING_NAME_BASE "rx_ring"
 #define TX_RING_NAME_BASE "tx_ring"
+#define ERRQ_RING_NAME_BASE "errq_ring"
+#define ERRQ_RING_SIZE 256
+#define SHARED_RX_RING_NAME_BASE "shared_rx_ring"
+#define SHARED_RX_STATE_NAME "shared_rx_state"
+#define IPAUGENBLICK_SHARED_RX_RING_SIZE 16384
+#define IPAUGENBLICK_SHARED_RX_SOCKET_CAP 256 /* per socket, so one flow doesn't take the whole ring */
 #define ACCEPTED_RING_NAME "accepted_ring"
 #define FREE_ACCEPTED_POOL_NAME "free_accepted_pool"
 #define SELECTOR_POOL_NAME "selector_pool"
 #define SELECTOR_RING_NAME "selector_ring"
 #define IPAUGENBLICK_CONNECTION_POOL_SIZE 512
 #define IPAUGENBLICK_SELECTOR_POOL_SIZE 64
+#define SOCKETS_MEMZONE_NAME "ipaugenblick_sockets" /* holds the address of the ipaugenblick_socket_t array */
 #define COMMON_NOTIFICATIONS_POOL_NAME "common_notifications_pool_name"
 #define COMMON_NOTIFICATIONS_RING_NAME "common_notifications_ring_name"
 
 extern struct rte_mempool *free_command_pool;
 
+/* same as DPDK_MBUF_RX_TSC in dpdk_drv_iface.h: TSC the buffer was received (or spliced) at */
+#define IPAUGENBLICK_MBUF_RX_TSC(mbuf) (*(uint64_t *)((mbuf)->buf_addr))
+/* rx buffers on a shared ring carry their socket and its shared_rx_gen,
+   the NIC's hash is of no use past the stack */
+#define IPAUGENBLICK_MBUF_RX_SOCK(mbuf) ((mbuf)->pkt.hash.rss)
+#define IPAUGENBLICK_SHARED_RX_TAG(ringset_idx,gen) ((uint32_t)(ringset_idx)|((uint32_t)(gen) << 16))
+#define IPAUGENBLICK_SHARED_RX_TAG_SOCK(tag) ((tag) & 0xffff)
+#define IPAUGENBLICK_SHARED_RX_TAG_GEN(tag) ((uint16_t)((tag) >> 16))
+/* same as DPDK_MBUF_TX_TAG: non-zero asks for tx timestamp reports */
+#define IPAUGENBLICK_MBUF_TX_TAG(mbuf) (*(uint64_t *)((char *)(mbuf)->buf_addr + sizeof(uint64_t)))
+
+/* NUMA sockets having memory, 0 if the layout tells none */
+static inline uint32_t ipaugenblick_memory_numa_mask(void)
+{
+    const struct rte_memseg *memseg = rte_eal_get_physmem_layout();
+    uint32_t mask = 0;
+    int i;
+
+    for(i = 0;(i < RTE_MAX_MEMSEG)&&(memseg[i].addr);i++) {
+        if((memseg[i].socket_id >= 0)&&(memseg[i].socket_id < RTE_MAX_NUMA_NODES))
+            mask |= 1 << memseg[i].socket_id;
+    }
+    return mask;
+}
+
+/* a connection uses the rings of its index on its app's NUMA socket */
+static inline void ipaugenblick_ring_name(char *ringname,const char *base,int numa_socket,int ringset_idx)
+{
+    sprintf(ringname,"%s%d_%d",base,numa_socket,ringset_idx);
+}
+
+static inline void ipaugenblick_big_ring_name(char *ringname,const char *base,int numa_socket,int ring_id)
+{
+    sprintf(ringname,"%s_big%d_%d",base,numa_socket,ring_id);
+}
+
+/* created by whichever side binds the index on that NUMA socket first and kept for
+   the next connections, DPDK can't free a ring. NULL if there is no memory for it */
+static inline struct rte_ring *ipaugenblick_data_ring_get(const char *base,int numa_socket,int ringset_idx)
+{
+    char ringname[RTE_RING_NAMESIZE];
+    struct rte_ring *ring;
+
+    ipaugenblick_ring_name(ringname,base,numa_socket,ringset_idx);
+    ring = rte_ring_lookup(ringname);
+    if(!ring)
+        ring = rte_ring_create(ringname,DATA_RINGS_SIZE,numa_socket,RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if(!ring) /* the other side may have created it meanwhile */
+        ring = rte_ring_lookup(ringname);
+    return ring;
+}
+
 static inline ipaugenblick_cmd_t *ipaugenblick_get_free_command_buf()
 {
     ipaugenblick_cmd_t *cmd;
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_memcpy.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+#include "ipaugenblick_service/ipaugenblick_sendfile.h"
+
+extern void *get_buffer();
+
+uint64_t ipaugenblick_stats_sendfile_started = 0;
+uint64_t ipaugenblick_stats_sendfile_bytes = 0;
+uint64_t ipaugenblick_stats_sendfile_remaps = 0;
+uint64_t ipaugenblick_stats_sendfile_no_mbufs = 0;
+uint64_t ipaugenblick_stats_sendfile_errors = 0;
+
+static int ipaugenblick_sendfile_map_window(ipaugenblick_sendfile_t *sendfile)
+{
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    unsigned long aligned_offset = sendfile->offset & ~(page_size - 1);
+    unsigned long len = (sendfile->offset - aligned_offset) + sendfile->remaining;
+
+    if(sendfile->window)
+        munmap(sendfile->window,sendfile->window_len);
+    if(len > IPAUGENBLICK_SENDFILE_WINDOW_SIZE)
+        len = IPAUGENBLICK_SENDFILE_WINDOW_SIZE;
+    sendfile->window = mmap(NULL,len,PROT_READ,MAP_SHARED,sendfile->fd,aligned_offset);
+    if(sendfile->window == MAP_FAILED) {
+        printf("cannot map file %s %d\n",__FILE__,__LINE__);
+        sendfile->window = NULL;
+        sendfile->error = errno;
+        ipaugenblick_stats_sendfile_errors++;
+        return -1;
+    }
+    sendfile->window_offset = aligned_offset;
+    sendfile->window_len = len;
+    madvise(sendfile->window,len,MADV_SEQUENTIAL);
+    /* let the kernel read the next window while this one is sent */
+    if(sendfile->remaining > len - (sendfile->offset - aligned_offset))
+        posix_fadvise(sendfile->fd,aligned_offset + len,IPAUGENBLICK_SENDFILE_WINDOW_SIZE,POSIX_FADV_WILLNEED);
+    ipaugenblick_stats_sendfile_remaps++;
+    return 0;
+}
+
+int ipaugenblick_sendfile_open(ipaugenblick_sendfile_t *sendfile,unsigned long pid,int fd,
+                               unsigned long offset,unsigned long length)
+{
+    char path[64];
+    struct stat st;
+    int err;
+
+    memset(sendfile,0,sizeof(*sendfile));
+    sprintf(path,"/proc/%lu/fd/%d",pid,fd);
+    sendfile->fd = open(path,O_RDONLY);
+    if(sendfile->fd < 0) {
+        err = errno;
+        printf("cannot open %s %s %d\n",path,__FILE__,__LINE__);
+        ipaugenblick_stats_sendfile_errors++;
+        return -err;
+    }
+    if(fstat(sendfile->fd,&st)) {
+        err = errno;
+        close(sendfile->fd);
+        sendfile->fd = -1;
+        printf("cannot stat %s %s %d\n",path,__FILE__,__LINE__);
+        ipaugenblick_stats_sendfile_errors++;
+        return -err;
+    }
+    /* the mapping must not reach past the end of file, what is beyond is reported as not sent */
+    if(offset >= (unsigned long)st.st_size)
+        length = 0;
+    else if(length > (unsigned long)st.st_size - offset)
+        length = (unsigned long)st.st_size - offset;
+    posix_fadvise(sendfile->fd,offset,length,POSIX_FADV_SEQUENTIAL);
+    sendfile->offset = offset;
+    sendfile->remaining = length;
+    ipaugenblick_stats_sendfile_started++;
+    if(length == 0)
+        return 0;
+    if(ipaugenblick_sendfile_map_window(sendfile))
+        return -sendfile->error;
+    return 0;
+}
+
+struct rte_mbuf *ipaugenblick_sendfile_get_buffer(ipaugenblick_sendfile_t *sendfile)
+{
+    struct rte_mbuf *mbuf;
+    unsigned long len,in_window;
+
+    if(ipaugenblick_sendfile_done(sendfile))
+        return NULL;
+    if(sendfile->offset >= sendfile->window_offset + sendfile->window_len) {
+        if(ipaugenblick_sendfile_map_window(sendfile))
+            return NULL;
+    }
+    mbuf = get_buffer();
+    if(!mbuf) {
+        ipaugenblick_stats_sendfile_no_mbufs++;
+        return NULL;
+    }
+    /* never across the window's end, the rest goes in the next mbuf */
+    len = (sendfile->remaining < IPAUGENBLICK_SENDFILE_SEG_SIZE) ? sendfile->remaining : IPAUGENBLICK_SENDFILE_SEG_SIZE;
+    in_window = sendfile->window_offset + sendfile->window_len - sendfile->offset;
+    if(len > in_window)
+        len = in_window;
+    rte_memcpy(mbuf->pkt.data,sendfile->window + (sendfile->offset - sendfile->window_offset),len);
+    mbuf->pkt.data_len = len;
+    mbuf->pkt.pkt_len = len;
+    sendfile->offset += len;
+    sendfile->remaining -= len;
+    sendfile->sent += len;
+    ipaugenblick_stats_sendfile_bytes += len;
+    return mbuf;
+}
+
+void ipaugenblick_sendfile_close(ipaugenblick_sendfile_t *sendfile)
+{
+    if(sendfile->window)
+        munmap(sendfile->window,sendfile->window_len);
+    sendfile->window = NULL;
+    if(sendfile->fd >= 0)
+        close(sendfile->fd);
+    sendfile->fd = -1;
+}
@@ -0,0 +1,50 @@
+#ifndef __IPAUGENBLICK_SENDFILE_H__
+#define __IPAUGENBLICK_SENDFILE_H__
+
+/* File contents are copied from a sliding mmap window straight into mbufs
+   when TCP asks for the next buffer, so reading is paced by the send window.
+   The window following the current one is handed to the kernel's readahead */
+
+#define IPAUGENBLICK_SENDFILE_SEG_SIZE 1448
+#define IPAUGENBLICK_SENDFILE_WINDOW_SIZE (4*1024*1024)
+
+extern uint64_t ipaugenblick_stats_sendfile_started;
+extern uint64_t ipaugenblick_stats_sendfile_bytes;
+extern uint64_t ipaugenblick_stats_sendfile_remaps;
+extern uint64_t ipaugenblick_stats_sendfile_no_mbufs;
+extern uint64_t ipaugenblick_stats_sendfile_errors;
+
+typedef struct
+{
+    int fd;
+    unsigned long offset;    /* next byte to send */
+    unsigned long remaining;
+    unsigned long sent; /* handed to TCP */
+    char *window;
+    unsigned long window_offset; /* file offset the window is mapped at */
+    unsigned long window_len;
+    int error; /* errno */
+}ipaugenblick_sendfile_t;
+
+/* opens the app's file descriptor through /proc. Returns 0 on success, -errno otherwise.
+   length is cut to what the file holds past offset */
+int ipaugenblick_sendfile_open(ipaugenblick_sendfile_t *sendfile,unsigned long pid,int fd,
+                               unsigned long offset,unsigned long length);
+
+/* returns mbuf filled with the next chunk, NULL if done or out of mbufs */
+struct rte_mbuf *ipaugenblick_sendfile_get_buffer(ipaugenblick_sendfile_t *sendfile);
+
+void ipaugenblick_sendfile_close(ipaugenblick_sendfile_t *sendfile);
+
+static inline int ipaugenblick_sendfile_done(ipaugenblick_sendfile_t *sendfile)
+{
+    return (sendfile->remaining == 0)||(sendfile->error);
+}
+
+/* completion status reported to the app: 0 or -errno */
+static inline int ipaugenblick_sendfile_status(ipaugenblick_sendfile_t *sendfile)
+{
+    return -sendfile->error;
+}
+
+#endif
@@ -3,19 +3,128 @@
 #define __IPAUGENBLICK_SERVER_SIDE_H__
 //#include <sys/types.h>
 //#include <signal.h>
+#include <rte_memzone.h>
+#include <rte_cycles.h>
+#include "ipaugenblick_sendfile.h"
 #define PKTMBUF_HEADROOM 128
 #define IPAUGENBLICK_BUFSIZE (PKTMBUF_HEADROOM+1448)
 
+enum
+{
+    IPAUGENBLICK_SPLICE_NONE = 0,
+    IPAUGENBLICK_SPLICE_PENDING, /* local peer found, tx held until TCP is drained both ways */
+    IPAUGENBLICK_SPLICE_ACTIVE   /* tx_ring is moved to the peer's rx_ring, TCP is bypassed */
+};
+
+/* tagged buffers in flight per socket, awaiting SENT/ACKED reports */
+#define IPAUGENBLICK_TX_TSTAMP_PENDING 32
+
+typedef struct
+{
+    uint64_t tag;
+    uint32_t end_seq;
+    int port; /* where the driver staged the last segment carrying it, see dpdk_dev_tx_sent_tsc */
+    uint64_t seq;
+}ipaugenblick_tx_tstamp_pending_t;
+
+/* rings of a connection index on one NUMA socket, NULL until first placed there */
+typedef struct
+{
+    struct rte_ring *tx_ring;
+    struct rte_ring *rx_ring;
+}ipaugenblick_data_rings_t;
+
+/* big rings of one direction on one NUMA socket, see ipaugenblick_resize_socket_rings */
 typedef struct
+{
+    struct rte_ring *rings[IPAUGENBLICK_BIG_RINGS_COUNT];
+    int free[IPAUGENBLICK_BIG_RINGS_COUNT]; /* ids, a stack */
+    int free_count;
+}ipaugenblick_big_rings_t;
+
+#define IPAUGENBLICK_DEFAULT_RX_LOWAT 1
+#define IPAUGENBLICK_DEFAULT_TX_LOWAT 1
+
+typedef struct socket_satelite_data
 {
     struct socket *socket;
     int ringset_idx;
     int parent_idx;
     struct rte_ring *tx_ring;
     struct rte_ring *rx_ring;
+    ipaugenblick_sendfile_t *sendfile; /* NULL unless sendfile is in progress */
+    int sendfile_done_pending; /* completed before the socket was attached to a selector */
+    int rx_lowat; /* buffers queued to the app before it is told the socket is readable */
+    int rx_hiwat; /* buffers queued to the app before the service stops reading the connection */
+    int rx_hiwat_hit; /* stopped at rx_hiwat, reading resumes below rx_lowat */
+    int tx_lowat; /* free tx ring entries before it is told the socket is writable */
+    /* as the app set them, the above are clamped to the current rings, see ipaugenblick_clamp_watermarks */
+    int rx_lowat_req,rx_hiwat_req,tx_lowat_req;
+    uint64_t rx_max_delay; /* cycles a buffer may wait below rx_lowat, 0 - forever */
+    uint64_t rx_pending_since; /* tsc of the oldest buffer not signalled yet */
+    int rx_delay_queued;
+    int tx_credits_to_return; /* buffers taken off tx_ring, not yet credited back to the app */
+    int tx_owner; /* command ring of the app charged for the socket's tx buffers, -1 - none */
+    TAILQ_ENTRY(socket_satelite_data) rx_delay_entry;
+    struct socket_satelite_data *splice_peer; /* the other end, when it is a local app */
+    int splice_state;
+    int splice_queued;
+    uint64_t splice_pending_since; /* tsc the local peer was found at */
+    TAILQ_ENTRY(socket_satelite_data) splice_entry;
+    struct rte_ring *errq_ring; /* tx timestamp reports toward the app */
+    /* FIFO in sequence order: [tail,sent) sent and not ACKed,
+       [sent,queued) staged in the driver, SENT waits for the burst, [queued,head) not sent yet */
+    unsigned int tstamp_head,tstamp_queued,tstamp_sent,tstamp_tail;
+    int tstamp_queued_listed;
+    TAILQ_ENTRY(socket_satelite_data) tstamp_queued_entry;
+    ipaugenblick_tx_tstamp_pending_t tstamp_pending[IPAUGENBLICK_TX_TSTAMP_PENDING];
+    int tx_ring_id; /* of tx_ring/rx_ring, IPAUGENBLICK_HOME_RING or a big ring of the socket's NUMA socket */
+    int rx_ring_id;
+    /* tx ring swap: published to the app, taken from once the app acked it and tx_ring is empty */
+    struct rte_ring *tx_ring_next;
+    int tx_ring_next_id;
+    /* rx ring swap: rx_ring is filled already, this one goes back once the app drained it and acked rx_ring */
+    struct rte_ring *rx_ring_old;
+    int rx_ring_old_id;
+    int rx_ring_hit; /* rx_ring was full since last resize */
+    unsigned int rx_enqueued; /* buffers put to rx_ring, app's consumption rate is derived from it */
+    unsigned int rx_enqueued_last;
+    unsigned int rx_count_last;
+    struct rte_ring *shared_rx; /* selector's shared ring when the socket uses it, else NULL */
+    int shared_rx_blocked;
+    TAILQ_ENTRY(socket_satelite_data) shared_rx_entry;
+    /* handed off while buffers were on the old selector's shared ring, told once its app moved them */
+    int handoff_select; /* -1 - not pending */
+    uint64_t handoff_pending_since;
+    TAILQ_ENTRY(socket_satelite_data) handoff_entry;
 } socket_satelite_data_t;
 
-extern struct rte_ring *command_ring;
+TAILQ_HEAD(rx_delay_socket_list_head, socket_satelite_data);
+extern struct rx_delay_socket_list_head rx_delay_socket_list_head;
+TAILQ_HEAD(splice_pending_list_head, socket_satelite_data);
+extern struct splice_pending_list_head splice_pending_list_head;
+TAILQ_HEAD(shared_rx_blocked_list_head, socket_satelite_data);
+extern struct shared_rx_blocked_list_head shared_rx_blocked_list_head;
+TAILQ_HEAD(tx_tstamp_queued_list_head, socket_satelite_data);
+extern struct tx_tstamp_queued_list_head tx_tstamp_queued_list_head;
+TAILQ_HEAD(handoff_pending_list_head, socket_satelite_data);
+extern struct handoff_pending_list_head handoff_pending_list_head;
+extern ipaugenblick_shared_rx_state_t *ipaugenblick_shared_rx_state;
+extern uint64_t ipaugenblick_stats_shared_rx_bufs;
+extern uint64_t ipaugenblick_stats_shared_rx_blocked;
+extern uint64_t ipaugenblick_stats_splice_established;
+extern uint64_t ipaugenblick_stats_splice_bufs;
+extern uint64_t ipaugenblick_stats_tx_tstamp_reports;
+extern uint64_t ipaugenblick_stats_tx_tstamp_dropped;
+extern uint64_t ipaugenblick_stats_tx_tstamp_overflow;
+extern int dpdk_dev_last_tx_port;
+extern uint64_t dpdk_dev_last_tx_seq;
+extern int dpdk_dev_tx_sent_tsc(int port_num,uint64_t seq,uint64_t *tsc);
+extern int dpdk_dev_tx_pending(int port_num);
+extern ipaugenblick_big_rings_t ipaugenblick_big_rings[RTE_MAX_NUMA_NODES][2];
+extern int ipaugenblick_big_rings_in_use;
+
+extern ipaugenblick_cmd_ring_t *ipaugenblick_cmd_rings[IPAUGENBLICK_CMD_RINGS_COUNT];
 extern struct rte_ring *selectors_ring;
 extern struct rte_ring *free_connections_ring;
 extern struct rte_mempool *free_connections_pool;
@@ -27,6 +136,10 @@ extern ipaugenblick_socket_t *g_ipaugenblick_sockets;
 extern ipaugenblick_selector_t *g_ipaugenblick_selectors;
 extern uint64_t user_kick_select_tx;
 extern uint64_t user_kick_select_rx;
+extern uint32_t ipaugenblick_rings_numa_mask;
+extern ipaugenblick_data_rings_t ipaugenblick_data_rings[RTE_MAX_NUMA_NODES][IPAUGENBLICK_CONNECTION_POOL_SIZE];
+extern uint64_t ipaugenblick_stats_rings_placed[RTE_MAX_NUMA_NODES];
+extern uint64_t ipaugenblick_stats_rings_placement_fallback;
 
 #pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
 
@@ -39,16 +152,25 @@ static inline struct ipaugenblick_memory *ipaugenblick_service_api_init(int comm
     ipaugenblick_socket_t *ipaugenblick_socket;
     ipaugenblick_selector_t *ipaugenblick_selector;
 
-    memset(socket_satelite_data,0,sizeof(void *)*IPAUGENBLICK_CONNECTION_POOL_SIZE);
+    ipaugenblick_rings_numa_mask = ipaugenblick_memory_numa_mask();
+    if(!ipaugenblick_rings_numa_mask)
+        ipaugenblick_rings_numa_mask = 1 << rte_socket_id();
+    printf("CONNECTION RINGS NUMA MASK %x\n",ipaugenblick_rings_numa_mask);
 
-    sprintf(ringname,COMMAND_RING_NAME);
+    memset(socket_satelite_data,0,sizeof(void *)*IPAUGENBLICK_CONNECTION_POOL_SIZE);
 
-    command_ring = rte_ring_create(ringname, command_bufs_count,rte_socket_id(), RING_F_SC_DEQ);
-    if(!command_ring) {
-        printf("cannot create ring %s %d\n",__FILE__,__LINE__);
-        exit(0);
+    for(i = 0;i < IPAUGENBLICK_CMD_RINGS_COUNT;i++) {
+        const struct rte_memzone *mz;
+        sprintf(ringname,CMD_RING_NAME_BASE"%d",i);
+        mz = rte_memzone_reserve(ringname,sizeof(ipaugenblick_cmd_ring_t),rte_socket_id(),0);
+        if(!mz) {
+            printf("cannot create command ring %s %d\n",__FILE__,__LINE__);
+            exit(0);
+        }
+        ipaugenblick_cmd_rings[i] = (ipaugenblick_cmd_ring_t *)mz->addr;
+        memset(ipaugenblick_cmd_rings[i],0,sizeof(ipaugenblick_cmd_ring_t));
     }
-    printf("COMMAND RING CREATED\n");
+    printf("COMMAND RINGS CREATED\n");
     sprintf(ringname,"rx_mbufs_ring");
 
     rx_mbufs_ring = rte_ring_create(ringname, rx_bufs_count*IPAUGENBLICK_CONNECTION_POOL_SIZE,rte_socket_id(), 0);
@@ -91,6 +213,15 @@ static inline struct ipaugenblick_memory *ipaugenblick_service_api_init(int comm
     }
 
     ipaugenblick_socket = g_ipaugenblick_sockets;
+    /* apps adopting a handed off connection find its shared state by index */
+    {
+        const struct rte_memzone *mz = rte_memzone_reserve(SOCKETS_MEMZONE_NAME,sizeof(void *),rte_socket_id(),0);
+        if(!mz) {
+            printf("cannot create memzone %s %d\n",__FILE__,__LINE__);
+            exit(0);
+        }
+        *(ipaugenblick_socket_t **)mz->addr = g_ipaugenblick_sockets;
+    }
 
     free_connections_ring = rte_ring_create(FREE_CONNECTIONS_RING,IPAUGENBLICK_CONNECTION_POOL_SIZE,rte_socket_id(), 0);
     if(!free_connections_ring) {
@@ -106,24 +237,75 @@ static inline struct ipaugenblick_memory *ipaugenblick_service_api_init(int comm
         ipaugenblick_socket->connection_idx = ringset_idx;
         rte_atomic16_init(&ipaugenblick_socket->read_ready_to_app);
         rte_atomic16_init(&ipaugenblick_socket->write_ready_to_app);
+        rte_atomic32_init(&ipaugenblick_socket->tx_inflight);
+        rte_atomic32_init(&ipaugenblick_socket->tx_window);
         rte_ring_enqueue(free_connections_ring,(void*)ipaugenblick_socket);
-        sprintf(ringname,TX_RING_NAME_BASE"%d",ringset_idx);
-        socket_satelite_data[ringset_idx].tx_ring = rte_ring_create(ringname, tx_bufs_count,rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-        if(!socket_satelite_data[ringset_idx].tx_ring) {
+        /* tx/rx rings are created on the NUMA socket a connection asks for, when it does */
+        socket_satelite_data[ringset_idx].tx_ring = NULL;
+        socket_satelite_data[ringset_idx].rx_ring = NULL;
+        sprintf(ringname,ERRQ_RING_NAME_BASE"%d",ringset_idx);
+        socket_satelite_data[ringset_idx].errq_ring = rte_ring_create(ringname, ERRQ_RING_SIZE,rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if(!socket_satelite_data[ringset_idx].errq_ring) {
             printf("cannot create ring %s %d\n",__FILE__,__LINE__);
             exit(0);
         }
-        rte_ring_set_water_mark(socket_satelite_data[ringset_idx].tx_ring,/*tx_bufs_count/10*/1);
-        sprintf(ringname,RX_RING_NAME_BASE"%d",ringset_idx);
-        socket_satelite_data[ringset_idx].rx_ring = rte_ring_create(ringname, rx_bufs_count,rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-        if(!socket_satelite_data[ringset_idx].rx_ring) {
-            printf("cannot create ring %s %d\n",__FILE__,__LINE__);
-            exit(0);
-        }
-        rte_ring_set_water_mark(socket_satelite_data[ringset_idx].rx_ring,/*rx_bufs_count/10*/1);
+        socket_satelite_data[ringset_idx].tstamp_head = 0;
+        socket_satelite_data[ringset_idx].tstamp_queued = 0;
+        socket_satelite_data[ringset_idx].tstamp_queued_listed = 0;
+        socket_satelite_data[ringset_idx].tstamp_sent = 0;
+        socket_satelite_data[ringset_idx].tstamp_tail = 0;
         socket_satelite_data[ringset_idx].ringset_idx = -1;
         socket_satelite_data[ringset_idx].parent_idx = -1;
         socket_satelite_data[ringset_idx].socket = NULL;
+        socket_satelite_data[ringset_idx].sendfile = NULL;
+        socket_satelite_data[ringset_idx].rx_lowat = IPAUGENBLICK_DEFAULT_RX_LOWAT;
+        socket_satelite_data[ringset_idx].rx_hiwat = DATA_RINGS_SIZE - 1;
+        socket_satelite_data[ringset_idx].rx_hiwat_hit = 0;
+        socket_satelite_data[ringset_idx].tx_lowat = IPAUGENBLICK_DEFAULT_TX_LOWAT;
+        socket_satelite_data[ringset_idx].rx_lowat_req = IPAUGENBLICK_DEFAULT_RX_LOWAT;
+        socket_satelite_data[ringset_idx].rx_hiwat_req = 0;
+        socket_satelite_data[ringset_idx].tx_lowat_req = IPAUGENBLICK_DEFAULT_TX_LOWAT;
+        socket_satelite_data[ringset_idx].rx_max_delay = 0;
+        socket_satelite_data[ringset_idx].rx_pending_since = 0;
+        socket_satelite_data[ringset_idx].rx_delay_queued = 0;
+        socket_satelite_data[ringset_idx].tx_credits_to_return = 0;
+        socket_satelite_data[ringset_idx].tx_owner = -1;
+        socket_satelite_data[ringset_idx].splice_peer = NULL;
+        socket_satelite_data[ringset_idx].splice_state = IPAUGENBLICK_SPLICE_NONE;
+        socket_satelite_data[ringset_idx].splice_queued = 0;
+        socket_satelite_data[ringset_idx].tx_ring_id = IPAUGENBLICK_HOME_RING;
+        socket_satelite_data[ringset_idx].rx_ring_id = IPAUGENBLICK_HOME_RING;
+        socket_satelite_data[ringset_idx].tx_ring_next = NULL;
+        socket_satelite_data[ringset_idx].rx_ring_old = NULL;
+        socket_satelite_data[ringset_idx].shared_rx = NULL;
+        socket_satelite_data[ringset_idx].shared_rx_blocked = 0;
+        socket_satelite_data[ringset_idx].handoff_select = -1;
+    }
+    TAILQ_INIT(&shared_rx_blocked_list_head);
+    TAILQ_INIT(&handoff_pending_list_head);
+    TAILQ_INIT(&tx_tstamp_queued_list_head);
+    TAILQ_INIT(&splice_pending_list_head);
+    TAILQ_INIT(&rx_delay_socket_list_head);
+    /* rings can't be freed, so the big ones are made once, what fits is the pool */
+    for(i = 0;i < RTE_MAX_NUMA_NODES;i++) {
+        int dir,ring_id;
+        ipaugenblick_big_rings_t *pool;
+
+        if(!(ipaugenblick_rings_numa_mask & (1 << i)))
+            continue;
+        for(dir = 0;dir < 2;dir++) {
+            pool = &ipaugenblick_big_rings[i][dir];
+            for(ring_id = 0;ring_id < IPAUGENBLICK_BIG_RINGS_COUNT;ring_id++) {
+                ipaugenblick_big_ring_name(ringname,dir ? RX_RING_NAME_BASE : TX_RING_NAME_BASE,i,ring_id);
+                pool->rings[ring_id] = rte_ring_create(ringname,DATA_RINGS_SIZE_MAX,i,RING_F_SP_ENQ | RING_F_SC_DEQ);
+                if(!pool->rings[ring_id]) {
+                    printf("cannot create ring %s %s %d\n",ringname,__FILE__,__LINE__);
+                    break;
+                }
+                pool->free[pool->free_count++] = ring_id;
+            }
+        }
+        printf("BIG RINGS ON SOCKET %d tx %d rx %d\n",i,ipaugenblick_big_rings[i][0].free_count,ipaugenblick_big_rings[i][1].free_count);
     }
     printf("CONNECTIONS Tx/Rx RINGS CREATED\n");
     
@@ -158,21 +340,195 @@ static inline struct ipaugenblick_memory *ipaugenblick_service_api_init(int comm
             printf("cannot create ring %s %d\n",__FILE__,__LINE__);
             exit(0);
         }
+        sprintf(ringname,SHARED_RX_RING_NAME_BASE"%d",ringset_idx);
+        ipaugenblick_selector[ringset_idx].shared_rx = rte_ring_create(ringname, IPAUGENBLICK_SHARED_RX_RING_SIZE,rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if(!ipaugenblick_selector[ringset_idx].shared_rx) {
+            printf("cannot create ring %s %d\n",__FILE__,__LINE__);
+            exit(0);
+        }
         printf("SELECTOR READY RING#%d CREATED\n",ringset_idx);
         rte_ring_enqueue(selectors_ring,(void*)ringset_idx);
     } 
+    {
+        const struct rte_memzone *mz = rte_memzone_reserve(SHARED_RX_STATE_NAME,
+                                                           sizeof(ipaugenblick_shared_rx_state_t)*IPAUGENBLICK_SELECTOR_POOL_SIZE,
+                                                           rte_socket_id(),0);
+        if(!mz) {
+            printf("cannot create memzone %s %d\n",__FILE__,__LINE__);
+            exit(0);
+        }
+        ipaugenblick_shared_rx_state = (ipaugenblick_shared_rx_state_t *)mz->addr;
+        memset(ipaugenblick_shared_rx_state,0,mz->len);
+    }
     printf("DONE\n");
     return 0;
 }
-static inline ipaugenblick_cmd_t *ipaugenblick_dequeue_command_buf()
+
+/* a mark the rings can't reach would never fire: readable within rx_hiwat,
+   rx_hiwat within the rx ring, writable within the tx ring, the socket's window and the app's budget */
+static inline void ipaugenblick_clamp_watermarks(socket_satelite_data_t *socket_satelite_data)
 {
-    ipaugenblick_cmd_t *cmd;
-    if(!rte_ring_count(command_ring))
-        return NULL;
-    if(rte_ring_sc_dequeue_bulk(command_ring,(void **)&cmd,1)) {
+    int rx_cap,tx_cap,tx_ring_id,window;
+
+    rx_cap = (socket_satelite_data->rx_ring_id == IPAUGENBLICK_HOME_RING) ? DATA_RINGS_SIZE - 1 : DATA_RINGS_SIZE_MAX - 1;
+    tx_ring_id = socket_satelite_data->tx_ring_next ? socket_satelite_data->tx_ring_next_id : socket_satelite_data->tx_ring_id;
+    tx_cap = (tx_ring_id == IPAUGENBLICK_HOME_RING) ? DATA_RINGS_SIZE - 1 : DATA_RINGS_SIZE_MAX - 1;
+    window = rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_window);
+    if((window > 0)&&(window < tx_cap))
+        tx_cap = window;
+    if((socket_satelite_data->tx_owner >= 0)&&(ipaugenblick_cmd_rings[socket_satelite_data->tx_owner]->tx_budget < tx_cap))
+        tx_cap = ipaugenblick_cmd_rings[socket_satelite_data->tx_owner]->tx_budget;
+
+    socket_satelite_data->rx_hiwat = ((socket_satelite_data->rx_hiwat_req > 0)&&(socket_satelite_data->rx_hiwat_req < rx_cap)) ?
+                                     socket_satelite_data->rx_hiwat_req : rx_cap;
+    socket_satelite_data->rx_lowat = (socket_satelite_data->rx_lowat_req < socket_satelite_data->rx_hiwat) ?
+                                     socket_satelite_data->rx_lowat_req : socket_satelite_data->rx_hiwat;
+    socket_satelite_data->tx_lowat = (socket_satelite_data->tx_lowat_req < tx_cap) ? socket_satelite_data->tx_lowat_req : tx_cap;
+    if(socket_satelite_data->tx_lowat < 1)
+        socket_satelite_data->tx_lowat = 1;
+}
+
+/* binds the connection to the rings on the app's socket,
+   the lowest socket having memory if the app's one has none */
+static inline int ipaugenblick_place_socket_rings(socket_satelite_data_t *socket_satelite_data,int numa_socket)
+{
+    ipaugenblick_data_rings_t *rings;
+
+    if((numa_socket < 0)||(numa_socket >= RTE_MAX_NUMA_NODES)||
+       (!(ipaugenblick_rings_numa_mask & (1 << numa_socket)))) {
+        numa_socket = __builtin_ctz(ipaugenblick_rings_numa_mask);
+        ipaugenblick_stats_rings_placement_fallback++;
+    }
+    rings = &ipaugenblick_data_rings[numa_socket][socket_satelite_data->ringset_idx];
+    if(!rings->tx_ring)
+        rings->tx_ring = ipaugenblick_data_ring_get(TX_RING_NAME_BASE,numa_socket,socket_satelite_data->ringset_idx);
+    if(!rings->rx_ring)
+        rings->rx_ring = ipaugenblick_data_ring_get(RX_RING_NAME_BASE,numa_socket,socket_satelite_data->ringset_idx);
+    if((!rings->tx_ring)||(!rings->rx_ring)) {
+        printf("cannot create rings %s %d\n",__FILE__,__LINE__);
+        return -1;
+    }
+    socket_satelite_data->tx_ring = rings->tx_ring;
+    socket_satelite_data->rx_ring = rings->rx_ring;
+    socket_satelite_data->tx_ring_id = IPAUGENBLICK_HOME_RING;
+    socket_satelite_data->rx_ring_id = IPAUGENBLICK_HOME_RING;
+    /* the app bound the home rings before it sent the command */
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_ring_id,IPAUGENBLICK_HOME_RING);
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].rx_ring_id,IPAUGENBLICK_HOME_RING);
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_ring_ack,IPAUGENBLICK_HOME_RING);
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].rx_ring_ack,IPAUGENBLICK_HOME_RING);
+    ipaugenblick_stats_rings_placed[numa_socket]++;
+    g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].numa_socket = numa_socket;
+    socket_satelite_data->rx_ring_hit = 0;
+    socket_satelite_data->rx_enqueued = 0;
+    socket_satelite_data->rx_enqueued_last = 0;
+    socket_satelite_data->rx_count_last = rte_ring_count(socket_satelite_data->rx_ring);
+    ipaugenblick_clamp_watermarks(socket_satelite_data);
+    return 0;
+}
+
+/* NULL if the pool is empty */
+static inline struct rte_ring *ipaugenblick_get_big_ring(int numa_socket,int dir,int *ring_id)
+{
+    ipaugenblick_big_rings_t *pool = &ipaugenblick_big_rings[numa_socket][dir];
+
+    if(!pool->free_count)
         return NULL;
+    *ring_id = pool->free[--pool->free_count];
+    ipaugenblick_big_rings_in_use++;
+    return pool->rings[*ring_id];
+}
+
+/* home rings stay with the index, big ones go back to the pool empty */
+static inline void ipaugenblick_put_ring(int numa_socket,int dir,int ring_id,struct rte_ring *ring)
+{
+    struct rte_mbuf *mbuf;
+
+    if(ring_id == IPAUGENBLICK_HOME_RING)
+        return;
+    while(!rte_ring_sc_dequeue(ring,(void **)&mbuf))
+        rte_pktmbuf_free(mbuf);
+    ipaugenblick_big_rings[numa_socket][dir].free[ipaugenblick_big_rings[numa_socket][dir].free_count++] = ring_id;
+    ipaugenblick_big_rings_in_use--;
+}
+
+/* the app acked tx_ring_next, so it won't enqueue to tx_ring any more. Once that is drained
+   the service takes from the new one. Returns non-zero if it moved */
+static inline int ipaugenblick_tx_ring_advance(socket_satelite_data_t *socket_satelite_data)
+{
+    if(!socket_satelite_data->tx_ring_next)
+        return 0;
+    if(rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_ring_ack) != socket_satelite_data->tx_ring_next_id)
+        return 0;
+    /* the app's last enqueues to tx_ring are seen before its ack */
+    rte_rmb();
+    if(rte_ring_count(socket_satelite_data->tx_ring))
+        return 0;
+    ipaugenblick_put_ring(g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].numa_socket,0,
+                          socket_satelite_data->tx_ring_id,socket_satelite_data->tx_ring);
+    socket_satelite_data->tx_ring = socket_satelite_data->tx_ring_next;
+    socket_satelite_data->tx_ring_id = socket_satelite_data->tx_ring_next_id;
+    socket_satelite_data->tx_ring_next = NULL;
+    return 1;
+}
+
+/* the app drained rx_ring_old and moved to rx_ring */
+static inline void ipaugenblick_rx_ring_release_old(socket_satelite_data_t *socket_satelite_data)
+{
+    if(!socket_satelite_data->rx_ring_old)
+        return;
+    if(rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].rx_ring_ack) != socket_satelite_data->rx_ring_id)
+        return;
+    ipaugenblick_put_ring(g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].numa_socket,1,
+                          socket_satelite_data->rx_ring_old_id,socket_satelite_data->rx_ring_old);
+    socket_satelite_data->rx_ring_old = NULL;
+}
+
+/* the app moves to the new tx ring on its next enqueue and acks it,
+   the window follows the ring so the app never holds more than it can queue */
+static inline void ipaugenblick_swap_tx_ring(socket_satelite_data_t *socket_satelite_data,struct rte_ring *ring,int ring_id)
+{
+    socket_satelite_data->tx_ring_next = ring;
+    socket_satelite_data->tx_ring_next_id = ring_id;
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_window,
+                     (ring_id == IPAUGENBLICK_HOME_RING) ? DATA_RINGS_SIZE - 1 : DATA_RINGS_SIZE_MAX - 1);
+    ipaugenblick_clamp_watermarks(socket_satelite_data);
+    rte_wmb();
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_ring_id,ring_id);
+}
+
+/* the service fills the new rx ring from now on,
+   the app moves to it once it finds the old one empty and acks it */
+static inline void ipaugenblick_swap_rx_ring(socket_satelite_data_t *socket_satelite_data,struct rte_ring *ring,int ring_id)
+{
+    socket_satelite_data->rx_ring_old = socket_satelite_data->rx_ring;
+    socket_satelite_data->rx_ring_old_id = socket_satelite_data->rx_ring_id;
+    socket_satelite_data->rx_ring = ring;
+    socket_satelite_data->rx_ring_id = ring_id;
+    ipaugenblick_clamp_watermarks(socket_satelite_data);
+    /* what was put to the old ring is seen before the new id */
+    rte_wmb();
+    rte_atomic32_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].rx_ring_id,ring_id);
+}
+
+/* the connection is closed, big rings go back to the pool.
+   What is left on them is dropped, tx is drained by then */
+static inline void ipaugenblick_release_socket_rings(socket_satelite_data_t *socket_satelite_data)
+{
+    int numa_socket = g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].numa_socket;
+
+    if(socket_satelite_data->tx_ring_next) {
+        ipaugenblick_put_ring(numa_socket,0,socket_satelite_data->tx_ring_next_id,socket_satelite_data->tx_ring_next);
+        socket_satelite_data->tx_ring_next = NULL;
+    }
+    if(socket_satelite_data->rx_ring_old) {
+        ipaugenblick_put_ring(numa_socket,1,socket_satelite_data->rx_ring_old_id,socket_satelite_data->rx_ring_old);
+        socket_satelite_data->rx_ring_old = NULL;
     }
-    return cmd;
+    ipaugenblick_put_ring(numa_socket,0,socket_satelite_data->tx_ring_id,socket_satelite_data->tx_ring);
+    ipaugenblick_put_ring(numa_socket,1,socket_satelite_data->rx_ring_id,socket_satelite_data->rx_ring);
+    socket_satelite_data->tx_ring_id = IPAUGENBLICK_HOME_RING;
+    socket_satelite_data->rx_ring_id = IPAUGENBLICK_HOME_RING;
 }
 
 static inline void ipaugenblick_free_command_buf(ipaugenblick_cmd_t *cmd)
@@ -190,6 +546,8 @@ static inline void ipaugenblick_mark_readable(void *descriptor)
         printf("%s %d\n",__FILE__,__LINE__);
         return;
     }
+    /* signalled now or still signalled, the delay starts over either way */
+    socket_satelite_data->rx_pending_since = 0;
 #if 1
     if(!rte_atomic16_test_and_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].read_ready_to_app)) {
 //        if(app_pid)
@@ -223,41 +581,271 @@ static inline struct rte_mbuf *ipaugenblick_dequeue_tx_buf(void *descriptor)
     if(rte_ring_sc_dequeue_bulk(socket_satelite_data->tx_ring,(void **)&mbuf,1)) { 
         return NULL;
     }
+    socket_satelite_data->tx_credits_to_return++;
     return mbuf;
 }
 
 static inline int ipaugenblick_dequeue_tx_buf_burst(void *descriptor,struct rte_mbuf **mbufs,int max_count)
 {
+    int dequeued;
     socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor; 
-    return rte_ring_sc_dequeue_burst(socket_satelite_data->tx_ring,(void **)mbufs,max_count);
+    dequeued = rte_ring_sc_dequeue_burst(socket_satelite_data->tx_ring,(void **)mbufs,max_count);
+    socket_satelite_data->tx_credits_to_return += dequeued;
+    return dequeued;
+}
+
+/* once the stack owns the buffers, they are bounded by the socket's send buffer,
+   so the app gets the credits back, to the socket and to its budget.
+   Called once per tx opportunity, not per buffer */
+static inline void ipaugenblick_return_tx_credits(void *descriptor)
+{
+    socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+    if(!socket_satelite_data->tx_credits_to_return)
+        return;
+    rte_atomic32_sub(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_inflight,
+                     socket_satelite_data->tx_credits_to_return);
+    if(socket_satelite_data->tx_owner >= 0)
+        rte_atomic32_sub(&ipaugenblick_cmd_rings[socket_satelite_data->tx_owner]->tx_inflight,
+                         socket_satelite_data->tx_credits_to_return);
+    socket_satelite_data->tx_credits_to_return = 0;
+}
+
+/* buffers the app may allocate for the socket now: within the socket's window,
+   within the app's budget and within the ring */
+static inline int ipaugenblick_tx_space(socket_satelite_data_t *socket_satelite_data)
+{
+    ipaugenblick_cmd_ring_t *owner;
+    struct rte_ring *tx_ring;
+    int space,app_space;
+
+    space = rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_window) -
+            rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_inflight);
+    if(socket_satelite_data->tx_owner >= 0) {
+        owner = ipaugenblick_cmd_rings[socket_satelite_data->tx_owner];
+        app_space = owner->tx_budget - rte_atomic32_read(&owner->tx_inflight);
+        if(app_space < space)
+            space = app_space;
+    }
+    tx_ring = socket_satelite_data->tx_ring_next ? socket_satelite_data->tx_ring_next : socket_satelite_data->tx_ring;
+    if((int)rte_ring_free_count(tx_ring) < space)
+        space = rte_ring_free_count(tx_ring);
+    return space;
+}
+
+/* the app whose command opened or adopted the socket is charged for what is outstanding on it */
+static inline void ipaugenblick_charge_tx_owner(socket_satelite_data_t *socket_satelite_data,int cmd_ring_idx)
+{
+    socket_satelite_data->tx_owner = cmd_ring_idx;
+    rte_atomic32_add(&ipaugenblick_cmd_rings[cmd_ring_idx]->tx_inflight,
+                     rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_inflight));
+}
+
+/* the socket leaves its app (closed or handed off), whatever is outstanding on it is written off the app's budget */
+static inline void ipaugenblick_release_tx_owner(socket_satelite_data_t *socket_satelite_data)
+{
+    ipaugenblick_return_tx_credits(socket_satelite_data);
+    if(socket_satelite_data->tx_owner >= 0)
+        rte_atomic32_sub(&ipaugenblick_cmd_rings[socket_satelite_data->tx_owner]->tx_inflight,
+                         rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_inflight));
+    socket_satelite_data->tx_owner = -1;
+}
+
+/* the connection is closed, what the app queued and TCP didn't take is dropped.
+   The app may have enqueued to both rings of a pending swap */
+static inline void ipaugenblick_drain_tx_ring(socket_satelite_data_t *socket_satelite_data)
+{
+    struct rte_mbuf *mbuf;
+    struct rte_ring *tx_ring;
+
+    if(!socket_satelite_data->tx_ring)
+        return;
+    while((mbuf = ipaugenblick_dequeue_tx_buf(socket_satelite_data)) != NULL)
+        rte_pktmbuf_free(mbuf);
+    if(!socket_satelite_data->tx_ring_next)
+        return;
+    tx_ring = socket_satelite_data->tx_ring;
+    socket_satelite_data->tx_ring = socket_satelite_data->tx_ring_next;
+    while((mbuf = ipaugenblick_dequeue_tx_buf(socket_satelite_data)) != NULL)
+        rte_pktmbuf_free(mbuf);
+    socket_satelite_data->tx_ring = tx_ring;
 }
 
 static inline int ipaugenblick_tx_buf_count(void *descriptor)
 {
     socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+    int count;
+
     rte_atomic16_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].write_done_from_app,0);
-    return rte_ring_count(socket_satelite_data->tx_ring);
+    count = rte_ring_count(socket_satelite_data->tx_ring);
+    if(unlikely((!count)&&(ipaugenblick_tx_ring_advance(socket_satelite_data))))
+        count = rte_ring_count(socket_satelite_data->tx_ring);
+    return count;
 }
 
+/* room left in the socket's rx ring, under rx_hiwat when the app set one.
+   On a shared ring, room left under the socket's cap */
 static inline int ipaugenblick_rx_buf_free_count(void *descriptor)
 { 
     socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
-    return rte_ring_free_count(socket_satelite_data->rx_ring);
+    int count,queued;
+
+    if(socket_satelite_data->shared_rx) {
+        int ring_free = rte_ring_free_count(socket_satelite_data->shared_rx);
+        count = IPAUGENBLICK_SHARED_RX_SOCKET_CAP - 
+                rte_atomic32_read(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].shared_rx_queued);
+        if(count <= 0)
+            return 0;
+        return (count > ring_free) ? ring_free : count;
+    }
+    count = rte_ring_free_count(socket_satelite_data->rx_ring);
+    if(!count)
+        socket_satelite_data->rx_ring_hit = 1;
+    if(socket_satelite_data->rx_hiwat_req <= 0)
+        return count;
+    /* hysteresis: once rx_hiwat is queued, TCP holds the rest until the app drained below rx_lowat */
+    queued = rte_ring_count(socket_satelite_data->rx_ring);
+    if(socket_satelite_data->rx_hiwat_hit) {
+        if(queued >= socket_satelite_data->rx_lowat)
+            return 0;
+        socket_satelite_data->rx_hiwat_hit = 0;
+    }
+    if(queued >= socket_satelite_data->rx_hiwat) {
+        socket_satelite_data->rx_hiwat_hit = 1;
+        return 0;
+    }
+    return (count > socket_satelite_data->rx_hiwat - queued) ? socket_satelite_data->rx_hiwat - queued : count;
 }
 
+/* buffers of many sockets go on one ring, the selector is told once until the app finds it empty */
+static inline int ipaugenblick_submit_shared_rx_buf(struct rte_mbuf *mbuf,socket_satelite_data_t *socket_satelite_data)
+{
+    uint32_t ringidx_ready_mask;
+
+    IPAUGENBLICK_MBUF_RX_SOCK(mbuf) = IPAUGENBLICK_SHARED_RX_TAG(socket_satelite_data->ringset_idx,
+                                                                 g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].shared_rx_gen);
+    if(rte_ring_sp_enqueue_bulk(socket_satelite_data->shared_rx,(void **)&mbuf,1) == -ENOBUFS)
+        return 1;
+    rte_atomic32_inc(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].shared_rx_queued);
+    socket_satelite_data->rx_enqueued++;
+    ipaugenblick_stats_shared_rx_bufs++;
+    if(!rte_atomic16_test_and_set(&ipaugenblick_shared_rx_state[socket_satelite_data->parent_idx].rx_ready_to_app))
+        return 0;
+    ringidx_ready_mask = socket_satelite_data->parent_idx|(SOCKET_SHARED_RX_BIT << SOCKET_READY_SHIFT);
+    rte_ring_enqueue(g_ipaugenblick_selectors[socket_satelite_data->parent_idx].ready_connections,(void *)ringidx_ready_mask);
+    user_kick_select_rx++;
+    return 0;
+}
+
+/* out of room on the shared ring or over the cap, retried from the main loop */
+static inline void ipaugenblick_shared_rx_block(socket_satelite_data_t *socket_satelite_data)
+{
+    if(!socket_satelite_data->shared_rx_blocked) {
+        ipaugenblick_stats_shared_rx_blocked++;
+        TAILQ_INSERT_TAIL(&shared_rx_blocked_list_head,socket_satelite_data,shared_rx_entry);
+        socket_satelite_data->shared_rx_blocked = 1;
+    }
+}
+
+static inline void ipaugenblick_shared_rx_unblock(socket_satelite_data_t *socket_satelite_data)
+{
+    if(socket_satelite_data->shared_rx_blocked) {
+        TAILQ_REMOVE(&shared_rx_blocked_list_head,socket_satelite_data,shared_rx_entry);
+        socket_satelite_data->shared_rx_blocked = 0;
+    }
+}
+
+static inline void ipaugenblick_rx_delay_cancel(socket_satelite_data_t *socket_satelite_data)
+{
+    if(socket_satelite_data->rx_delay_queued) {
+        TAILQ_REMOVE(&rx_delay_socket_list_head,socket_satelite_data,rx_delay_entry);
+        socket_satelite_data->rx_delay_queued = 0;
+    }
+}
+
+/* readable is signalled once rx_lowat buffers are queued or the oldest one waited rx_max_delay.
+   The app re-arms it by reading, so a streaming receiver is woken per batch, not per buffer */
 static inline int ipaugenblick_submit_rx_buf(struct rte_mbuf *mbuf,void *descriptor)
 {
-    uint32_t ringidx_ready_mask; 
     int rc;
     socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+    if(socket_satelite_data->shared_rx)
+        return ipaugenblick_submit_shared_rx_buf(mbuf,socket_satelite_data);
     rc = rte_ring_sp_enqueue_bulk(socket_satelite_data->rx_ring,(void *)&mbuf,1);
-     
-    if(rc != 0)
+    socket_satelite_data->rx_enqueued += (rc != -ENOBUFS);
+
+    if((rc == -ENOBUFS)||(rte_ring_count(socket_satelite_data->rx_ring) >= socket_satelite_data->rx_lowat)) {
+        ipaugenblick_rx_delay_cancel(socket_satelite_data);
         ipaugenblick_mark_readable(descriptor);
+    }
+    else if(!socket_satelite_data->rx_pending_since) {
+        socket_satelite_data->rx_pending_since = rte_rdtsc();
+        if((socket_satelite_data->rx_max_delay)&&(!socket_satelite_data->rx_delay_queued)) {
+            TAILQ_INSERT_TAIL(&rx_delay_socket_list_head,socket_satelite_data,rx_delay_entry);
+            socket_satelite_data->rx_delay_queued = 1;
+        }
+    }
     
     return (rc == -ENOBUFS);
 }
 
+/* signals whatever is queued regardless of rx_lowat (max delay expired, connection is going down) */
+static inline void ipaugenblick_flush_readable(void *descriptor)
+{
+    socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+    if(socket_satelite_data->shared_rx)
+        return;
+    ipaugenblick_rx_delay_cancel(socket_satelite_data);
+    socket_satelite_data->rx_pending_since = 0;
+    if(rte_ring_count(socket_satelite_data->rx_ring) > 0)
+        ipaugenblick_mark_readable(descriptor);
+}
+
+static inline void ipaugenblick_rx_delay_expire(uint64_t now)
+{
+    socket_satelite_data_t *socket_satelite_data,*next;
+
+    for(socket_satelite_data = TAILQ_FIRST(&rx_delay_socket_list_head);socket_satelite_data;socket_satelite_data = next) {
+        next = TAILQ_NEXT(socket_satelite_data,rx_delay_entry);
+        if((socket_satelite_data->rx_pending_since)&&
+           (now - socket_satelite_data->rx_pending_since < socket_satelite_data->rx_max_delay))
+            continue;
+        ipaugenblick_flush_readable(socket_satelite_data);
+    }
+}
+
+/* cycles until the first rx_max_delay expires, 0 if one is due, ~0 if none is pending */
+static inline uint64_t ipaugenblick_rx_delay_next(uint64_t now)
+{
+    socket_satelite_data_t *socket_satelite_data;
+    uint64_t next = ~0ULL,waited;
+
+    TAILQ_FOREACH(socket_satelite_data,&rx_delay_socket_list_head,rx_delay_entry) {
+        if(!socket_satelite_data->rx_pending_since)
+            continue;
+        waited = now - socket_satelite_data->rx_pending_since;
+        if(waited >= socket_satelite_data->rx_max_delay)
+            return 0;
+        if(socket_satelite_data->rx_max_delay - waited < next)
+            next = socket_satelite_data->rx_max_delay - waited;
+    }
+    return next;
+}
+
+static inline void ipaugenblick_reset_watermarks(socket_satelite_data_t *socket_satelite_data)
+{
+    ipaugenblick_rx_delay_cancel(socket_satelite_data);
+    socket_satelite_data->rx_lowat = IPAUGENBLICK_DEFAULT_RX_LOWAT;
+    socket_satelite_data->rx_hiwat = DATA_RINGS_SIZE - 1;
+    socket_satelite_data->rx_hiwat_hit = 0;
+    socket_satelite_data->tx_lowat = IPAUGENBLICK_DEFAULT_TX_LOWAT;
+    socket_satelite_data->rx_lowat_req = IPAUGENBLICK_DEFAULT_RX_LOWAT;
+    socket_satelite_data->rx_hiwat_req = 0;
+    socket_satelite_data->tx_lowat_req = IPAUGENBLICK_DEFAULT_TX_LOWAT;
+    socket_satelite_data->rx_max_delay = 0;
+    socket_satelite_data->rx_pending_since = 0;
+    socket_satelite_data->tx_credits_to_return = 0;
+}
+
 static inline int ipaugenblick_mark_writable(void *descriptor)
 {
     uint32_t ringidx_ready_mask;
@@ -266,8 +854,12 @@ static inline int ipaugenblick_mark_writable(void *descriptor)
     if(socket_satelite_data->parent_idx == -1) {
         return 1;
     }
+    /* the app may enqueue as many as it has credits for, next tx opportunity will try again */
+    if(ipaugenblick_tx_space(socket_satelite_data) < socket_satelite_data->tx_lowat) {
+        return 0;
+    }
     if(!rte_atomic16_test_and_set(&g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].write_ready_to_app)) {
-        return;
+        return 0;
     }
     ringidx_ready_mask = socket_satelite_data->ringset_idx|(SOCKET_WRITABLE_BIT << SOCKET_READY_SHIFT);
     rc = rte_ring_enqueue(g_ipaugenblick_selectors[socket_satelite_data->parent_idx].ready_connections,(void *)ringidx_ready_mask);
@@ -277,6 +869,201 @@ static inline int ipaugenblick_mark_writable(void *descriptor)
     return (rc == -ENOBUFS);
 }
 
+static inline void ipaugenblick_mark_handoff(socket_satelite_data_t *socket_satelite_data)
+{
+    uint32_t ringidx_ready_mask;
+
+    ringidx_ready_mask = socket_satelite_data->ringset_idx|(SOCKET_HANDOFF_BIT << SOCKET_READY_SHIFT);
+    rte_ring_enqueue(g_ipaugenblick_selectors[socket_satelite_data->parent_idx].ready_connections,(void *)ringidx_ready_mask);
+}
+
+/* the result is in the shared socket, the selector is told once there is one */
+static inline void ipaugenblick_mark_sendfile_done(void *descriptor,int status,unsigned long bytes)
+{
+    uint32_t ringidx_ready_mask;
+    socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+
+    g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].sendfile_status = status;
+    g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].sendfile_bytes = bytes;
+    if(socket_satelite_data->parent_idx == -1) {
+        socket_satelite_data->sendfile_done_pending = 1;
+        return;
+    }
+    socket_satelite_data->sendfile_done_pending = 0;
+    rte_wmb();
+    ringidx_ready_mask = socket_satelite_data->ringset_idx|(SOCKET_SENDFILE_DONE_BIT << SOCKET_READY_SHIFT);
+    rte_ring_enqueue(g_ipaugenblick_selectors[socket_satelite_data->parent_idx].ready_connections,(void *)ringidx_ready_mask);
+}
+
+static inline void ipaugenblick_post_tx_timestamp(socket_satelite_data_t *socket_satelite_data,
+                                                  uint64_t tag,int type,uint64_t tsc)
+{
+    ipaugenblick_cmd_t *cmd;
+    uint32_t ringidx_ready_mask;
+    int was_empty;
+
+    if(rte_mempool_get(free_command_pool,(void **)&cmd)) {
+        ipaugenblick_stats_tx_tstamp_dropped++;
+        g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_tstamp_dropped++;
+        return;
+    }
+    cmd->cmd = IPAUGENBLICK_SOCKET_TX_TIMESTAMP_REPORT;
+    cmd->ringset_idx = socket_satelite_data->ringset_idx;
+    cmd->u.tx_timestamp.tag = tag;
+    cmd->u.tx_timestamp.tsc = tsc;
+    cmd->u.tx_timestamp.type = type;
+    was_empty = !rte_ring_count(socket_satelite_data->errq_ring);
+    if(rte_ring_sp_enqueue_bulk(socket_satelite_data->errq_ring,(void **)&cmd,1) == -ENOBUFS) {
+        ipaugenblick_free_command_buf(cmd);
+        ipaugenblick_stats_tx_tstamp_dropped++;
+        g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_tstamp_dropped++;
+        return;
+    }
+    ipaugenblick_stats_tx_tstamp_reports++;
+    if((was_empty)&&(socket_satelite_data->parent_idx != -1)) {
+        ringidx_ready_mask = socket_satelite_data->ringset_idx|(SOCKET_TX_TIMESTAMP_BIT << SOCKET_READY_SHIFT);
+        rte_ring_enqueue(g_ipaugenblick_selectors[socket_satelite_data->parent_idx].ready_connections,(void *)ringidx_ready_mask);
+    }
+}
+
+/* a tagged buffer left the tx ring, SENT/ACKED follow as snd_nxt/snd_una pass end_seq.
+   Returns non-zero if the FIFO is full, then SCHED is the only report */
+static inline int ipaugenblick_tx_tstamp_scheduled(socket_satelite_data_t *socket_satelite_data,
+                                                   uint64_t tag,uint32_t end_seq)
+{
+    ipaugenblick_tx_tstamp_pending_t *pending;
+
+    ipaugenblick_post_tx_timestamp(socket_satelite_data,tag,IPAUGENBLICK_TX_TSTAMP_SCHED,rte_rdtsc());
+    if(socket_satelite_data->tstamp_head - socket_satelite_data->tstamp_tail >= IPAUGENBLICK_TX_TSTAMP_PENDING) {
+        ipaugenblick_stats_tx_tstamp_overflow++;
+        /* SENT and, on a stream, ACKED */
+        g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_tstamp_dropped +=
+            (socket_satelite_data->socket->type == SOCK_STREAM) ? 2 : 1;
+        return 1;
+    }
+    pending = &socket_satelite_data->tstamp_pending[socket_satelite_data->tstamp_head % IPAUGENBLICK_TX_TSTAMP_PENDING];
+    pending->tag = tag;
+    pending->end_seq = end_seq;
+    socket_satelite_data->tstamp_head++;
+    return 0;
+}
+
+/* the oldest not yet sent buffer was just staged in the driver */
+static inline void ipaugenblick_tx_tstamp_queue(socket_satelite_data_t *socket_satelite_data)
+{
+    ipaugenblick_tx_tstamp_pending_t *pending;
+
+    pending = &socket_satelite_data->tstamp_pending[socket_satelite_data->tstamp_queued % IPAUGENBLICK_TX_TSTAMP_PENDING];
+    pending->port = dpdk_dev_last_tx_port;
+    pending->seq = dpdk_dev_last_tx_seq;
+    socket_satelite_data->tstamp_queued++;
+}
+
+/* SENT carries the TSC of the burst that handed the buffer's last segment to the PMD.
+   Sockets with staged ones are polled from the main loop */
+static inline void ipaugenblick_tx_tstamp_post_sent(socket_satelite_data_t *socket_satelite_data)
+{
+    ipaugenblick_tx_tstamp_pending_t *pending;
+    uint64_t tsc;
+
+    while(socket_satelite_data->tstamp_sent != socket_satelite_data->tstamp_queued) {
+        pending = &socket_satelite_data->tstamp_pending[socket_satelite_data->tstamp_sent % IPAUGENBLICK_TX_TSTAMP_PENDING];
+        if(unlikely(pending->port == -1))
+            tsc = rte_rdtsc();
+        else if(!dpdk_dev_tx_sent_tsc(pending->port,pending->seq,&tsc))
+            break;
+        ipaugenblick_post_tx_timestamp(socket_satelite_data,pending->tag,IPAUGENBLICK_TX_TSTAMP_SENT,tsc);
+        socket_satelite_data->tstamp_sent++;
+    }
+    /* datagrams are not ACKed, SENT is the last report */
+    if(socket_satelite_data->socket->type != SOCK_STREAM)
+        socket_satelite_data->tstamp_tail = socket_satelite_data->tstamp_sent;
+    if(socket_satelite_data->tstamp_sent != socket_satelite_data->tstamp_queued) {
+        if(!socket_satelite_data->tstamp_queued_listed) {
+            TAILQ_INSERT_TAIL(&tx_tstamp_queued_list_head,socket_satelite_data,tstamp_queued_entry);
+            socket_satelite_data->tstamp_queued_listed = 1;
+        }
+    }
+    else if(socket_satelite_data->tstamp_queued_listed) {
+        TAILQ_REMOVE(&tx_tstamp_queued_list_head,socket_satelite_data,tstamp_queued_entry);
+        socket_satelite_data->tstamp_queued_listed = 0;
+    }
+}
+
+/* after the datagram of the newest tagged buffer was handed to the stack, or failed to */
+static inline void ipaugenblick_tx_tstamp_datagram_sent(void *descriptor,int sent)
+{
+    socket_satelite_data_t *socket_satelite_data = (socket_satelite_data_t *)descriptor;
+
+    if(!sent) {
+        socket_satelite_data->tstamp_head--;
+        return;
+    }
+    ipaugenblick_tx_tstamp_queue(socket_satelite_data);
+    ipaugenblick_tx_tstamp_post_sent(socket_satelite_data);
+}
+
+static inline void ipaugenblick_tx_tstamp_queued_poll()
+{
+    socket_satelite_data_t *socket_satelite_data,*next;
+
+    for(socket_satelite_data = TAILQ_FIRST(&tx_tstamp_queued_list_head);socket_satelite_data;socket_satelite_data = next) {
+        next = TAILQ_NEXT(socket_satelite_data,tstamp_queued_entry);
+        ipaugenblick_tx_tstamp_post_sent(socket_satelite_data);
+    }
+}
+
+static inline void ipaugenblick_tx_tstamp_reset(socket_satelite_data_t *socket_satelite_data)
+{
+    if(socket_satelite_data->tstamp_queued_listed) {
+        TAILQ_REMOVE(&tx_tstamp_queued_list_head,socket_satelite_data,tstamp_queued_entry);
+        socket_satelite_data->tstamp_queued_listed = 0;
+    }
+    socket_satelite_data->tstamp_head = 0;
+    socket_satelite_data->tstamp_queued = 0;
+    socket_satelite_data->tstamp_sent = 0;
+    socket_satelite_data->tstamp_tail = 0;
+    g_ipaugenblick_sockets[socket_satelite_data->ringset_idx].tx_tstamp_dropped = 0;
+}
+
+/* moves what src's app sent to the peer app's rx ring, stops when it is full.
+   The peer reading kicks rx and this is called again */
+static inline void ipaugenblick_splice_move(socket_satelite_data_t *src)
+{
+    struct rte_mbuf *mbufs[MAX_PKT_BURST];
+    socket_satelite_data_t *dst = src->splice_peer;
+    int count,i;
+    uint64_t rx_tsc = rte_rdtsc();
+
+    ipaugenblick_tx_buf_count(src);
+    do {
+        count = ipaugenblick_rx_buf_free_count(dst);
+        if(count > MAX_PKT_BURST)
+            count = MAX_PKT_BURST;
+        if(!count)
+            break;
+        count = ipaugenblick_dequeue_tx_buf_burst(src,mbufs,count);
+        for(i = 0;i < count;i++) {
+            mbufs[i]->pkt.pkt_len = mbufs[i]->pkt.data_len;
+            mbufs[i]->pkt.nb_segs = 1;
+            mbufs[i]->pkt.next = NULL;
+            IPAUGENBLICK_MBUF_RX_TSC(mbufs[i]) = rx_tsc;
+            /* the peer's ring is the network here, all three happen at once */
+            if(unlikely(IPAUGENBLICK_MBUF_TX_TAG(mbufs[i]))) {
+                ipaugenblick_post_tx_timestamp(src,IPAUGENBLICK_MBUF_TX_TAG(mbufs[i]),IPAUGENBLICK_TX_TSTAMP_SCHED,rx_tsc);
+                ipaugenblick_post_tx_timestamp(src,IPAUGENBLICK_MBUF_TX_TAG(mbufs[i]),IPAUGENBLICK_TX_TSTAMP_SENT,rx_tsc);
+                ipaugenblick_post_tx_timestamp(src,IPAUGENBLICK_MBUF_TX_TAG(mbufs[i]),IPAUGENBLICK_TX_TSTAMP_ACKED,rx_tsc);
+                IPAUGENBLICK_MBUF_TX_TAG(mbufs[i]) = 0;
+            }
+            ipaugenblick_submit_rx_buf(mbufs[i],dst);
+        }
+        ipaugenblick_stats_splice_bufs += count;
+    }while(count == MAX_PKT_BURST);
+    ipaugenblick_return_tx_credits(src);
+    if(!rte_ring_count(src->tx_ring))
+        ipaugenblick_mark_writable(src);
+}
+
 static inline void ipaugenblick_free_socket(int connidx)
 {
    rte_ring_enqueue(free_connections_ring,(void *)&g_ipaugenblick_sockets[connidx]);
@@ -15,6 +15,7 @@
 #include <specific_includes/linux/rtnetlink.h>
 #include <specific_includes/net/dst.h>
 #include <specific_includes/net/checksum.h>
+#include <specific_includes/net/tcp.h>
 #include <specific_includes/linux/err.h>
 #include <specific_includes/linux/if_arp.h>
 #include <specific_includes/linux/if_vlan.h>
@@ -23,6 +24,7 @@
 #include <specific_includes/linux/ipv6.h>
 #include <specific_includes/linux/in.h>
 #include <string.h>
+#include <unistd.h>
 #include <rte_config.h>
 #include <rte_common.h>
 #include <rte_cycles.h>
@@ -31,6 +33,7 @@
 #include <api.h>
 #include <porting/libinit.h>
 #include <rte_atomic.h>
+#include <rte_power.h>
 #include "ipaugenblick_common/ipaugenblick_common.h"
 #include "ipaugenblick_service/ipaugenblick_server_side.h"
 #include "user_callbacks.h"
@@ -55,7 +58,7 @@ uint64_t user_rx_ring_full = 0;
 
 uint64_t g_last_time_transmitted = 0;
 
-struct rte_ring *command_ring = NULL;
+ipaugenblick_cmd_ring_t *ipaugenblick_cmd_rings[IPAUGENBLICK_CMD_RINGS_COUNT];
 struct rte_ring *selectors_ring = NULL;
 struct rte_mempool *free_connections_pool = NULL;
 struct rte_ring *free_connections_ring = NULL;
@@ -65,21 +68,395 @@ struct rte_mempool *free_command_pool = NULL;
 socket_satelite_data_t socket_satelite_data[IPAUGENBLICK_CONNECTION_POOL_SIZE];
 ipaugenblick_socket_t *g_ipaugenblick_sockets = NULL;
 ipaugenblick_selector_t *g_ipaugenblick_selectors = NULL;
+static ipaugenblick_sendfile_t sendfile_state[IPAUGENBLICK_CONNECTION_POOL_SIZE];
+uint32_t ipaugenblick_rings_numa_mask = 0;
+ipaugenblick_data_rings_t ipaugenblick_data_rings[RTE_MAX_NUMA_NODES][IPAUGENBLICK_CONNECTION_POOL_SIZE];
+uint64_t ipaugenblick_stats_rings_placed[RTE_MAX_NUMA_NODES];
+uint64_t ipaugenblick_stats_rings_placement_fallback = 0;
 //unsigned long app_pid = 0;
 
 TAILQ_HEAD(buffers_available_notification_socket_list_head, socket) buffers_available_notification_socket_list_head;
+struct rx_delay_socket_list_head rx_delay_socket_list_head;
+struct splice_pending_list_head splice_pending_list_head;
+struct shared_rx_blocked_list_head shared_rx_blocked_list_head;
+struct tx_tstamp_queued_list_head tx_tstamp_queued_list_head;
+struct handoff_pending_list_head handoff_pending_list_head;
+ipaugenblick_shared_rx_state_t *ipaugenblick_shared_rx_state = NULL;
+uint64_t ipaugenblick_stats_shared_rx_bufs = 0;
+uint64_t ipaugenblick_stats_shared_rx_blocked = 0;
+uint64_t ipaugenblick_stats_splice_candidates = 0;
+uint64_t ipaugenblick_stats_splice_established = 0;
+uint64_t ipaugenblick_stats_splice_abandoned = 0;
+uint64_t ipaugenblick_stats_splice_bufs = 0;
+uint64_t ipaugenblick_stats_tx_tstamp_reports = 0;
+uint64_t ipaugenblick_stats_tx_tstamp_dropped = 0;
+uint64_t ipaugenblick_stats_tx_tstamp_overflow = 0;
+ipaugenblick_big_rings_t ipaugenblick_big_rings[RTE_MAX_NUMA_NODES][2];
+int ipaugenblick_big_rings_in_use = 0;
+uint64_t ipaugenblick_stats_rings_grown = 0;
+uint64_t ipaugenblick_stats_rings_shrunk = 0;
+uint64_t ipaugenblick_stats_ring_pool_empty = 0;
+uint64_t ipaugenblick_stats_handoffs = 0;
+uint64_t ipaugenblick_stats_handoffs_delayed = 0;
+uint64_t ipaugenblick_stats_handoffs_refused = 0;
+uint64_t ipaugenblick_stats_handoff_shared_rx_lost = 0;
 
-static inline void process_commands()
+/* a pending splice falls back to TCP if the connection isn't drained both ways by then */
+#ifndef IPAUGENBLICK_SPLICE_PENDING_TIMEOUT_US
+#define IPAUGENBLICK_SPLICE_PENDING_TIMEOUT_US 100000
+#endif
+
+/* a handoff waits that long for the old owner to move the socket's buffers off its shared ring */
+#ifndef IPAUGENBLICK_HANDOFF_PENDING_TIMEOUT_US
+#define IPAUGENBLICK_HANDOFF_PENDING_TIMEOUT_US 1000000
+#endif
+
+#define IPAUGENBLICK_RING_RESIZE_INTERVAL_US 100000
+#define IPAUGENBLICK_RING_MIN_RTT_US 1000
+
+/* idle governor of the main loop, counted in consecutive iterations without work */
+#ifndef IPAUGENBLICK_IDLE_SPIN_POLLS
+#define IPAUGENBLICK_IDLE_SPIN_POLLS 1000 /* busy polling */
+#endif
+#ifndef IPAUGENBLICK_IDLE_PAUSE_POLLS
+#define IPAUGENBLICK_IDLE_PAUSE_POLLS 10000 /* then 1us pauses, then sleeps */
+#endif
+#ifndef IPAUGENBLICK_IDLE_SCALE_DOWN_POLLS
+#define IPAUGENBLICK_IDLE_SCALE_DOWN_POLLS 1000 /* while sleeping, a frequency step down each that many */
+#endif
+/* the sleeps start at the time a burst takes at line rate and double up to this,
+   it bounds the latency of the first packet after an idle period */
+#ifndef IPAUGENBLICK_IDLE_MAX_SLEEP_US
+#define IPAUGENBLICK_IDLE_MAX_SLEEP_US 100
+#endif
+
+uint64_t ipaugenblick_stats_idle_pauses = 0;
+uint64_t ipaugenblick_stats_idle_sleeps = 0;
+uint64_t ipaugenblick_stats_freq_down = 0;
+uint64_t ipaugenblick_stats_freq_max = 0;
+extern uint64_t received;
+extern uint64_t transmitted;
+
+void user_on_tcp_data_sent(struct sock *sk)
+{
+    socket_satelite_data_t *sd = (socket_satelite_data_t *)sk->sk_user_data;
+    struct tcp_sock *tp = tcp_sk(sk);
+
+    if(likely(sd->tstamp_queued == sd->tstamp_head))
+        return;
+    while((sd->tstamp_queued != sd->tstamp_head)&&
+          (!after(sd->tstamp_pending[sd->tstamp_queued % IPAUGENBLICK_TX_TSTAMP_PENDING].end_seq,tp->snd_nxt)))
+        ipaugenblick_tx_tstamp_queue(sd);
+    ipaugenblick_tx_tstamp_post_sent(sd);
+}
+
+void user_on_tcp_data_acked(struct sock *sk)
+{
+    socket_satelite_data_t *sd = (socket_satelite_data_t *)sk->sk_user_data;
+    struct tcp_sock *tp = tcp_sk(sk);
+    uint64_t now;
+
+    if(likely(sd->tstamp_tail == sd->tstamp_head))
+        return;
+    now = rte_rdtsc();
+    while((sd->tstamp_tail != sd->tstamp_sent)&&
+          (!after(sd->tstamp_pending[sd->tstamp_tail % IPAUGENBLICK_TX_TSTAMP_PENDING].end_seq,tp->snd_una))) {
+        ipaugenblick_post_tx_timestamp(sd,sd->tstamp_pending[sd->tstamp_tail % IPAUGENBLICK_TX_TSTAMP_PENDING].tag,
+                                       IPAUGENBLICK_TX_TSTAMP_ACKED,now);
+        sd->tstamp_tail++;
+    }
+}
+
+/* The other end of a TCP connection is local if it is one of our sockets.
+   The stack's established hash finds it as it would for a segment we send to it */
+static socket_satelite_data_t *ipaugenblick_find_local_peer(struct socket *sock)
+{
+    struct inet_sock *inet = inet_sk(sock->sk);
+    struct sock *peer_sk;
+    socket_satelite_data_t *peer = NULL;
+
+    peer_sk = inet_lookup_established(&init_net,&tcp_hashinfo,inet->inet_saddr,inet->inet_sport,
+                                      inet->inet_daddr,inet->inet_dport,0);
+    if(!peer_sk)
+        return NULL;
+    if((peer_sk != sock->sk)&&(peer_sk->sk_state == TCP_ESTABLISHED))
+        peer = (socket_satelite_data_t *)peer_sk->sk_user_data;
+    sock_gen_put(peer_sk);
+    /* not opened by an app (or not yet bound to a ringset) */
+    if((!peer)||(peer < socket_satelite_data)||(peer >= &socket_satelite_data[IPAUGENBLICK_CONNECTION_POOL_SIZE])||
+       (!peer->socket)||(peer->socket->sk != peer_sk)||(peer->splice_peer))
+        return NULL;
+    return peer;
+}
+
+static void ipaugenblick_splice_candidate(socket_satelite_data_t *sd)
+{
+    socket_satelite_data_t *peer;
+
+    if(sd->socket->type != SOCK_STREAM)
+        return;
+    peer = ipaugenblick_find_local_peer(sd->socket);
+    if((!peer)||(peer->sendfile)||(sd->sendfile))
+        return;
+    ipaugenblick_stats_splice_candidates++;
+    sd->splice_peer = peer;
+    peer->splice_peer = sd;
+    sd->splice_state = IPAUGENBLICK_SPLICE_PENDING;
+    peer->splice_state = IPAUGENBLICK_SPLICE_PENDING;
+    sd->splice_pending_since = rte_rdtsc();
+    TAILQ_INSERT_TAIL(&splice_pending_list_head,sd,splice_entry);
+    sd->splice_queued = 1;
+}
+
+/* nothing is in flight and nothing is left in the socket queues */
+static int ipaugenblick_tcp_drained(struct socket *sock)
+{
+    struct sock *sk = sock->sk;
+    struct tcp_sock *tp = tcp_sk(sk);
+
+    return (sk->sk_state == TCP_ESTABLISHED)&&
+           (skb_queue_empty(&sk->sk_write_queue))&&
+           (skb_queue_empty(&sk->sk_receive_queue))&&
+           (skb_queue_empty(&tp->out_of_order_queue))&&
+           (tp->snd_una == tp->write_seq);
+}
+
+static void ipaugenblick_splice_unqueue(socket_satelite_data_t *sd)
+{
+    if(sd->splice_queued) {
+        TAILQ_REMOVE(&splice_pending_list_head,sd,splice_entry);
+        sd->splice_queued = 0;
+    }
+}
+
+static void ipaugenblick_unsplice(socket_satelite_data_t *sd);
+
+/* either side left ESTABLISHED or TCP didn't drain in time, both go on over TCP */
+static int ipaugenblick_splice_pending_expired(socket_satelite_data_t *sd,uint64_t now)
+{
+    return (sd->socket->sk->sk_state != TCP_ESTABLISHED)||
+           (sd->splice_peer->socket->sk->sk_state != TCP_ESTABLISHED)||
+           (now - sd->splice_pending_since > (rte_get_tsc_hz()/1000000)*IPAUGENBLICK_SPLICE_PENDING_TIMEOUT_US);
+}
+
+static void ipaugenblick_splice_pending_poll()
+{
+    socket_satelite_data_t *sd,*next;
+    uint64_t now = rte_rdtsc();
+
+    for(sd = TAILQ_FIRST(&splice_pending_list_head);sd;sd = next) {
+        next = TAILQ_NEXT(sd,splice_entry);
+        if(!sd->splice_peer) {
+            ipaugenblick_splice_unqueue(sd);
+            continue;
+        }
+        if(ipaugenblick_splice_pending_expired(sd,now)) {
+            ipaugenblick_stats_splice_abandoned++;
+            /* tx was held for the splice, the peer is kicked by unsplice */
+            ipaugenblick_unsplice(sd);
+            user_on_transmission_opportunity(sd->socket);
+            continue;
+        }
+        if((!ipaugenblick_tcp_drained(sd->socket))||(!ipaugenblick_tcp_drained(sd->splice_peer->socket)))
+            continue;
+        ipaugenblick_splice_unqueue(sd);
+        sd->splice_state = IPAUGENBLICK_SPLICE_ACTIVE;
+        sd->splice_peer->splice_state = IPAUGENBLICK_SPLICE_ACTIVE;
+        ipaugenblick_stats_splice_established++;
+        ipaugenblick_splice_move(sd);
+        ipaugenblick_splice_move(sd->splice_peer);
+    }
+}
+
+/* back to TCP: whatever was sent so far is handed to the peer first, so the stream stays in order */
+static void ipaugenblick_unsplice(socket_satelite_data_t *sd)
+{
+    socket_satelite_data_t *peer = sd->splice_peer;
+
+    if(!peer)
+        return;
+    if(sd->splice_state == IPAUGENBLICK_SPLICE_ACTIVE) {
+        ipaugenblick_splice_move(sd);
+        ipaugenblick_splice_move(peer);
+    }
+    ipaugenblick_splice_unqueue(sd);
+    ipaugenblick_splice_unqueue(peer);
+    sd->splice_peer = NULL;
+    peer->splice_peer = NULL;
+    sd->splice_state = IPAUGENBLICK_SPLICE_NONE;
+    peer->splice_state = IPAUGENBLICK_SPLICE_NONE;
+    if(peer->socket)
+        user_on_transmission_opportunity(peer->socket);
+}
+
+static void ipaugenblick_shared_rx_blocked_poll()
+{
+    socket_satelite_data_t *sd,*next;
+
+    for(sd = TAILQ_FIRST(&shared_rx_blocked_list_head);sd;sd = next) {
+        next = TAILQ_NEXT(sd,shared_rx_entry);
+        if(ipaugenblick_rx_buf_free_count(sd) <= 0)
+            continue;
+        ipaugenblick_shared_rx_unblock(sd);
+        user_data_available_cbk(sd->socket);
+    }
+}
+
+static void ipaugenblick_handoff_deliver(socket_satelite_data_t *sd,int selector)
+{
+    sd->parent_idx = selector;
+    /* the new owner adopts first, then learns the socket's state */
+    ipaugenblick_mark_handoff(sd);
+    ipaugenblick_mark_readable(sd);
+    ipaugenblick_mark_writable(sd);
+}
+
+static void ipaugenblick_handoff_unqueue(socket_satelite_data_t *sd)
+{
+    if(sd->handoff_select != -1) {
+        TAILQ_REMOVE(&handoff_pending_list_head,sd,handoff_entry);
+        sd->handoff_select = -1;
+    }
+}
+
+/* the old owner moved what was on its shared ring to handoff_rx, or is given up on:
+   the buffers left there are stale then */
+static void ipaugenblick_handoff_pending_poll()
+{
+    socket_satelite_data_t *sd,*next;
+    ipaugenblick_socket_t *ipaugenblick_socket;
+    uint64_t now = rte_rdtsc();
+    int selector;
+
+    for(sd = TAILQ_FIRST(&handoff_pending_list_head);sd;sd = next) {
+        next = TAILQ_NEXT(sd,handoff_entry);
+        ipaugenblick_socket = &g_ipaugenblick_sockets[sd->ringset_idx];
+        if(rte_atomic32_read(&ipaugenblick_socket->shared_rx_queued) > 0) {
+            if(now - sd->handoff_pending_since <= (rte_get_tsc_hz()/1000000)*IPAUGENBLICK_HANDOFF_PENDING_TIMEOUT_US)
+                continue;
+            ipaugenblick_stats_handoff_shared_rx_lost += rte_atomic32_read(&ipaugenblick_socket->shared_rx_queued);
+            ipaugenblick_socket->shared_rx_gen++;
+            rte_atomic32_set(&ipaugenblick_socket->shared_rx_queued,0);
+        }
+        /* handoff_rx is complete before the count drops */
+        rte_rmb();
+        selector = sd->handoff_select;
+        ipaugenblick_handoff_unqueue(sd);
+        ipaugenblick_handoff_deliver(sd,selector);
+    }
+}
+
+/* sockets the app found out of tx buffers. Each one is told it is writable once there are
+   mbufs and it has credits, those short of credits (window or the app's budget) wait for returns */
+static void ipaugenblick_buffers_available_poll()
+{
+    struct socket *sock,*next;
+    socket_satelite_data_t *socket_data;
+
+    for(sock = TAILQ_FIRST(&buffers_available_notification_socket_list_head);sock;sock = next) {
+        next = TAILQ_NEXT(sock,buffers_available_notification_queue_entry);
+        if(get_buffer_count() <= 0)
+            break;
+        socket_data = get_user_data(sock);
+        if(ipaugenblick_tx_space(socket_data) < socket_data->tx_lowat)
+            continue;
+        if(ipaugenblick_mark_writable(socket_data))
+            break;
+        sock->buffers_available_notification_queue_present = 0;
+        TAILQ_REMOVE(&buffers_available_notification_socket_list_head,sock,buffers_available_notification_queue_entry);
+    }
+}
+
+/* one swap at a time per direction: to a big ring when target doesn't fit the home one,
+   back home when it would fit in half of it */
+static void ipaugenblick_resize_socket_ring(socket_satelite_data_t *sd,int dir,unsigned int target)
+{
+    int numa_socket = g_ipaugenblick_sockets[sd->ringset_idx].numa_socket;
+    int ring_id = dir ? sd->rx_ring_id : sd->tx_ring_id;
+    int grown = 0;
+    struct rte_ring *ring;
+
+    if((ring_id == IPAUGENBLICK_HOME_RING)&&(target > DATA_RINGS_SIZE - 1)) {
+        ring = ipaugenblick_get_big_ring(numa_socket,dir,&ring_id);
+        if(!ring) {
+            ipaugenblick_stats_ring_pool_empty++;
+            return;
+        }
+        ipaugenblick_stats_rings_grown++;
+        grown = 1;
+    }
+    else if((ring_id != IPAUGENBLICK_HOME_RING)&&(target < DATA_RINGS_SIZE/2)) {
+        ring_id = IPAUGENBLICK_HOME_RING;
+        ring = dir ? ipaugenblick_data_rings[numa_socket][sd->ringset_idx].rx_ring :
+                     ipaugenblick_data_rings[numa_socket][sd->ringset_idx].tx_ring;
+        ipaugenblick_stats_rings_shrunk++;
+    }
+    else
+        return;
+    if(dir) {
+        ipaugenblick_swap_rx_ring(sd,ring,ring_id);
+        if(grown)
+            user_data_available_cbk(sd->socket);
+    }
+    else {
+        ipaugenblick_swap_tx_ring(sd,ring,ring_id);
+        if(grown)
+            ipaugenblick_mark_writable(sd);
+    }
+}
+
+/* Each index has DATA_RINGS_SIZE rings of its own, connections needing more are lent
+   DATA_RINGS_SIZE_MAX ones from the pool of their NUMA socket and give them back when idle:
+   tx - twice cwnd, one buffer per segment, so the next window is queued while one is in flight.
+   rx - twice what the app consumed during one RTT, doubled when it was the bottleneck.
+   The app moves to a new ring at a quiescent point, see ipaugenblick_swap_tx_ring/rx_ring */
+static void ipaugenblick_resize_socket_rings(uint64_t interval_us)
 {
+    socket_satelite_data_t *sd;
+    struct sock *sk;
+    unsigned int rtt_us,consumed,count,target;
     int ringset_idx;
-    ipaugenblick_cmd_t *cmd;
-    struct rte_mbuf *mbuf;
+
+    for(ringset_idx = 0;ringset_idx < IPAUGENBLICK_CONNECTION_POOL_SIZE;ringset_idx++) {
+        sd = &socket_satelite_data[ringset_idx];
+        if((!sd->socket)||(sd->ringset_idx == -1))
+            continue;
+        sk = sd->socket->sk;
+        if(sk->sk_state == TCP_LISTEN)
+            continue;
+        ipaugenblick_rx_ring_release_old(sd);
+        rtt_us = 0;
+        if(sd->socket->type == SOCK_STREAM) {
+            rtt_us = jiffies_to_msecs(tcp_sk(sk)->srtt >> 3)*1000;
+            if(!sd->tx_ring_next)
+                ipaugenblick_resize_socket_ring(sd,0,2*tcp_sk(sk)->snd_cwnd);
+        }
+        /* bounded by IPAUGENBLICK_SHARED_RX_SOCKET_CAP instead */
+        if(sd->shared_rx)
+            continue;
+        if(rtt_us < IPAUGENBLICK_RING_MIN_RTT_US)
+            rtt_us = IPAUGENBLICK_RING_MIN_RTT_US;
+        count = rte_ring_count(sd->rx_ring);
+        if(sd->rx_ring_old)
+            count += rte_ring_count(sd->rx_ring_old);
+        consumed = (sd->rx_enqueued - sd->rx_enqueued_last) - (count - sd->rx_count_last);
+        sd->rx_enqueued_last = sd->rx_enqueued;
+        sd->rx_count_last = count;
+        target = (unsigned int)((2*(uint64_t)consumed*rtt_us)/interval_us);
+        if((sd->rx_ring_hit)&&(target < DATA_RINGS_SIZE))
+            target = DATA_RINGS_SIZE;
+        sd->rx_ring_hit = 0;
+        if(!sd->rx_ring_old)
+            ipaugenblick_resize_socket_ring(sd,1,target);
+    }
+}
+
+/* cmd_ring_idx - of the app that sent the command */
+static inline void process_command(ipaugenblick_cmd_t *cmd,int cmd_ring_idx)
+{
     struct socket *sock;
-    char *p;
+    int rc;
 
-    cmd = ipaugenblick_dequeue_command_buf();
-    if(!cmd)
-        return;
     switch(cmd->cmd) {
         case IPAUGENBLICK_OPEN_CLIENT_SOCKET_COMMAND:
            printf("open_client_sock %x %x %x %x\n",cmd->u.open_client_sock.my_ipaddress,cmd->u.open_client_sock.my_port,
@@ -89,6 +466,12 @@ static inline void process_commands()
            if(sock) {
                printf("setting user data %p\n",sock);
                socket_satelite_data[cmd->ringset_idx].ringset_idx = cmd->ringset_idx;
+               if(ipaugenblick_place_socket_rings(&socket_satelite_data[cmd->ringset_idx],cmd->numa_socket)) {
+                   socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
+                   app_glue_close_socket(sock);
+                   break;
+               }
+               socket_satelite_data[cmd->ringset_idx].tx_owner = cmd_ring_idx;
                socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->parent_idx;
                app_glue_set_user_data(sock,(void *)&socket_satelite_data[cmd->ringset_idx]);
                socket_satelite_data[cmd->ringset_idx].socket = sock;
@@ -102,6 +485,12 @@ static inline void process_commands()
            if(sock) {
                printf("setting user data %p %p %d\n",sock,&socket_satelite_data[cmd->ringset_idx],cmd->ringset_idx);
                socket_satelite_data[cmd->ringset_idx].ringset_idx = cmd->ringset_idx;
+               if(ipaugenblick_place_socket_rings(&socket_satelite_data[cmd->ringset_idx],cmd->numa_socket)) {
+                   socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
+                   app_glue_close_socket(sock);
+                   break;
+               }
+               socket_satelite_data[cmd->ringset_idx].tx_owner = cmd_ring_idx;
                socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->parent_idx;
                app_glue_set_user_data(sock,(void *)&socket_satelite_data[cmd->ringset_idx]);
                socket_satelite_data[cmd->ringset_idx].socket = sock;
@@ -113,6 +502,12 @@ static inline void process_commands()
            if(sock) {
                printf("setting user data %d %p\n",cmd->ringset_idx,sock->sk);
                socket_satelite_data[cmd->ringset_idx].ringset_idx = cmd->ringset_idx;
+               if(ipaugenblick_place_socket_rings(&socket_satelite_data[cmd->ringset_idx],cmd->numa_socket)) {
+                   socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
+                   app_glue_close_socket(sock);
+                   break;
+               }
+               socket_satelite_data[cmd->ringset_idx].tx_owner = cmd_ring_idx;
                socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->parent_idx;
                app_glue_set_user_data(sock,(void *)&socket_satelite_data[cmd->ringset_idx]);
                socket_satelite_data[cmd->ringset_idx].socket = sock;
@@ -125,6 +520,12 @@ static inline void process_commands()
            if(sock) {
                printf("setting user data\n");
                socket_satelite_data[cmd->ringset_idx].ringset_idx = cmd->ringset_idx;
+               if(ipaugenblick_place_socket_rings(&socket_satelite_data[cmd->ringset_idx],cmd->numa_socket)) {
+                   socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
+                   app_glue_close_socket(sock);
+                   break;
+               }
+               socket_satelite_data[cmd->ringset_idx].tx_owner = cmd_ring_idx;
                socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->parent_idx;
                app_glue_set_user_data(sock,(void *)&socket_satelite_data[cmd->ringset_idx]);
                socket_satelite_data[cmd->ringset_idx].socket = sock;
@@ -140,6 +541,7 @@ static inline void process_commands()
         case IPAUGENBLICK_SOCKET_RX_KICK_COMMAND:
            if(socket_satelite_data[cmd->ringset_idx].socket) {
                user_kick_rx++;
+               ipaugenblick_rx_ring_release_old(&socket_satelite_data[cmd->ringset_idx]);
                user_data_available_cbk(socket_satelite_data[cmd->ringset_idx].socket);
       //         user_on_transmission_opportunity(socket_satelite_data[cmd->ringset_idx].socket);
            }
@@ -147,16 +549,41 @@ static inline void process_commands()
         case IPAUGENBLICK_SET_SOCKET_RING_COMMAND:
            printf("%s %d %d %d %p\n",__FILE__,__LINE__,cmd->ringset_idx,cmd->parent_idx,cmd->u.set_socket_ring.socket_descr);
            socket_satelite_data[cmd->ringset_idx].ringset_idx = cmd->ringset_idx;
+           if(ipaugenblick_place_socket_rings(&socket_satelite_data[cmd->ringset_idx],cmd->numa_socket)) {
+               socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
+               app_glue_close_socket((struct socket *)cmd->u.set_socket_ring.socket_descr);
+               break;
+           }
+           socket_satelite_data[cmd->ringset_idx].tx_owner = cmd_ring_idx;
            socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->parent_idx;
            app_glue_set_user_data(cmd->u.set_socket_ring.socket_descr,&socket_satelite_data[cmd->ringset_idx]);
            socket_satelite_data[cmd->ringset_idx].socket = cmd->u.set_socket_ring.socket_descr; 
            user_on_transmission_opportunity(socket_satelite_data[cmd->ringset_idx].socket);
            user_data_available_cbk(socket_satelite_data[cmd->ringset_idx].socket);
+           ipaugenblick_splice_candidate(&socket_satelite_data[cmd->ringset_idx]);
            break;
         case IPAUGENBLICK_SET_SOCKET_SELECT_COMMAND:
            printf("setting selector %d for socket %d\n",cmd->u.set_socket_select.socket_select,cmd->ringset_idx);
            socket_satelite_data[cmd->ringset_idx].parent_idx = cmd->u.set_socket_select.socket_select; 
+           ipaugenblick_shared_rx_unblock(&socket_satelite_data[cmd->ringset_idx]);
+           sock = socket_satelite_data[cmd->ringset_idx].socket;
+           /* a listener's accepted connections always come on its own ring */
+           if((cmd->u.set_socket_select.shared_rx)&&(sock)&&(sock->sk->sk_state != TCP_LISTEN)) {
+               /* what is on the socket's own ring stays there. shared_rx_queued is not reset,
+                  buffers still on another selector's ring are counted until delivered */
+               ipaugenblick_rx_delay_cancel(&socket_satelite_data[cmd->ringset_idx]);
+               socket_satelite_data[cmd->ringset_idx].shared_rx = 
+                   g_ipaugenblick_selectors[cmd->u.set_socket_select.socket_select].shared_rx;
+           }
+           else
+               socket_satelite_data[cmd->ringset_idx].shared_rx = NULL;
            ipaugenblick_mark_writable(&socket_satelite_data[cmd->ringset_idx]);
+           if(socket_satelite_data[cmd->ringset_idx].sendfile_done_pending)
+               ipaugenblick_mark_sendfile_done(&socket_satelite_data[cmd->ringset_idx],
+                                               g_ipaugenblick_sockets[cmd->ringset_idx].sendfile_status,
+                                               g_ipaugenblick_sockets[cmd->ringset_idx].sendfile_bytes);
+           if(socket_satelite_data[cmd->ringset_idx].shared_rx)
+               user_data_available_cbk(sock);
            break;
         case IPAUGENBLICK_SOCKET_CONNECT_COMMAND:
            printf("Socket connect %x %x %p\n",cmd->u.socket_connect.ipaddr,cmd->u.socket_connect.port,socket_satelite_data[cmd->ringset_idx].socket);
@@ -179,7 +606,28 @@ static inline void process_commands()
        case IPAUGENBLICK_SOCKET_CLOSE_COMMAND:
            if(socket_satelite_data[cmd->ringset_idx].socket) {
                printf("closing socket %d %p\n",cmd->ringset_idx,socket_satelite_data[cmd->ringset_idx].socket);
+               ipaugenblick_unsplice(&socket_satelite_data[cmd->ringset_idx]);
+               if(socket_satelite_data[cmd->ringset_idx].sendfile) {
+                   ipaugenblick_sendfile_close(socket_satelite_data[cmd->ringset_idx].sendfile);
+                   socket_satelite_data[cmd->ringset_idx].sendfile = NULL;
+               }
+               socket_satelite_data[cmd->ringset_idx].sendfile_done_pending = 0;
+               if(socket_satelite_data[cmd->ringset_idx].socket->buffers_available_notification_queue_present) {
+                   TAILQ_REMOVE(&buffers_available_notification_socket_list_head,socket_satelite_data[cmd->ringset_idx].socket,buffers_available_notification_queue_entry);
+                   socket_satelite_data[cmd->ringset_idx].socket->buffers_available_notification_queue_present = 0;
+               }
+               ipaugenblick_drain_tx_ring(&socket_satelite_data[cmd->ringset_idx]);
+               ipaugenblick_release_tx_owner(&socket_satelite_data[cmd->ringset_idx]);
                app_glue_close_socket((struct socket *)socket_satelite_data[cmd->ringset_idx].socket);
+               ipaugenblick_reset_watermarks(&socket_satelite_data[cmd->ringset_idx]);
+               ipaugenblick_tx_tstamp_reset(&socket_satelite_data[cmd->ringset_idx]);
+               ipaugenblick_release_socket_rings(&socket_satelite_data[cmd->ringset_idx]);
+               ipaugenblick_shared_rx_unblock(&socket_satelite_data[cmd->ringset_idx]);
+               ipaugenblick_handoff_unqueue(&socket_satelite_data[cmd->ringset_idx]);
+               socket_satelite_data[cmd->ringset_idx].shared_rx = NULL;
+               /* buffers still on shared rings belong to this connection, not to the next one on the index */
+               g_ipaugenblick_sockets[cmd->ringset_idx].shared_rx_gen++;
+               rte_atomic32_set(&g_ipaugenblick_sockets[cmd->ringset_idx].shared_rx_queued,0);
                socket_satelite_data[cmd->ringset_idx].socket = NULL;
                socket_satelite_data[cmd->ringset_idx].ringset_idx = -1;
                socket_satelite_data[cmd->ringset_idx].parent_idx = -1;
@@ -195,11 +643,232 @@ static inline void process_commands()
                }
            }
            break;
+        case IPAUGENBLICK_SOCKET_SENDFILE_COMMAND:
+           /* not open, nothing to report to */
+           if(!socket_satelite_data[cmd->ringset_idx].socket) {
+               printf("cannot sendfile on socket %d\n",cmd->ringset_idx);
+               break;
+           }
+           if((socket_satelite_data[cmd->ringset_idx].socket->type != SOCK_STREAM)||
+              (socket_satelite_data[cmd->ringset_idx].sendfile)) {
+               printf("cannot sendfile on socket %d\n",cmd->ringset_idx);
+               ipaugenblick_mark_sendfile_done(&socket_satelite_data[cmd->ringset_idx],
+                                               socket_satelite_data[cmd->ringset_idx].sendfile ? -EBUSY : -EINVAL,0);
+               break;
+           }
+           /* file data goes through TCP, the peer must read it from there too */
+           ipaugenblick_unsplice(&socket_satelite_data[cmd->ringset_idx]);
+           /* the fd is looked up in the process the command came from, not one the command names */
+           rc = ipaugenblick_sendfile_open(&sendfile_state[cmd->ringset_idx],
+                                           (unsigned long)rte_atomic32_read(&ipaugenblick_cmd_rings[cmd_ring_idx]->pid),
+                                           cmd->u.socket_sendfile.fd,cmd->u.socket_sendfile.offset,
+                                           cmd->u.socket_sendfile.length);
+           if(rc) {
+               ipaugenblick_sendfile_close(&sendfile_state[cmd->ringset_idx]);
+               ipaugenblick_mark_sendfile_done(&socket_satelite_data[cmd->ringset_idx],rc,0);
+               break;
+           }
+           socket_satelite_data[cmd->ringset_idx].sendfile = &sendfile_state[cmd->ringset_idx];
+           user_on_transmission_opportunity(socket_satelite_data[cmd->ringset_idx].socket);
+           break;
+        case IPAUGENBLICK_SOCKET_SET_WATERMARKS_COMMAND:
+           if(!socket_satelite_data[cmd->ringset_idx].socket) {
+               printf("cannot set watermarks of socket %d, not open %s %d\n",cmd->ringset_idx,__FILE__,__LINE__);
+               break;
+           }
+           socket_satelite_data[cmd->ringset_idx].rx_lowat_req = 
+               (cmd->u.socket_watermarks.rx_lowat > 0) ? cmd->u.socket_watermarks.rx_lowat : IPAUGENBLICK_DEFAULT_RX_LOWAT;
+           socket_satelite_data[cmd->ringset_idx].rx_hiwat_req = cmd->u.socket_watermarks.rx_hiwat;
+           socket_satelite_data[cmd->ringset_idx].tx_lowat_req = 
+               (cmd->u.socket_watermarks.tx_lowat > 0) ? cmd->u.socket_watermarks.tx_lowat : IPAUGENBLICK_DEFAULT_TX_LOWAT;
+           ipaugenblick_clamp_watermarks(&socket_satelite_data[cmd->ringset_idx]);
+           socket_satelite_data[cmd->ringset_idx].rx_hiwat_hit = 0;
+           socket_satelite_data[cmd->ringset_idx].rx_max_delay = 
+               (rte_get_tsc_hz()/1000000)*cmd->u.socket_watermarks.rx_max_delay_us;
+           /* whatever is queued now is judged by the new marks */
+           if(rte_ring_count(socket_satelite_data[cmd->ringset_idx].rx_ring) >= socket_satelite_data[cmd->ringset_idx].rx_lowat)
+               ipaugenblick_flush_readable(&socket_satelite_data[cmd->ringset_idx]);
+           ipaugenblick_mark_writable(&socket_satelite_data[cmd->ringset_idx]);
+           break;
+        case IPAUGENBLICK_SOCKET_HANDOFF_COMMAND:
+           /* only by the app owning the connection */
+           if((!socket_satelite_data[cmd->ringset_idx].socket)||
+              (socket_satelite_data[cmd->ringset_idx].tx_owner != cmd_ring_idx)) {
+               printf("cannot hand off socket %d, not the owner's %s %d\n",cmd->ringset_idx,__FILE__,__LINE__);
+               break;
+           }
+           /* only to a selector some process opened, else the sender takes it back when told */
+           if((cmd->u.socket_handoff.socket_select < 0)||
+              (cmd->u.socket_handoff.socket_select >= IPAUGENBLICK_SELECTOR_POOL_SIZE)||
+              (!rte_atomic32_read(&ipaugenblick_shared_rx_state[cmd->u.socket_handoff.socket_select].owner_pid))) {
+               printf("cannot hand off socket %d %s %d\n",cmd->ringset_idx,__FILE__,__LINE__);
+               ipaugenblick_stats_handoffs_refused++;
+               g_ipaugenblick_sockets[cmd->ringset_idx].handoff_status = -EINVAL;
+               if(socket_satelite_data[cmd->ringset_idx].parent_idx != -1)
+                   ipaugenblick_mark_handoff(&socket_satelite_data[cmd->ringset_idx]);
+               break;
+           }
+           printf("socket %d handed off to selector %d\n",cmd->ringset_idx,cmd->u.socket_handoff.socket_select);
+           ipaugenblick_stats_handoffs++;
+           /* the shared ring is the old selector's, the new owner attaches again if it wants */
+           ipaugenblick_shared_rx_unblock(&socket_satelite_data[cmd->ringset_idx]);
+           socket_satelite_data[cmd->ringset_idx].shared_rx = NULL;
+           ipaugenblick_rx_delay_cancel(&socket_satelite_data[cmd->ringset_idx]);
+           /* nobody is told anything until the new owner is */
+           socket_satelite_data[cmd->ringset_idx].parent_idx = -1;
+           rte_atomic16_set(&g_ipaugenblick_sockets[cmd->ringset_idx].read_ready_to_app,0);
+           rte_atomic16_set(&g_ipaugenblick_sockets[cmd->ringset_idx].write_ready_to_app,0);
+           /* nobody is charged for the tx buffers until the new owner adopts */
+           ipaugenblick_release_tx_owner(&socket_satelite_data[cmd->ringset_idx]);
+           /* what is on the old selector's shared ring is older than what goes to rx_ring from now on,
+              the old owner appends it to handoff_rx first */
+           if(rte_atomic32_read(&g_ipaugenblick_sockets[cmd->ringset_idx].shared_rx_queued) > 0) {
+               ipaugenblick_stats_handoffs_delayed++;
+               socket_satelite_data[cmd->ringset_idx].handoff_select = cmd->u.socket_handoff.socket_select;
+               socket_satelite_data[cmd->ringset_idx].handoff_pending_since = rte_rdtsc();
+               TAILQ_INSERT_TAIL(&handoff_pending_list_head,&socket_satelite_data[cmd->ringset_idx],handoff_entry);
+               break;
+           }
+           ipaugenblick_handoff_deliver(&socket_satelite_data[cmd->ringset_idx],cmd->u.socket_handoff.socket_select);
+           break;
+        case IPAUGENBLICK_SOCKET_ADOPT_COMMAND:
+           /* by the process owning the selector it was handed off to */
+           if((!socket_satelite_data[cmd->ringset_idx].socket)||
+              (socket_satelite_data[cmd->ringset_idx].tx_owner != -1)||
+              (socket_satelite_data[cmd->ringset_idx].handoff_select != -1)||
+              (socket_satelite_data[cmd->ringset_idx].parent_idx != cmd->u.socket_adopt.socket_select)||
+              (rte_atomic32_read(&ipaugenblick_shared_rx_state[cmd->u.socket_adopt.socket_select].owner_pid) !=
+               rte_atomic32_read(&ipaugenblick_cmd_rings[cmd_ring_idx]->pid))) {
+               printf("cannot adopt socket %d %s %d\n",cmd->ringset_idx,__FILE__,__LINE__);
+               break;
+           }
+           ipaugenblick_charge_tx_owner(&socket_satelite_data[cmd->ringset_idx],cmd_ring_idx);
+           ipaugenblick_mark_writable(&socket_satelite_data[cmd->ringset_idx]);
+           break;
         default:
            printf("unknown cmd %d\n",cmd->cmd);
            break;
     }
-    ipaugenblick_free_command_buf(cmd);
+}
+
+#define IPAUGENBLICK_CMD_BURST 32
+
+/* pid each command ring was last seen owned by */
+static int ipaugenblick_cmd_ring_pid[IPAUGENBLICK_CMD_RINGS_COUNT];
+
+/* an app took over the ring of a dead one: the dead app's sockets stop being charged to it,
+   which leaves tx_inflight with exactly what the new app holds */
+static void ipaugenblick_cmd_ring_reclaim(int cmd_ring_idx)
+{
+    int ringset_idx;
+
+    for(ringset_idx = 0;ringset_idx < IPAUGENBLICK_CONNECTION_POOL_SIZE;ringset_idx++)
+        if(socket_satelite_data[ringset_idx].tx_owner == cmd_ring_idx)
+            ipaugenblick_release_tx_owner(&socket_satelite_data[ringset_idx]);
+}
+
+/* a burst from each app's ring in turn, starting from the next one each time.
+   Returns the number of commands processed */
+static inline int process_commands()
+{
+    static int first_cmd_ring = 0;
+    ipaugenblick_cmd_ring_t *cmd_ring;
+    uint32_t count,i;
+    int ring_idx,cmd_ring_idx,processed = 0,pid;
+
+    for(ring_idx = 0;ring_idx < IPAUGENBLICK_CMD_RINGS_COUNT;ring_idx++) {
+        cmd_ring_idx = (first_cmd_ring + ring_idx) % IPAUGENBLICK_CMD_RINGS_COUNT;
+        cmd_ring = ipaugenblick_cmd_rings[cmd_ring_idx];
+        /* before any command of the new owner, so only the old owner's sockets are written off */
+        pid = rte_atomic32_read(&cmd_ring->pid);
+        if(unlikely(pid != ipaugenblick_cmd_ring_pid[cmd_ring_idx])) {
+            printf("command ring %d owned by %d, was %d %s %d\n",cmd_ring_idx,pid,ipaugenblick_cmd_ring_pid[cmd_ring_idx],__FILE__,__LINE__);
+            ipaugenblick_cmd_ring_reclaim(cmd_ring_idx);
+            ipaugenblick_cmd_ring_pid[cmd_ring_idx] = pid;
+        }
+        count = ipaugenblick_cmd_ring_count(cmd_ring);
+        if(!count)
+            continue;
+        if(count > IPAUGENBLICK_CMD_BURST)
+            count = IPAUGENBLICK_CMD_BURST;
+        for(i = 0;i < count;i++)
+            process_command(ipaugenblick_cmd_ring_peek(cmd_ring,i),cmd_ring_idx);
+        ipaugenblick_cmd_ring_release(cmd_ring,count);
+        processed += count;
+    }
+    first_cmd_ring = (first_cmd_ring + 1) % IPAUGENBLICK_CMD_RINGS_COUNT;
+    return processed;
+}
+
+typedef struct
+{
+    uint64_t idle_polls;
+    uint64_t last_received;
+    uint64_t last_transmitted;
+    int sleep_us;
+    int min_sleep_us;
+    int power; /* librte_power is usable on this lcore */
+    int scaled_down;
+}ipaugenblick_idle_t;
+
+static void ipaugenblick_idle_init(ipaugenblick_idle_t *idle,int drv_poll_interval)
+{
+    memset(idle,0,sizeof(*idle));
+    idle->min_sleep_us = drv_poll_interval > 0 ? drv_poll_interval : 1;
+    if(idle->min_sleep_us > IPAUGENBLICK_IDLE_MAX_SLEEP_US)
+        idle->min_sleep_us = IPAUGENBLICK_IDLE_MAX_SLEEP_US;
+    idle->sleep_us = idle->min_sleep_us;
+    /* needs the userspace cpufreq governor, busy polling at fixed frequency otherwise */
+    idle->power = (rte_power_init(rte_lcore_id()) == 0);
+    printf("idle governor: sleeps %d-%d us, frequency scaling %s\n",
+           idle->min_sleep_us,IPAUGENBLICK_IDLE_MAX_SLEEP_US,idle->power ? "on" : "off");
+}
+
+/* like l3fwd-power: any work (packets in or out, commands) restores busy polling
+   at full frequency, a run of empty iterations escalates to pauses, then sleeps
+   and frequency steps down. DPDK 1.6 PMDs have no rx interrupts, sleeps stand for them.
+   A sleep doesn't run past max_sleep_us, the nearest deadline of the loop */
+static inline void ipaugenblick_idle(ipaugenblick_idle_t *idle,int work,uint64_t max_sleep_us)
+{
+    work |= (received != idle->last_received)||(transmitted != idle->last_transmitted);
+    idle->last_received = received;
+    idle->last_transmitted = transmitted;
+    if(likely(work)) {
+        idle->idle_polls = 0;
+        idle->sleep_us = idle->min_sleep_us;
+        if(unlikely(idle->scaled_down)) {
+            rte_power_freq_max(rte_lcore_id());
+            idle->scaled_down = 0;
+            ipaugenblick_stats_freq_max++;
+        }
+        return;
+    }
+    idle->idle_polls++;
+    if(idle->idle_polls < IPAUGENBLICK_IDLE_SPIN_POLLS)
+        return;
+    if(idle->idle_polls < IPAUGENBLICK_IDLE_PAUSE_POLLS) {
+        rte_delay_us(1);
+        ipaugenblick_stats_idle_pauses++;
+        return;
+    }
+    if(idle->power && ((idle->idle_polls - IPAUGENBLICK_IDLE_PAUSE_POLLS) % IPAUGENBLICK_IDLE_SCALE_DOWN_POLLS) == 0) {
+        if(rte_power_freq_down(rte_lcore_id()) > 0) {
+            idle->scaled_down = 1;
+            ipaugenblick_stats_freq_down++;
+        }
+    }
+    if(max_sleep_us < (uint64_t)idle->min_sleep_us) {
+        rte_delay_us(1);
+        ipaugenblick_stats_idle_pauses++;
+        return;
+    }
+    usleep(max_sleep_us < (uint64_t)idle->sleep_us ? max_sleep_us : idle->sleep_us);
+    ipaugenblick_stats_idle_sleeps++;
+    if(idle->sleep_us < IPAUGENBLICK_IDLE_MAX_SLEEP_US) {
+        idle->sleep_us <<= 1;
+        if(idle->sleep_us > IPAUGENBLICK_IDLE_MAX_SLEEP_US)
+            idle->sleep_us = IPAUGENBLICK_IDLE_MAX_SLEEP_US;
+    }
 }
 
 void ipaugenblick_main_loop()
@@ -207,6 +876,10 @@ void ipaugenblick_main_loop()
     struct rte_mbuf *mbuf;
     uint8_t ports_to_poll[1] = { 0 };
     int drv_poll_interval = get_max_drv_poll_interval_in_micros(0);
+    uint64_t now,last_resize = 0,resize_interval = (rte_get_tsc_hz()/1000000)*IPAUGENBLICK_RING_RESIZE_INTERVAL_US;
+    ipaugenblick_idle_t idle;
+    uint64_t rx_delay_next;
+    int work;
     app_glue_init_poll_intervals(/*drv_poll_interval/(2*MAX_PKT_BURST)*/1,
                                  1000 /*timer_poll_interval*/,
                                  /*drv_poll_interval/(10*MAX_PKT_BURST)*/1,
@@ -214,31 +887,49 @@ void ipaugenblick_main_loop()
     
     ipaugenblick_service_api_init(COMMAND_POOL_SIZE,DATA_RINGS_SIZE,DATA_RINGS_SIZE);
     TAILQ_INIT(&buffers_available_notification_socket_list_head);
+    ipaugenblick_idle_init(&idle,drv_poll_interval);
     printf("IPAugenblick service initialized\n");
     while(1) {
-        process_commands();
+        work = process_commands();
 	app_glue_periodic(1,ports_to_poll,1);
-        while(!TAILQ_EMPTY(&buffers_available_notification_socket_list_head)) {
-            if(get_buffer_count() > 0) {
-                struct socket *sock = TAILQ_FIRST(&buffers_available_notification_socket_list_head);
-                socket_satelite_data_t *socket_data = get_user_data(sock);
-                if(!ipaugenblick_mark_writable(socket_data)) { 
-                    sock->buffers_available_notification_queue_present = 0;
-                    TAILQ_REMOVE(&buffers_available_notification_socket_list_head,sock,buffers_available_notification_queue_entry); 
-                }
-                else {
-                    break;
-                }
-            }
-            else {
-                break;
-            }
+        if(!TAILQ_EMPTY(&rx_delay_socket_list_head)) {
+            ipaugenblick_rx_delay_expire(rte_rdtsc());
+        }
+        if(!TAILQ_EMPTY(&splice_pending_list_head)) {
+            ipaugenblick_splice_pending_poll();
+        }
+        if(!TAILQ_EMPTY(&shared_rx_blocked_list_head)) {
+            ipaugenblick_shared_rx_blocked_poll();
+        }
+        if(!TAILQ_EMPTY(&tx_tstamp_queued_list_head)) {
+            ipaugenblick_tx_tstamp_queued_poll();
+        }
+        if(!TAILQ_EMPTY(&handoff_pending_list_head)) {
+            ipaugenblick_handoff_pending_poll();
         }
+        now = rte_rdtsc();
+        if(now - last_resize >= resize_interval) {
+            if(last_resize)
+                ipaugenblick_resize_socket_rings((now - last_resize)/(rte_get_tsc_hz()/1000000));
+            last_resize = now;
+        }
+        if(!TAILQ_EMPTY(&buffers_available_notification_socket_list_head)) {
+            ipaugenblick_buffers_available_poll();
+        }
+        /* the driver and the polled lists still have something to do */
+        work |= dpdk_dev_tx_pending(ports_to_poll[0])||
+                (!TAILQ_EMPTY(&buffers_available_notification_socket_list_head))||
+                (!TAILQ_EMPTY(&shared_rx_blocked_list_head))||
+                (!TAILQ_EMPTY(&tx_tstamp_queued_list_head));
+        rx_delay_next = TAILQ_EMPTY(&rx_delay_socket_list_head) ? ~0ULL : ipaugenblick_rx_delay_next(now);
+        ipaugenblick_idle(&idle,work,rx_delay_next/(rte_get_tsc_hz()/1000000));
     }
 }
 /*this is called in non-data-path thread */
 void print_user_stats()
 {
+        int i;
+
 	printf("user_on_tx_opportunity_called %"PRIu64"\n",user_on_tx_opportunity_called);
 	printf("user_on_tx_opportunity_api_nothing_to_tx %"PRIu64"user_on_tx_opportunity_socket_full %"PRIu64" \n",
                 user_on_tx_opportunity_api_nothing_to_tx,user_on_tx_opportunity_socket_full);
@@ -252,4 +943,26 @@ void print_user_stats()
 	printf("user_on_rx_opportunity_called_exhausted %"PRIu64"\n",user_on_rx_opportunity_called_exhausted);
 	printf("user_rx_mbufs %"PRIu64" user_rx_ring_full %"PRIu64"\n",user_rx_mbufs,user_rx_ring_full);
         printf("user_on_tx_opportunity_api_mbufs_sent %"PRIu64"\n",user_on_tx_opportunity_api_mbufs_sent);
+        printf("sendfile started %"PRIu64" bytes %"PRIu64" remaps %"PRIu64" no_mbufs %"PRIu64" errors %"PRIu64"\n",
+                ipaugenblick_stats_sendfile_started,ipaugenblick_stats_sendfile_bytes,ipaugenblick_stats_sendfile_remaps,
+                ipaugenblick_stats_sendfile_no_mbufs,ipaugenblick_stats_sendfile_errors);
+        for(i = 0;i < RTE_MAX_NUMA_NODES;i++) {
+            if(ipaugenblick_rings_numa_mask & (1 << i))
+                printf("connections on socket %d rings %"PRIu64"\n",i,ipaugenblick_stats_rings_placed[i]);
+        }
+        printf("rings placement fallback %"PRIu64"\n",ipaugenblick_stats_rings_placement_fallback);
+        printf("splice candidates %"PRIu64" established %"PRIu64" abandoned %"PRIu64" bufs %"PRIu64"\n",
+                ipaugenblick_stats_splice_candidates,ipaugenblick_stats_splice_established,
+                ipaugenblick_stats_splice_abandoned,ipaugenblick_stats_splice_bufs);
+        printf("tx timestamp reports %"PRIu64" dropped %"PRIu64" pending overflow %"PRIu64"\n",
+                ipaugenblick_stats_tx_tstamp_reports,ipaugenblick_stats_tx_tstamp_dropped,ipaugenblick_stats_tx_tstamp_overflow);
+        printf("shared rx bufs %"PRIu64" blocked %"PRIu64"\n",ipaugenblick_stats_shared_rx_bufs,ipaugenblick_stats_shared_rx_blocked);
+        printf("handoffs %"PRIu64" delayed %"PRIu64" refused %"PRIu64" shared rx lost %"PRIu64"\n",
+                ipaugenblick_stats_handoffs,ipaugenblick_stats_handoffs_delayed,ipaugenblick_stats_handoffs_refused,
+                ipaugenblick_stats_handoff_shared_rx_lost);
+        printf("big rings in use %d grown %"PRIu64" shrunk %"PRIu64" pool empty %"PRIu64"\n",
+                ipaugenblick_big_rings_in_use,ipaugenblick_stats_rings_grown,
+                ipaugenblick_stats_rings_shrunk,ipaugenblick_stats_ring_pool_empty);
+        printf("idle pauses %"PRIu64" sleeps %"PRIu64" freq down %"PRIu64" restored %"PRIu64"\n",
+                ipaugenblick_stats_idle_pauses,ipaugenblick_stats_idle_sleeps,ipaugenblick_stats_freq_down,ipaugenblick_stats_freq_max);
 }
@@ -2,12 +2,57 @@
 #ifndef __DPDK_DRV_IFACE_H__
 #define __DPDK_DRV_IFACE_H__
 
+/* rx arrival TSC lives in the first bytes of the headroom,
+   the NIC writes past RTE_PKTMBUF_HEADROOM and the stack never prepends to rx mbufs */
+#define DPDK_MBUF_RX_TSC(mbuf) (*(uint64_t *)((mbuf)->buf_addr))
+/* the next 8 bytes carry the app's tx tag, must not be stale when an rx buffer is sent back */
+#define DPDK_MBUF_TX_TAG(mbuf) (*(uint64_t *)((char *)(mbuf)->buf_addr + sizeof(uint64_t)))
+
+/* port and per-port sequence number (from 1) of the last mbuf staged for the PMD,
+   see dpdk_dev_tx_sent_tsc */
+extern int dpdk_dev_last_tx_port;
+extern uint64_t dpdk_dev_last_tx_seq;
+
+/* tx queues staged per port, only queue 0 is configured today */
+#define DPDK_DEV_TX_QUEUES_COUNT 1
+/* 0 flushes the staging at the end of every iteration,
+   otherwise partial bursts may wait up to this many micros for more packets */
+#ifndef DPDK_DEV_TX_MAX_DELAY_US
+#define DPDK_DEV_TX_MAX_DELAY_US 0
+#endif
+#define DPDK_DEV_TX_BURST_BUCKETS 6
+/* bursts remembered per tx queue for dpdk_dev_tx_sent_tsc, power of 2 */
+#ifndef DPDK_DEV_TX_BURST_HISTORY
+#define DPDK_DEV_TX_BURST_HISTORY 64
+#endif
+/* packets the PMD ring could not take, per tx queue, power of 2 */
+#ifndef DPDK_DEV_TX_BACKLOG_SIZE
+#define DPDK_DEV_TX_BACKLOG_SIZE 4096
+#endif
+#define DPDK_DEV_TX_BACKLOG_STOP_THRESHOLD ((DPDK_DEV_TX_BACKLOG_SIZE*3)/4)
+#define DPDK_DEV_TX_BACKLOG_WAKE_THRESHOLD (DPDK_DEV_TX_BACKLOG_SIZE/4)
+
+/* largest frame the ports accept, longer than an rx mbuf so PMDs scatter it over a chain.
+   Leaves room for a 9000 MTU plus ethernet header, VLAN tag and CRC */
+#ifndef DPDK_DEV_MAX_RX_PKT_LEN
+#define DPDK_DEV_MAX_RX_PKT_LEN 9216
+#endif
+/* largest frame each port was configured to receive (max_rx_pkt_len), bounds its netdevs' MTU */
+extern int dpdk_dev_max_rx_pkt_len[];
+
 void *create_netdev(int port_num);
 
+/* VLAN sub-interface dpdk_if<port>.<vlan_id> on top of the port's netdev */
+void *create_vlan_netdev(void *real_netdev,int vlan_id);
+void *get_vlan_netdev(void *real_netdev,int vlan_id);
+
 void add_dev_addr(void *netdev,int instance,char *ip_addr,char *ip_mask);
 
 void set_dev_addr(void *netdev,char *mac_addr,char *ip_addr,char *ip_mask);
 
+/* 0 or -errno */
+int set_dev_mtu(void *netdev,int mtu);
+
 void user_transmitted_callback(struct rte_mbuf *mbuf);
 
 void run_rx_thread(int portnum);
@@ -15,11 +60,67 @@ void run_tx_thread(int portnum);
 
 void dpdk_dev_init_rx_ring(int port_num);
 int dpdk_dev_get_received(int port_num,struct rte_mbuf **tbl,int tbl_size);
+/* non-zero if the PMD verifies IPv4, TCP and UDP checksums (hw_ip_checksum) */
+int dpdk_dev_rx_csum_capable(int port_num);
+/* non-zero if the PMD strips VLAN tags into the mbuf (hw_vlan_strip) */
+int dpdk_dev_rx_vlan_strip_capable(int port_num);
+
+/* NIC counters of a port as of the last dpdk_dev_sample_nic_stats(), one per port in the
+   DPDK_DEV_NIC_STATS_MEMZONE_NAME memzone so apps read them next to the stack's own.
+   rx_missed - dropped by the NIC because the rx ring was full (the stack did not poll in time),
+   rx_nombuf - not received for lack of mbufs to refill the ring (held by the stack or apps),
+   stack_* - what the stack took off the ring and dropped on tx. Rates are per second */
+#define DPDK_DEV_NIC_STATS_MEMZONE_NAME "dpdk_dev_nic_stats"
+#define DPDK_DEV_NIC_STATS_QUEUES 16 /* RTE_ETHDEV_QUEUE_STAT_CNTRS */
+typedef struct
+{
+	volatile uint32_t seq; /* odd while a sample is being written */
+	uint64_t tsc; /* of the sample */
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_errors;
+	uint64_t tx_errors;
+	uint64_t rx_multicast;
+	uint64_t rx_missed;
+	uint64_t rx_nombuf;
+	uint64_t stack_rx_packets;
+	uint64_t stack_tx_dropped;
+	uint64_t rx_packets_rate;
+	uint64_t tx_packets_rate;
+	uint64_t rx_bytes_rate;
+	uint64_t tx_bytes_rate;
+	uint64_t rx_missed_rate;
+	uint64_t rx_nombuf_rate;
+	uint64_t q_rx_packets[DPDK_DEV_NIC_STATS_QUEUES];
+	uint64_t q_tx_packets[DPDK_DEV_NIC_STATS_QUEUES];
+	uint64_t q_rx_bytes[DPDK_DEV_NIC_STATS_QUEUES];
+	uint64_t q_tx_bytes[DPDK_DEV_NIC_STATS_QUEUES];
+	uint64_t q_rx_missed[DPDK_DEV_NIC_STATS_QUEUES];
+}__attribute__((aligned(64)))dpdk_dev_nic_stats_t;
+/* reserves the memzone, before the ports start */
+void dpdk_dev_init_nic_stats(void);
+/* reads the NIC's counters, off the data path and from one lcore only */
+void dpdk_dev_sample_nic_stats(int port_num);
+/* consistent copy of the last sample, -1 if there is none */
+int dpdk_dev_get_nic_stats(int port_num,dpdk_dev_nic_stats_t *stats);
+void dpdk_dev_print_nic_stats(int port_num);
 void dpdk_dev_init_tx_ring(int port_num);
 void dpdk_dev_enqueue_for_tx(int port_num,struct rte_mbuf *m);
+/* 1 and the TSC of the burst that handed mbuf seq to the PMD, 0 while it is still staged or backlogged.
+   Older than DPDK_DEV_TX_BURST_HISTORY bursts gets the oldest remembered one */
+int dpdk_dev_tx_sent_tsc(int port_num,uint64_t seq,uint64_t *tsc);
+/* non-zero if the PMD inserts VLAN tags (PKT_TX_VLAN_PKT) */
+int dpdk_dev_tx_vlan_insert_capable(int port_num);
 
+/* flushes staged tx mbufs of the port, see DPDK_DEV_TX_MAX_DELAY_US */
 void transmit_pending(int port_num);
 
+/* non-zero while the port has staged or backlogged mbufs */
+int dpdk_dev_tx_pending(int port_num);
+
+/* non-zero while the port's tx backlog is over DPDK_DEV_TX_BACKLOG_STOP_THRESHOLD */
 int get_tx_overflow(int port_num);
 
 #endif /* __DPDK_DRV_IFACE_H__ */
@@ -178,7 +178,8 @@ struct page_frag {
  * size.
  */
 #ifdef GSO
-#define MAX_SKB_FRAGS (2)
+/* one payload mbuf per frag, enough for a 64K TSO frame */
+#define MAX_SKB_FRAGS (65536/1448)
 #else
 #define MAX_SKB_FRAGS (1)
 #endif
@@ -1597,4 +1597,8 @@ int tcpv4_offload_init(void);
 void tcp_v4_init(void);
 void tcp_init(void);
 
+/* implemented by the service: snd_nxt/snd_una moved, report tx timestamps */
+void user_on_tcp_data_sent(struct sock *sk);
+void user_on_tcp_data_acked(struct sock *sk);
+
 #endif	/* _TCP_H */
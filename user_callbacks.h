@@ -66,8 +66,32 @@ static inline __attribute__ ((always_inline)) void user_on_transmission_opportun
         if(sock->sk->sk_state == TCP_LISTEN) {
            printf("%s %d\n",__FILE__,__LINE__);exit(0);
         }
+
+        if(unlikely(((socket_satelite_data_t *)socket_satelite_data)->splice_state != IPAUGENBLICK_SPLICE_NONE)) {
+            if(((socket_satelite_data_t *)socket_satelite_data)->splice_state == IPAUGENBLICK_SPLICE_ACTIVE)
+                ipaugenblick_splice_move(socket_satelite_data);
+            return;
+        }
         
-        if(sock->type == SOCK_STREAM) {
+        if((sock->type == SOCK_STREAM)&&(((socket_satelite_data_t *)socket_satelite_data)->sendfile)) {
+            ipaugenblick_sendfile_t *sendfile = ((socket_satelite_data_t *)socket_satelite_data)->sendfile;
+            /* file is read only as fast as the socket's send buffer drains */
+            while((!ipaugenblick_sendfile_done(sendfile))&&(sk_stream_memory_free(sock->sk))) {
+                i = kernel_sendpage(sock, &page, 0/*offset*/,IPAUGENBLICK_SENDFILE_SEG_SIZE, 0 /*flags*/);
+                if(i <= 0)
+                    break;
+            }
+            if(ipaugenblick_sendfile_done(sendfile)) {
+                ipaugenblick_sendfile_close(sendfile);
+                ((socket_satelite_data_t *)socket_satelite_data)->sendfile = NULL;
+                ipaugenblick_mark_sendfile_done(socket_satelite_data,ipaugenblick_sendfile_status(sendfile),sendfile->sent);
+                ipaugenblick_mark_writable(socket_satelite_data);
+            }
+            else {
+                user_on_tx_opportunity_socket_full++;
+            }
+        }
+        else if(sock->type == SOCK_STREAM) {
             ring_entries = ipaugenblick_tx_buf_count(socket_satelite_data);
             if(ring_entries == 0) {
                 ipaugenblick_mark_writable(socket_satelite_data);
@@ -78,6 +102,7 @@ static inline __attribute__ ((always_inline)) void user_on_transmission_opportun
                 i = kernel_sendpage(sock, &page, 0/*offset*/,ring_entries<<10, 0 /*flags*/);
                 ring_entries = ipaugenblick_tx_buf_count(socket_satelite_data);
             }while((i > 0)&&(ring_entries > 0));
+            ipaugenblick_return_tx_credits(socket_satelite_data);
             if(ring_entries == 0) {
                 ipaugenblick_mark_writable(socket_satelite_data);
             }
@@ -90,6 +115,8 @@ static inline __attribute__ ((always_inline)) void user_on_transmission_opportun
             struct iovec iov; 
             struct sock *sk = sock->sk;
             int dequeued,rc = 0,exhausted = 0;
+            uint64_t tag;
+            int tstamp_pending;
 
             msghdr.msg_namelen = sizeof(struct sockaddr_in);
             msghdr.msg_iov = &iov;
@@ -120,9 +147,15 @@ static inline __attribute__ ((always_inline)) void user_on_transmission_opportun
                            msghdr.msg_name = NULL;
 
                         iov.head = mbuf[i]; 
+                        tag = IPAUGENBLICK_MBUF_TX_TAG(mbuf[i]);
+                        tstamp_pending = 0;
+                        if(unlikely(tag))
+                            tstamp_pending = !ipaugenblick_tx_tstamp_scheduled(socket_satelite_data,tag,0);
                 
                         rc = udp_sendmsg(NULL, sk, &msghdr, mbuf[i]->pkt.data_len);
                         exhausted |= !(rc > 0);
+                        if(unlikely(tstamp_pending))
+                            ipaugenblick_tx_tstamp_datagram_sent(socket_satelite_data,rc > 0);
                         if(exhausted) {
                             user_on_tx_opportunity_api_failed += dequeued - i;
                             for(;i < dequeued;i++) {
@@ -137,6 +170,7 @@ static inline __attribute__ ((always_inline)) void user_on_transmission_opportun
                     user_on_tx_opportunity_api_nothing_to_tx++;
                 }
             }while((dequeued > 0) && (!exhausted));
+            ipaugenblick_return_tx_credits(socket_satelite_data);
             if(!exhausted)//may write more
                 ipaugenblick_mark_writable(socket_satelite_data);
         }
@@ -182,7 +216,8 @@ static inline __attribute__ ((always_inline)) void user_data_available_cbk(struc
     
     user_rx_ring_full += !ring_free;
     while(ring_free > 0) {
-        if(unlikely(kernel_recvmsg(sock, &msg,&vec, 1 /*num*/, ring_free*1448 /*size*/, 0 /*flags*/)) <= 0) {
+        /* a datagram takes one ring entry whatever its size (jumbo ones arrive as chains) */
+        if(unlikely(kernel_recvmsg(sock, &msg,&vec, 1 /*num*/, (sock->type == SOCK_STREAM) ? ring_free*1448 : 0xFFFF /*size*/, 0 /*flags*/)) <= 0) {
             exhausted = 1;
             break;
         }
@@ -206,7 +241,18 @@ static inline __attribute__ ((always_inline)) void user_data_available_cbk(struc
 
     user_on_rx_opportunity_called_exhausted += exhausted; 
     if((!exhausted)&&(!ring_free)) { 
-        ipaugenblick_mark_readable(socket_satelite_data);
+        if(((socket_satelite_data_t *)socket_satelite_data)->shared_rx)
+            ipaugenblick_shared_rx_block(socket_satelite_data);
+        else
+            ipaugenblick_mark_readable(socket_satelite_data);
+    }
+    else if((exhausted)&&(sock->sk->sk_state != TCP_ESTABLISHED)) {
+        /* nothing more will come, don't hold buffers below rx_lowat */
+        ipaugenblick_flush_readable(socket_satelite_data);
+    }
+    /* app made room in rx ring, pull what the local peer has sent */
+    if(unlikely(((socket_satelite_data_t *)socket_satelite_data)->splice_state == IPAUGENBLICK_SPLICE_ACTIVE)) {
+        ipaugenblick_splice_move(((socket_satelite_data_t *)socket_satelite_data)->splice_peer);
     }
 }
 static inline __attribute__ ((always_inline)) void user_on_socket_fatal(struct socket *sock)
@@ -19,11 +19,32 @@ static inline __attribute__ ((always_inline)) struct rte_mbuf *user_get_buffer(s
     struct rte_mbuf *mbuf, *first = NULL,*prev;
     void *socket_satelite_data;
     unsigned int i=0;
+    uint32_t taken = 0; /* bytes this call put in the skb so far, past write_seq */
 
     user_on_tx_opportunity_getbuff_called++;
     if(sk->sk_socket == NULL)
         return NULL;
     socket_satelite_data = sk->sk_user_data;
+
+    if(((socket_satelite_data_t *)socket_satelite_data)->sendfile) {
+        /* same batching as the app's buffers below, but at least one buffer so the file always advances */
+        do {
+            mbuf = ipaugenblick_sendfile_get_buffer(((socket_satelite_data_t *)socket_satelite_data)->sendfile);
+            if(!mbuf)
+                return first;
+            (*copy) -= mbuf->pkt.data_len;
+            if(!first)
+                first = mbuf;
+            else
+                prev->pkt.next = mbuf;
+            prev = mbuf;
+            user_on_tx_opportunity_api_mbufs_sent++;
+#ifndef GSO
+            break;
+#endif
+        }while(*copy > 1448);
+        return first;
+    }
     
     while(*copy > 1448) {
         mbuf = ipaugenblick_dequeue_tx_buf(socket_satelite_data);
@@ -31,14 +52,31 @@ static inline __attribute__ ((always_inline)) struct rte_mbuf *user_get_buffer(s
             user_on_tx_opportunity_cannot_get_buff++;
             return first;
         }
+        if(unlikely(IPAUGENBLICK_MBUF_TX_TAG(mbuf))) {
+            struct rte_mbuf *seg;
+            uint32_t end_seq = tcp_sk(sk)->write_seq + taken;
+            for(seg = mbuf;seg;seg = seg->pkt.next)
+                end_seq += seg->pkt.data_len;
+            ipaugenblick_tx_tstamp_scheduled(socket_satelite_data,IPAUGENBLICK_MBUF_TX_TAG(mbuf),end_seq);
+        }
         (*copy) -= mbuf->pkt.data_len;
+        taken += mbuf->pkt.data_len;
         if(!first)
             first = mbuf;
         else
             prev->pkt.next = mbuf;
         prev = mbuf;
         user_on_tx_opportunity_api_mbufs_sent++;
+#ifdef GSO
+        /* TSO: keep filling the skb up to size_goal */
+        while(prev->pkt.next) {
+            prev = prev->pkt.next;
+            (*copy) -= prev->pkt.data_len;
+            taken += prev->pkt.data_len;
+        }
+#else
         break;
+#endif
     }
     return first;
 }